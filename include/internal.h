@@ -1,9 +1,169 @@
 #ifndef _LIBNETFILTER_LOG_INTERNAL_H
 #define _LIBNETFILTER_LOG_INTERNAL_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+
 struct nflog_data
 {
 	struct nfattr **nfa;
+	struct nflog_g_handle *gh;	/* NULL if not received via a handle */
+};
+
+struct nflog_prefix_slot;
+struct nflog_prefix_entry;
+
+struct nflog_prefix_table
+{
+	struct nflog_prefix_slot *slots;
+	struct nflog_prefix_entry *entries;
+	unsigned int size;
+	unsigned int count;
+	unsigned int last;		/* id + 1 of the last lookup, 0 if none */
+};
+
+int __nflog_prefix_intern(struct nflog_prefix_table *t, const char *str,
+			  size_t len);
+const char *__nflog_prefix_name(const struct nflog_prefix_table *t,
+				unsigned int id);
+void __nflog_prefix_table_free(struct nflog_prefix_table *t);
+
+struct nflog_recv
+{
+	enum nflog_recv_mode mode;
+	uint64_t spin_ns;
+	uint64_t gap_ns;		/* average time between datagrams */
+	uint64_t last;			/* when the last batch arrived */
+	char *buf;			/* NFLOG_RECV_BATCH slots */
+	size_t slot;
+	size_t want;			/* after a truncated datagram */
+};
+
+struct nflog_shed
+{
+	int enabled;
+	struct nflog_overload cfg;
+	uint8_t mode;			/* to restore */
+	uint32_t range;
+	unsigned int level;
+	uint64_t pressure;		/* last time we were under pressure */
+	uint64_t step;			/* last transition */
+	uint64_t down;
+	uint64_t up;
+	time_t changed;
+};
+
+struct nflog_range
+{
+	enum nflog_range_mode mode;
+	uint32_t hwm;			/* furthest byte read in this window */
+	uint32_t samples;
+	int starved;			/* a payload cut short was read whole */
+	uint32_t proposal;		/* from the last window, 0 if none */
+	int pending;			/* to be applied */
 };
 
+struct nflog_fair_queue
+{
+	int enabled;
+	struct nflog_fair cfg;
+	char *buf;			/* messages, from head to tail */
+	size_t head;
+	size_t tail;
+	size_t size;
+	uint32_t queued;
+	int64_t deficit;		/* dispatch time left this round */
+	uint64_t spent;			/* in this nflog_process() call */
+	uint64_t dispatched;
+	uint64_t dropped;
+	uint64_t busy_ns;
+};
+
+struct nflog_handle
+{
+	struct nfnl_handle *nfnlh;
+	struct nfnl_subsys_handle *nfnlssh;
+	struct nflog_g_handle *gh_list;
+	struct nflog_prefix_table prefixes;
+	int node;			/* NUMA node we run on, -1 if unknown */
+	uint32_t nlbufsiz;		/* largest set via nflog_set_nlbufsiz() */
+	struct nflog_recv recv;
+	struct nflog_stats stats;
+	uint64_t tune_next;		/* next automatic nflog_retune() */
+	unsigned int shed_groups;	/* with load shedding enabled */
+	uint64_t shed_next;		/* next nflog_overload_check() */
+	int range_pending;		/* some group has a range to apply */
+	unsigned int fair_groups;	/* with fair dispatch enabled */
+	uint32_t fair_queued;		/* messages in the group queues */
+	int dispatching;		/* in __nflog_fair_dispatch() */
+	struct nflog_peer *peer;	/* standing in for the kernel */
+	int capture_fd;			/* -1 unless capturing */
+};
+
+struct nflog_g_handle
+{
+	struct nflog_g_handle *next;
+	struct nflog_handle *h;
+	uint16_t id;
+
+	nflog_callback *cb;
+	void *data;
+
+	uint8_t copy_mode;		/* as set via nflog_set_mode() */
+	uint32_t copy_range;
+
+	struct nflog_tuning tuning;
+	unsigned int tune_flags;
+	uint64_t obs_start;		/* what arrived since then */
+	uint64_t obs_msgs;
+	uint64_t obs_bytes;
+
+	struct nflog_shed shed;
+	struct nflog_range range;
+	struct nflog_fair_queue fair;
+	int unbound;			/* freed once the dispatch is over */
+};
+
+void __nflog_autotune(struct nflog_handle *h, uint64_t now);
+
+size_t __nflog_pkt_extent(const struct nflog_pkt *pkt, size_t len);
+void __nflog_payload_consumed(struct nflog_data *nfad, size_t bytes,
+			      size_t len);
+void __nflog_range_update(struct nflog_handle *h);
+int __nflog_send_mode(struct nflog_g_handle *gh, uint8_t mode, uint32_t range);
+int __nflog_send_tuning(struct nflog_g_handle *gh,
+			const struct nflog_tuning *t);
+int __nflog_config_reply(struct nflog_handle *h, const struct nlmsghdr *nlh,
+			 size_t len);
+
+void __nflog_fair_enqueue(struct nflog_handle *h, char *buf, size_t len);
+void __nflog_fair_dispatch(struct nflog_handle *h);
+void __nflog_fair_free(struct nflog_g_handle *gh);
+void __nflog_gh_free(struct nflog_g_handle *gh);
+
+struct nflog_handle *__nflog_open_fd(int fd);
+int __nflog_peer_query(struct nflog_handle *h, struct nlmsghdr *nlh);
+void __nflog_peer_detach(struct nflog_peer *p);
+
+void __nflog_capture(struct nflog_handle *h, const char *buf, size_t len,
+		     uint64_t tstamp_ns, uint32_t flags);
+
+static inline uint64_t __nflog_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t __nflog_wall_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 #endif
@@ -22,7 +22,9 @@ struct nflog_handle;
 struct nflog_g_handle;
 struct nflog_data;
 
-extern int nflog_errno;
+/* per thread, like errno */
+extern int *__nflog_errno_location(void);
+#define nflog_errno (*__nflog_errno_location())
 
 extern struct nfnl_handle *nflog_nfnlh(struct nflog_handle *h);
 extern int nflog_fd(struct nflog_handle *h);
@@ -69,10 +71,13 @@ extern uint32_t nflog_get_physoutdev(struct nflog_data *nfad);
 extern struct nfulnl_msg_packet_hw *nflog_get_packet_hw(struct nflog_data *nfad);
 extern int nflog_get_payload(struct nflog_data *nfad, char **data);
 extern char *nflog_get_prefix(struct nflog_data *nfad);
+extern int nflog_get_prefix_id(struct nflog_data *nfad);
+extern const char *nflog_prefix_name(struct nflog_handle *h, int id);
 extern int nflog_get_uid(struct nflog_data *nfad, uint32_t *uid);
 extern int nflog_get_gid(struct nflog_data *nfad, uint32_t *gid);
 extern int nflog_get_seq(struct nflog_data *nfad, uint32_t *seq);
 extern int nflog_get_seq_global(struct nflog_data *nfad, uint32_t *seq);
+extern int nflog_data_layout(void);
 
 enum {
 	NFLOG_XML_PREFIX	= (1 << 0),
@@ -83,10 +88,375 @@ enum {
 	NFLOG_XML_PAYLOAD	= (1 << 5),
 	NFLOG_XML_TIME		= (1 << 6),
 	NFLOG_XML_CTID		= (1 << 7),
+	NFLOG_XML_PKT		= (1 << 8),
+	NFLOG_XML_ETH		= (1 << 9),
+	NFLOG_XML_CT		= (1 << 10),
+	NFLOG_XML_PREFIXID	= (1 << 11),
 	NFLOG_XML_ALL		= ~0U,
+	/* decoded fields, not implied by NFLOG_XML_ALL */
+	NFLOG_XML_EXT		= NFLOG_XML_PKT | NFLOG_XML_ETH | NFLOG_XML_CT |
+				  NFLOG_XML_PREFIXID,
+	NFLOG_XML_ALL_EXT	= (1 << 12) - 1,
 };
 
 extern int nflog_snprintf_xml(char *buf, size_t len, struct nflog_data *tb, int flags);
+extern int nflog_snprintf_json(char *buf, size_t len, struct nflog_data *tb, int flags);
+
+/* output of the nflog_strbuf_append_*() printers, zeroed when empty */
+struct nflog_strbuf {
+	char	*data;		/* NUL terminated */
+	size_t	len;		/* without the NUL */
+	size_t	size;		/* allocated */
+};
+
+extern int nflog_strbuf_append_xml(struct nflog_strbuf *sb, struct nflog_data *tb, int flags);
+extern int nflog_strbuf_append_json(struct nflog_strbuf *sb, struct nflog_data *tb, int flags);
+extern void nflog_strbuf_release(struct nflog_strbuf *sb);
+
+union nflog_addr {
+	uint32_t	v4;
+	uint32_t	v6[4];
+};
+
+enum {
+	NFLOG_PKT_F_L4		= (1 << 0),
+	NFLOG_PKT_F_FRAG	= (1 << 1),
+	NFLOG_PKT_F_MF		= (1 << 2),
+	NFLOG_PKT_F_TRUNC	= (1 << 3),
+	NFLOG_PKT_F_EXTHDR	= (1 << 4),
+};
+
+enum nflog_encap {
+	NFLOG_ENCAP_NONE	= 0,
+	NFLOG_ENCAP_IPIP,
+	NFLOG_ENCAP_GRE,
+	NFLOG_ENCAP_VXLAN,
+	NFLOG_ENCAP_GENEVE,
+};
+
+struct nflog_pkt {
+	union nflog_addr	src;		/* network byte order */
+	union nflog_addr	dst;		/* network byte order */
+	uint32_t		frag_id;
+	uint32_t		tun_id;		/* GRE key, VXLAN/GENEVE VNI */
+	uint16_t		frag_off;	/* in bytes */
+	uint16_t		l3_offset;	/* from start of payload */
+	uint16_t		l4_offset;	/* from start of payload */
+	uint16_t		sport;		/* host byte order */
+	uint16_t		dport;		/* host byte order */
+	uint16_t		flags;		/* NFLOG_PKT_F_* */
+	uint8_t			family;		/* AF_INET or AF_INET6 */
+	uint8_t			l4proto;	/* IPPROTO_* */
+	uint8_t			ttl;
+	uint8_t			tcp_flags;
+	uint8_t			icmp_type;
+	uint8_t			icmp_code;
+	uint8_t			encap;		/* enum nflog_encap */
+};
+
+extern int nflog_payload_parse(const void *payload, size_t len, uint8_t family,
+			       struct nflog_pkt *pkt);
+extern int nflog_payload_parse_tunnel(const void *payload, size_t len,
+				      uint8_t family, struct nflog_pkt *pkt,
+				      unsigned int depth);
+
+#define NFLOG_ETH_VLAN_MAX	2
+
+struct nflog_eth {
+	uint8_t			dst[6];
+	uint8_t			src[6];
+	uint16_t		proto;		/* ethertype after the tags */
+	uint16_t		vlan_tpid[NFLOG_ETH_VLAN_MAX];
+	uint16_t		vlan_tci[NFLOG_ETH_VLAN_MAX];
+	uint8_t			vlan_count;
+	uint8_t			hdrlen;
+};
+
+extern int nflog_eth_parse(const void *hdr, size_t len, struct nflog_eth *eth);
+extern int nflog_get_eth(struct nflog_data *nfad, struct nflog_eth *eth);
+
+struct nflog_ct_tuple {
+	union nflog_addr	src;		/* network byte order */
+	union nflog_addr	dst;		/* network byte order */
+	uint16_t		sport;		/* or ICMP id, host byte order */
+	uint16_t		dport;		/* host byte order */
+	uint8_t			family;		/* AF_INET or AF_INET6 */
+	uint8_t			l4proto;	/* IPPROTO_* */
+	uint8_t			icmp_type;
+	uint8_t			icmp_code;
+};
+
+enum {
+	NFLOG_CT_F_ORIG		= (1 << 0),
+	NFLOG_CT_F_REPLY	= (1 << 1),
+	NFLOG_CT_F_STATUS	= (1 << 2),
+	NFLOG_CT_F_MARK		= (1 << 3),
+	NFLOG_CT_F_ZONE		= (1 << 4),
+	NFLOG_CT_F_ID		= (1 << 5),
+	NFLOG_CT_F_TIMEOUT	= (1 << 6),
+	NFLOG_CT_F_LABELS	= (1 << 7),
+};
+
+struct nflog_ct {
+	struct nflog_ct_tuple	orig;
+	struct nflog_ct_tuple	reply;
+	uint32_t		attrs;		/* NFLOG_CT_F_* */
+	uint32_t		status;		/* IPS_* */
+	uint32_t		mark;
+	uint32_t		id;
+	uint32_t		timeout;	/* in seconds */
+	uint16_t		zone;
+	uint8_t			labels[16];
+};
+
+extern int nflog_ct_parse(const void *payload, size_t len, struct nflog_ct *ct);
+extern int nflog_get_ct(struct nflog_data *nfad, struct nflog_ct *ct);
+extern int nflog_get_pkt(struct nflog_data *nfad, struct nflog_pkt *pkt,
+			 unsigned int depth);
+
+extern int nflog_place_cpus(struct nflog_handle *h, const char *cpulist);
+extern int nflog_place_node(struct nflog_handle *h, int node);
+extern int nflog_place_irq(struct nflog_handle *h, unsigned int irq);
+extern void *nflog_alloc_buf(struct nflog_handle *h, size_t size);
+extern void nflog_free_buf(void *buf, size_t size);
+
+#define NFLOG_RECV_BATCH	16
+
+enum nflog_recv_mode {
+	NFLOG_RECV_BLOCK	= 0,
+	NFLOG_RECV_BUSY_POLL,
+};
+
+#define NFLOG_HIST_BUCKETS	24
+
+struct nflog_stats {
+	uint64_t	datagrams;	/* received from the socket */
+	uint64_t	batches;	/* recvmmsg() calls that returned data */
+	uint64_t	spins;		/* empty polls while spinning */
+	uint64_t	yields;		/* empty polls followed by sched_yield() */
+	uint64_t	sleeps;		/* times we slept in poll() */
+	uint64_t	enobufs;	/* socket buffer overruns */
+	uint64_t	truncated;	/* datagrams larger than the buffer */
+	uint64_t	captured;	/* see nflog_set_capture() */
+	uint64_t	overload_down;	/* see nflog_set_overload() */
+	uint64_t	overload_up;
+	uint64_t	config_errors;	/* receive path requests that failed */
+	/* filled by nflog_nlmsg_account() */
+	uint64_t	messages;
+	uint64_t	bytes;
+	uint64_t	msgs_hist[NFLOG_HIST_BUCKETS];	/* per datagram, log2 */
+	uint64_t	bytes_hist[NFLOG_HIST_BUCKETS];	/* per datagram, log2 */
+};
+
+extern int nflog_set_recv_mode(struct nflog_handle *h,
+			       enum nflog_recv_mode mode, unsigned int spin_us);
+extern int nflog_process(struct nflog_handle *h);
+extern int nflog_recv(struct nflog_handle *h, char **buf);
+extern int nflog_get_stats(struct nflog_handle *h, struct nflog_stats *stats);
+extern unsigned int nflog_nlmsg_account(struct nflog_stats *stats,
+					const void *buf, size_t len);
+
+struct nflog_tuning {
+	/* workload, set by the caller */
+	uint32_t	latency_ms;	/* maximum delay until delivery */
+	uint32_t	rate;		/* packets per second */
+	uint32_t	msgsize;	/* bytes per message, 0 to estimate */
+	/* parameters, filled in */
+	uint32_t	timeout;	/* see nflog_set_timeout() */
+	uint32_t	qthresh;	/* see nflog_set_qthresh() */
+	uint32_t	nlbufsiz;	/* see nflog_set_nlbufsiz() */
+	uint32_t	rcvbuf;		/* socket receive buffer */
+};
+
+enum {
+	NFLOG_TUNE_AUTO		= (1 << 0),
+};
+
+extern void nflog_calc_tuning(struct nflog_tuning *t);
+extern int nflog_tune(struct nflog_g_handle *gh, struct nflog_tuning *t,
+		      unsigned int flags);
+extern int nflog_retune(struct nflog_g_handle *gh);
+extern int nflog_get_tuning(struct nflog_g_handle *gh, struct nflog_tuning *t);
+
+enum {
+	NFLOG_FILTER_F_GROUP	= (1 << 0),
+	NFLOG_FILTER_F_MARK	= (1 << 1),
+	NFLOG_FILTER_F_PREFIX	= (1 << 2),
+	NFLOG_FILTER_F_HOOK	= (1 << 3),
+	NFLOG_FILTER_F_INDEV	= (1 << 4),
+};
+
+#define NFLOG_FILTER_MARKS_MAX	4
+#define NFLOG_FILTER_PREFIX_MAX	64	/* including the terminating nul */
+#define NFLOG_FILTER_INSNS_MAX	128	/* enough for any filter */
+
+struct nflog_filter {
+	uint32_t	flags;		/* NFLOG_FILTER_F_*, fields to match */
+	uint16_t	group;
+	uint8_t		hook;
+	uint32_t	indev;
+	const char	*prefix;
+	unsigned int	nmarks;
+	struct {
+		uint32_t	min;
+		uint32_t	max;
+	} marks[NFLOG_FILTER_MARKS_MAX];
+};
+
+struct sock_filter;
+
+extern int nflog_filter_compile(const struct nflog_filter *f,
+				struct sock_filter *insns, unsigned int max);
+extern int nflog_attach_filter(struct nflog_handle *h,
+			       const struct nflog_filter *f);
+extern int nflog_detach_filter(struct nflog_handle *h);
+
+struct nflog_overload {
+	unsigned int	high;		/* backlog in % of rcvbuf to shed at */
+	unsigned int	low;		/* backlog in % of rcvbuf to restore at */
+	unsigned int	hold_ms;	/* calm period before each restore step */
+	uint32_t	min_range;	/* smallest range before COPY_META */
+};
+
+struct nflog_overload_state {
+	unsigned int	level;		/* 0 if running with the set mode */
+	uint8_t		copy_mode;	/* currently applied */
+	uint32_t	copy_range;
+	uint64_t	down;		/* transitions to a cheaper mode */
+	uint64_t	up;		/* transitions back */
+	time_t		changed;	/* time of the last transition */
+};
+
+extern int nflog_set_overload(struct nflog_g_handle *gh,
+			      const struct nflog_overload *cfg);
+extern int nflog_overload_check(struct nflog_handle *h, int overrun);
+extern int nflog_get_overload(struct nflog_g_handle *gh,
+			      struct nflog_overload_state *st);
+
+#define NFLOG_RANGE_WINDOW	1024	/* packets per evaluation */
+
+enum nflog_range_mode {
+	NFLOG_RANGE_OFF		= 0,
+	NFLOG_RANGE_PROPOSE,
+	NFLOG_RANGE_APPLY,
+};
+
+extern int nflog_set_adaptive_range(struct nflog_g_handle *gh,
+				    enum nflog_range_mode mode);
+extern void nflog_payload_consumed(struct nflog_data *nfad, size_t bytes);
+extern int nflog_get_range_proposal(struct nflog_g_handle *gh,
+				    uint32_t *range);
+
+struct nflog_fair {
+	unsigned int	weight;		/* share of the dispatch time */
+	unsigned int	budget_us;	/* per nflog_process() call, 0 for none */
+	uint32_t	queue_max;	/* bytes queued before dropping */
+};
+
+struct nflog_fair_state {
+	uint32_t	queued;		/* messages waiting for the callback */
+	uint32_t	queued_bytes;
+	uint64_t	dispatched;
+	uint64_t	dropped;	/* because the queue was full */
+	uint64_t	busy_ns;	/* time spent in the callback */
+};
+
+extern int nflog_set_fair(struct nflog_g_handle *gh,
+			  const struct nflog_fair *cfg);
+extern int nflog_get_fair(struct nflog_g_handle *gh,
+			  struct nflog_fair_state *st);
+
+#define NFLOG_HANDOFF_GROUPS_MAX	256
+
+extern struct nflog_handle *nflog_open_fd(int fd);
+extern struct nflog_g_handle *nflog_adopt_group(struct nflog_handle *h,
+						uint16_t num);
+extern int nflog_export(struct nflog_handle *h, int sock);
+extern struct nflog_handle *nflog_import(int sock);
+
+struct nflog_ring;
+
+#define NFLOG_RING_PREFIX_LEN	64
+#define NFLOG_RING_NONE		0xffffffff	/* uid or gid not known */
+
+struct nflog_ring_rec {
+	uint64_t	tstamp_ns;	/* from the kernel, 0 if not stamped */
+	uint32_t	len;		/* of the record, payload included */
+	uint16_t	group;
+	uint16_t	hw_protocol;	/* host byte order */
+	uint8_t		hook;
+	uint8_t		pad[3];
+	uint32_t	mark;
+	uint32_t	indev;
+	uint32_t	outdev;
+	uint32_t	uid;
+	uint32_t	gid;
+	uint32_t	seq;
+	uint32_t	payload_len;	/* as received from the kernel */
+	uint32_t	caplen;		/* bytes of payload in the record */
+	char		prefix[NFLOG_RING_PREFIX_LEN];
+	uint8_t		payload[];
+};
+
+extern struct nflog_ring *nflog_ring_create(const char *name,
+					    unsigned int slots,
+					    unsigned int slot_size);
+extern struct nflog_ring *nflog_ring_attach(const char *name);
+extern void nflog_ring_close(struct nflog_ring *r);
+extern unsigned int nflog_ring_slot_size(const struct nflog_ring *r);
+extern int nflog_ring_publish(struct nflog_ring *r, struct nflog_data *nfad);
+extern int nflog_ring_read(struct nflog_ring *r, void *buf, size_t len);
+extern uint64_t nflog_ring_lost(const struct nflog_ring *r);
+extern uint64_t nflog_ring_lag(const struct nflog_ring *r);
+
+struct nflog_peer;
+
+struct nflog_peer_group {
+	uint32_t	copy_range;
+	uint32_t	nlbufsiz;
+	uint32_t	timeout;	/* in 1/100 s */
+	uint32_t	qthresh;
+	uint16_t	flags;		/* NFULNL_CFG_F_* */
+	uint8_t		copy_mode;
+	uint64_t	messages;	/* sent to the handle */
+	uint64_t	datagrams;
+	uint64_t	dropped;	/* did not fit in the socket buffer */
+};
+
+extern struct nflog_peer *nflog_peer_create(void);
+extern void nflog_peer_destroy(struct nflog_peer *p);
+extern struct nflog_handle *nflog_open_peer(struct nflog_peer *p);
+extern int nflog_peer_inject(struct nflog_peer *p, uint16_t group,
+			     const void *payload, size_t len);
+extern int nflog_peer_set_traffic(struct nflog_peer *p, uint16_t group,
+				  uint32_t rate, const void *payload,
+				  size_t len);
+extern int nflog_peer_service(struct nflog_peer *p);
+extern int nflog_peer_process(struct nflog_handle *h);
+extern int nflog_peer_get_group(struct nflog_peer *p, uint16_t group,
+				struct nflog_peer_group *st);
+
+#define NFLOG_CAPTURE_MAGIC	0x6e666c63	/* "nflc" */
+#define NFLOG_CAPTURE_VERSION	1
+
+/* all in host byte order */
+struct nflog_capture_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	reserved;
+};
+
+#define NFLOG_CAPTURE_F_TRUNC	(1 << 0)	/* len is what was received */
+
+struct nflog_capture_rec {
+	uint64_t	tstamp_ns;	/* arrival, CLOCK_REALTIME */
+	uint32_t	len;		/* of the datagram that follows */
+	uint32_t	flags;		/* NFLOG_CAPTURE_F_* */
+};
+
+#define NFLOG_CAPTURE_ALIGN(len)	(((len) + 7) & ~7)
+
+extern int nflog_set_capture(struct nflog_handle *h, int fd);
 
 extern struct nlmsghdr *
 nflog_nlmsg_put_header(char *buf, uint8_t type, uint8_t family, uint16_t gnum);
@@ -96,11 +466,15 @@ extern int nflog_nlmsg_parse(const struct nlmsghdr *nlh, struct nlattr **attr);
 
 enum nflog_output_type {
 	NFLOG_OUTPUT_XML	= 0,
+	NFLOG_OUTPUT_JSON	= 1,
 };
 
 int nflog_nlmsg_snprintf(char *buf, size_t bufsiz, const struct nlmsghdr *nlh,
 			 struct nlattr **attr, enum nflog_output_type type,
 			 uint32_t flags);
+int nflog_nlmsg_strbuf_append(struct nflog_strbuf *sb,
+			      const struct nlmsghdr *nlh, struct nlattr **attr,
+			      enum nflog_output_type type, uint32_t flags);
 
 #ifdef __cplusplus
 } /* extern "C" */
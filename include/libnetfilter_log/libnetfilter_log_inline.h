@@ -0,0 +1,232 @@
+/* libnetfilter_log_inline.h: inline accessors for the logged packet data
+ *
+ * This software may be used and distributed according to the terms
+ * of the GNU General Public License, incorporated herein by reference.
+ */
+
+#ifndef __LIBNETFILTER_LOG_INLINE_H
+#define __LIBNETFILTER_LOG_INLINE_H
+
+#include <string.h>
+#include <endian.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The nflog_get_*() functions are calls into the library for what comes
+ * down to a load and a byte swap. These do the same inline, on the layout
+ * below, which the library only changes along with NFLOG_DATA_LAYOUT.
+ * Check nflog_inline_usable() once before using them: the library that is
+ * loaded at run time may not be the one these were compiled against.
+ */
+#define NFLOG_DATA_LAYOUT	1
+
+/* struct nflog_data, as of layout 1 */
+struct nflog_data_layout {
+	struct nlattr	**attr;		/* [NFULA_* - 1], NULL if not there */
+	void		*gh;
+};
+
+static inline int nflog_inline_usable(void)
+{
+	return nflog_data_layout() == NFLOG_DATA_LAYOUT;
+}
+
+/* the attribute if it carries at least _len_ bytes, NULL otherwise */
+static inline struct nlattr *
+__nflog_inline_attr(struct nflog_data *nfad, int type, size_t len)
+{
+	struct nlattr *attr =
+		((struct nflog_data_layout *)nfad)->attr[type - 1];
+
+	if (!attr || attr->nla_len < NLA_HDRLEN + len)
+		return NULL;
+	return attr;
+}
+
+static inline void *__nflog_inline_data(struct nlattr *attr)
+{
+	return (char *)attr + NLA_HDRLEN;
+}
+
+static inline uint32_t __nflog_inline_u32(struct nflog_data *nfad, int type)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, type, sizeof(uint32_t));
+	uint32_t v;
+
+	if (!attr)
+		return 0;
+	memcpy(&v, __nflog_inline_data(attr), sizeof(v));
+	return ntohl(v);
+}
+
+static inline uint16_t __nflog_inline_u16(struct nflog_data *nfad, int type)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, type, sizeof(uint16_t));
+	uint16_t v;
+
+	if (!attr)
+		return 0;
+	memcpy(&v, __nflog_inline_data(attr), sizeof(v));
+	return ntohs(v);
+}
+
+static inline int __nflog_inline_opt_u32(struct nflog_data *nfad, int type,
+					 uint32_t *v)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, type, sizeof(uint32_t));
+
+	if (!attr)
+		return -1;
+	memcpy(v, __nflog_inline_data(attr), sizeof(*v));
+	*v = ntohl(*v);
+	return 0;
+}
+
+/* as nflog_get_msg_packet_hdr() */
+static inline struct nfulnl_msg_packet_hdr *
+nflog_inline_get_msg_packet_hdr(struct nflog_data *nfad)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, NFULA_PACKET_HDR,
+					sizeof(struct nfulnl_msg_packet_hdr));
+
+	return attr ? (struct nfulnl_msg_packet_hdr *)
+		      __nflog_inline_data(attr) : NULL;
+}
+
+/* as nflog_get_hwtype() */
+static inline uint16_t nflog_inline_get_hwtype(struct nflog_data *nfad)
+{
+	return __nflog_inline_u16(nfad, NFULA_HWTYPE);
+}
+
+/* as nflog_get_msg_packet_hwhdrlen() */
+static inline uint16_t
+nflog_inline_get_msg_packet_hwhdrlen(struct nflog_data *nfad)
+{
+	return __nflog_inline_u16(nfad, NFULA_HWLEN);
+}
+
+/* as nflog_get_msg_packet_hwhdr() */
+static inline char *nflog_inline_get_msg_packet_hwhdr(struct nflog_data *nfad)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, NFULA_HWHEADER, 0);
+
+	return attr ? (char *)__nflog_inline_data(attr) : NULL;
+}
+
+/* as nflog_get_nfmark() */
+static inline uint32_t nflog_inline_get_nfmark(struct nflog_data *nfad)
+{
+	return __nflog_inline_u32(nfad, NFULA_MARK);
+}
+
+/* as nflog_get_timestamp() */
+static inline int nflog_inline_get_timestamp(struct nflog_data *nfad,
+					     struct timeval *tv)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, NFULA_TIMESTAMP,
+				sizeof(struct nfulnl_msg_packet_timestamp));
+	uint64_t v[2];
+
+	if (!attr)
+		return -1;
+
+	memcpy(v, __nflog_inline_data(attr), sizeof(v));
+	tv->tv_sec = be64toh(v[0]);
+	tv->tv_usec = be64toh(v[1]);
+	return 0;
+}
+
+/* as nflog_get_indev() */
+static inline uint32_t nflog_inline_get_indev(struct nflog_data *nfad)
+{
+	return __nflog_inline_u32(nfad, NFULA_IFINDEX_INDEV);
+}
+
+/* as nflog_get_physindev() */
+static inline uint32_t nflog_inline_get_physindev(struct nflog_data *nfad)
+{
+	return __nflog_inline_u32(nfad, NFULA_IFINDEX_PHYSINDEV);
+}
+
+/* as nflog_get_outdev() */
+static inline uint32_t nflog_inline_get_outdev(struct nflog_data *nfad)
+{
+	return __nflog_inline_u32(nfad, NFULA_IFINDEX_OUTDEV);
+}
+
+/* as nflog_get_physoutdev() */
+static inline uint32_t nflog_inline_get_physoutdev(struct nflog_data *nfad)
+{
+	return __nflog_inline_u32(nfad, NFULA_IFINDEX_PHYSOUTDEV);
+}
+
+/* as nflog_get_packet_hw() */
+static inline struct nfulnl_msg_packet_hw *
+nflog_inline_get_packet_hw(struct nflog_data *nfad)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, NFULA_HWADDR,
+					sizeof(struct nfulnl_msg_packet_hw));
+
+	return attr ? (struct nfulnl_msg_packet_hw *)
+		      __nflog_inline_data(attr) : NULL;
+}
+
+/* as nflog_get_payload() */
+static inline int nflog_inline_get_payload(struct nflog_data *nfad,
+					   char **data)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, NFULA_PAYLOAD, 0);
+
+	if (!attr) {
+		*data = NULL;
+		return -1;
+	}
+	*data = (char *)__nflog_inline_data(attr);
+	return attr->nla_len - NLA_HDRLEN;
+}
+
+/* as nflog_get_prefix() */
+static inline char *nflog_inline_get_prefix(struct nflog_data *nfad)
+{
+	struct nlattr *attr = __nflog_inline_attr(nfad, NFULA_PREFIX, 0);
+
+	return attr ? (char *)__nflog_inline_data(attr) : NULL;
+}
+
+/* as nflog_get_uid() */
+static inline int nflog_inline_get_uid(struct nflog_data *nfad, uint32_t *uid)
+{
+	return __nflog_inline_opt_u32(nfad, NFULA_UID, uid);
+}
+
+/* as nflog_get_gid() */
+static inline int nflog_inline_get_gid(struct nflog_data *nfad, uint32_t *gid)
+{
+	return __nflog_inline_opt_u32(nfad, NFULA_GID, gid);
+}
+
+/* as nflog_get_seq() */
+static inline int nflog_inline_get_seq(struct nflog_data *nfad, uint32_t *seq)
+{
+	return __nflog_inline_opt_u32(nfad, NFULA_SEQ, seq);
+}
+
+/* as nflog_get_seq_global() */
+static inline int nflog_inline_get_seq_global(struct nflog_data *nfad,
+					      uint32_t *seq)
+{
+	return __nflog_inline_opt_u32(nfad, NFULA_SEQ_GLOBAL, seq);
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif	/* __LIBNETFILTER_LOG_INLINE_H */
@@ -0,0 +1,128 @@
+/* capture.c: record the datagrams received on a handle
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Capture Capture functions
+ *
+ * Reproducing a problem seen in production, or benchmarking a consumer
+ * against real traffic, takes the exact byte stream the kernel sent. Once
+ * capture is enabled on a handle via nflog_set_capture(), the datagrams
+ * received by nflog_process() and nflog_recv() are written to a file as
+ * they are, along with the time they arrived, before being handled.
+ *
+ * The file starts with a struct nflog_capture_hdr, followed by one struct
+ * nflog_capture_rec per datagram, each followed by the datagram, padded to
+ * NFLOG_CAPTURE_ALIGN() bytes. All fields are in host byte order. The
+ * nf-log-replay utility feeds a capture back to nflog_handle_packet() or to
+ * the libmnl parser, at the original speed or faster.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+static int capture_write(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t ret;
+
+	while (cnt) {
+		ret = writev(fd, iov, cnt);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+
+		/* short write, eg. to a pipe: go on from where it stopped */
+		while (cnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * nflog_set_capture - write the datagrams received on a handle to a file
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param fd file to write to, or -1 to stop
+ *
+ * This writes the header of the capture to \b fd, then a record for every
+ * datagram received by nflog_process() or nflog_recv() until capture is
+ * stopped. Applications that receive by other means, eg. __recv__(2) on
+ * nflog_fd(), are not captured. The handle does not own \b fd, it is not
+ * closed when the capture stops.
+ *
+ * Should writing a record fail, the capture stops; the number of datagrams
+ * written is returned by nflog_get_stats().
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * as for __write__(2)
+ */
+int nflog_set_capture(struct nflog_handle *h, int fd)
+{
+	struct nflog_capture_hdr hdr = {
+		.magic		= NFLOG_CAPTURE_MAGIC,
+		.version	= NFLOG_CAPTURE_VERSION,
+	};
+	struct iovec iov = {
+		.iov_base	= &hdr,
+		.iov_len	= sizeof(hdr),
+	};
+
+	h->capture_fd = -1;
+	if (fd < 0)
+		return 0;
+
+	if (capture_write(fd, &iov, 1) < 0)
+		return -1;
+
+	h->capture_fd = fd;
+	return 0;
+}
+
+void __nflog_capture(struct nflog_handle *h, const char *buf, size_t len,
+		     uint64_t tstamp_ns, uint32_t flags)
+{
+	static const char pad[NFLOG_CAPTURE_ALIGN(1)];
+	struct nflog_capture_rec rec = {
+		.tstamp_ns	= tstamp_ns,
+		.len		= len,
+		.flags		= flags,
+	};
+	struct iovec iov[3] = {
+		{ .iov_base = &rec,		.iov_len = sizeof(rec) },
+		{ .iov_base = (char *)buf,	.iov_len = len },
+		{ .iov_base = (char *)pad,
+		  .iov_len = NFLOG_CAPTURE_ALIGN(len) - len },
+	};
+
+	if (capture_write(h->capture_fd, iov, 3) < 0) {
+		h->capture_fd = -1;
+		return;
+	}
+	h->stats.captured++;
+}
+
+/**
+ * @}
+ */
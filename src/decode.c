@@ -0,0 +1,896 @@
+/* decode.c: network and transport header decoding for logged payloads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/if_arp.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Decode Payload decoding functions
+ *
+ * The payload attached to a logged packet (see nflog_get_payload()) starts
+ * at the network header. The functions in this group decode the network and
+ * transport headers found there, as well as the link layer header that the
+ * kernel attaches to packets received on an Ethernet device and the
+ * conntrack entry attached when NFULNL_CFG_F_CONNTRACK is set (see
+ * nflog_set_flags()), into compact structures, so that consumers do not have
+ * to re-parse them by hand. They never allocate memory and only
+ * read the bytes that the kernel actually copied, so it is safe to use them
+ * on payloads that have been cut short via the range passed to
+ * nflog_set_mode().
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <netinet/in.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#define IP4_MF		0x2000
+#define IP4_OFFMASK	0x1fff
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/* bytes of the transport header we decode, 0 if the protocol is unknown */
+static size_t l4_need(uint8_t l4proto)
+{
+	switch (l4proto) {
+	case IPPROTO_TCP:
+		return 14;
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_SCTP:
+	case IPPROTO_DCCP:
+		return 4;
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		return 2;
+	}
+	return 0;
+}
+
+/* decode the transport header found at _l4_, _len_ bytes are available */
+static void decode_l4(struct nflog_pkt *pkt, const uint8_t *l4, size_t len)
+{
+	size_t need = l4_need(pkt->l4proto);
+
+	if (need == 0)
+		return;
+
+	if (len < need) {
+		pkt->flags |= NFLOG_PKT_F_TRUNC;
+		return;
+	}
+
+	if (need == 2) {
+		pkt->icmp_type = l4[0];
+		pkt->icmp_code = l4[1];
+	} else {
+		pkt->sport = get_u16(l4);
+		pkt->dport = get_u16(l4 + 2);
+		pkt->tcp_flags = need == 14 ? l4[13] : 0;
+	}
+	pkt->flags |= NFLOG_PKT_F_L4;
+}
+
+static int decode_ipv4(struct nflog_pkt *pkt, const uint8_t *p, size_t len)
+{
+	size_t hlen, tot_len;
+	uint16_t frag;
+
+	if (len < 20 || (p[0] >> 4) != 4)
+		goto err;
+
+	hlen = (p[0] & 0x0f) << 2;
+	if (hlen < 20)
+		goto err;
+
+	/* ignore link layer padding beyond the IP datagram */
+	tot_len = get_u16(p + 2);
+	if (tot_len >= hlen && tot_len < len)
+		len = tot_len;
+
+	pkt->family = AF_INET;
+	pkt->ttl = p[8];
+	pkt->l4proto = p[9];
+	memcpy(&pkt->src.v4, p + 12, sizeof(pkt->src.v4));
+	memcpy(&pkt->dst.v4, p + 16, sizeof(pkt->dst.v4));
+	pkt->l4_offset = hlen;
+
+	frag = get_u16(p + 6);
+	if (frag & (IP4_MF | IP4_OFFMASK)) {
+		pkt->flags |= NFLOG_PKT_F_FRAG;
+		pkt->flags |= (frag & IP4_MF) ? NFLOG_PKT_F_MF : 0;
+		pkt->frag_id = get_u16(p + 4);
+		pkt->frag_off = (frag & IP4_OFFMASK) << 3;
+	}
+
+	if (hlen > len) {
+		pkt->flags |= NFLOG_PKT_F_TRUNC;
+		return 0;
+	}
+
+	/* only the first fragment carries the transport header */
+	if (pkt->frag_off == 0)
+		decode_l4(pkt, p + hlen, len - hlen);
+
+	return 0;
+err:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Upper bound on the number of IPv6 extension headers that are walked. RFC
+ * 8200 recommends at most one of each kind plus a second destination options
+ * header, anything longer than this is not worth the cycles.
+ */
+#define IP6_EXTHDR_MAX	8
+
+#define IP6_OFFMASK	0xfff8
+#define IP6_MF		0x0001
+
+static int decode_ipv6(struct nflog_pkt *pkt, const uint8_t *p, size_t len)
+{
+	size_t tot_len, off, hlen;
+	uint16_t frag;
+	int i;
+
+	if (len < 40 || (p[0] >> 4) != 6)
+		goto err;
+
+	/* a zero payload length is used by jumbograms, keep what we have */
+	tot_len = 40 + get_u16(p + 4);
+	if (tot_len > 40 && tot_len < len)
+		len = tot_len;
+
+	pkt->family = AF_INET6;
+	pkt->l4proto = p[6];
+	pkt->ttl = p[7];
+	memcpy(pkt->src.v6, p + 8, sizeof(pkt->src.v6));
+	memcpy(pkt->dst.v6, p + 24, sizeof(pkt->dst.v6));
+
+	/*
+	 * Walk the extension header chain. Every header is bounds checked
+	 * against the copied length before it is read, and the walk stops
+	 * after IP6_EXTHDR_MAX headers, leaving _l4proto_ set to the header
+	 * that was not looked into.
+	 */
+	off = 40;
+	for (i = 0; i < IP6_EXTHDR_MAX; i++) {
+		switch (pkt->l4proto) {
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_DSTOPTS:
+			if (off + 2 > len)
+				goto trunc;
+			hlen = (p[off + 1] + 1) << 3;
+			break;
+		case IPPROTO_AH:
+			if (off + 2 > len)
+				goto trunc;
+			hlen = (p[off + 1] + 2) << 2;
+			break;
+		case IPPROTO_FRAGMENT:
+			if (off + 8 > len)
+				goto trunc;
+			hlen = 8;
+			frag = get_u16(p + off + 2);
+			pkt->flags |= NFLOG_PKT_F_FRAG;
+			pkt->flags |= (frag & IP6_MF) ? NFLOG_PKT_F_MF : 0;
+			pkt->frag_off = frag & IP6_OFFMASK;
+			memcpy(&pkt->frag_id, p + off + 4,
+			       sizeof(pkt->frag_id));
+			pkt->frag_id = ntohl(pkt->frag_id);
+			break;
+		default:
+			goto done;
+		}
+
+		if (off + hlen > len)
+			goto trunc;
+
+		pkt->flags |= NFLOG_PKT_F_EXTHDR;
+		pkt->l4proto = p[off];
+		off += hlen;
+
+		/* non-first fragments do not carry the upper layer header */
+		if (pkt->frag_off)
+			break;
+	}
+done:
+	pkt->l4_offset = off;
+
+	/* no-op if the walk stopped on an extension header */
+	if (pkt->frag_off == 0)
+		decode_l4(pkt, p + off, len - off);
+
+	return 0;
+trunc:
+	pkt->l4_offset = off;
+	pkt->flags |= NFLOG_PKT_F_TRUNC;
+	return 0;
+err:
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * nflog_payload_parse - decode the network and transport headers of a payload
+ * \param payload pointer to the logged payload (see nflog_get_payload())
+ * \param len length of the payload
+ * \param family protocol family of the logged packet, as found in the
+ * _nfgen_family_ field of the nfgenmsg header. AF_UNSPEC (or any family other
+ * than AF_INET and AF_INET6, e.g. NFPROTO_BRIDGE) makes the decoder guess the
+ * family from the IP version field.
+ * \param pkt structure to fill with the decoded information
+ *
+ * On success, _pkt_ is zeroed and then filled with the source and destination
+ * addresses, the transport protocol, the time to live (hop limit for IPv6)
+ * and the offset of the transport header within the payload. If the
+ * transport header is present and the protocol is known (TCP, UDP, UDP-Lite,
+ * SCTP, DCCP, ICMP or ICMPv6), ports, TCP flags or ICMP type and code are
+ * also decoded and the NFLOG_PKT_F_L4 flag is set.
+ *
+ * The following flags may be set in _pkt->flags_:
+ *
+ *	- NFLOG_PKT_F_L4: the transport header fields are valid
+ *	- NFLOG_PKT_F_FRAG: the packet is a fragment, see _frag_id_ and
+ *	  _frag_off_
+ *	- NFLOG_PKT_F_MF: more fragments follow this one
+ *	- NFLOG_PKT_F_TRUNC: the payload ends before the headers that the
+ *	  decoder was interested in
+ *	- NFLOG_PKT_F_EXTHDR: IPv6 extension headers were skipped to reach the
+ *	  transport header
+ *
+ * For IPv6, the hop-by-hop options, routing, fragment, destination options
+ * and authentication headers are walked to find the transport header. The
+ * walk is bounded to a handful of headers so that the cost per packet stays
+ * constant whatever the packet contains; if the chain is longer than that,
+ * _l4proto_ is left set to the first extension header that was not walked
+ * and NFLOG_PKT_F_L4 is not set. _l4_offset_ always points past the last
+ * header that was walked, and the fragment fields are filled in from the
+ * fragment header, if any.
+ *
+ * Addresses are stored in network byte order, ports in host byte order.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * \b EINVAL _payload_ does not start with a valid IP header
+ * \n
+ * \b EAFNOSUPPORT _family_ could not be resolved to AF_INET or AF_INET6
+ */
+int nflog_payload_parse(const void *payload, size_t len, uint8_t family,
+			struct nflog_pkt *pkt)
+{
+	const uint8_t *p = payload;
+
+	memset(pkt, 0, sizeof(*pkt));
+
+	if (family != AF_INET && family != AF_INET6) {
+		if (len == 0)
+			goto err_inval;
+
+		switch (p[0] >> 4) {
+		case 4:
+			family = AF_INET;
+			break;
+		case 6:
+			family = AF_INET6;
+			break;
+		default:
+			errno = EAFNOSUPPORT;
+			return -1;
+		}
+	}
+
+	if (family == AF_INET)
+		return decode_ipv4(pkt, p, len);
+
+	return decode_ipv6(pkt, p, len);
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+#define ETH_TPID_8021Q		0x8100
+#define ETH_TPID_8021AD		0x88a8
+#define ETH_TPID_QINQ		0x9100
+
+static int eth_parse(struct nflog_eth *eth, const uint8_t *p, size_t len)
+{
+	size_t off = 12;
+	uint16_t proto;
+
+	if (len < 14) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memcpy(eth->dst, p, sizeof(eth->dst));
+	memcpy(eth->src, p + 6, sizeof(eth->src));
+
+	proto = get_u16(p + off);
+	while ((proto == ETH_TPID_8021Q || proto == ETH_TPID_8021AD ||
+		proto == ETH_TPID_QINQ) &&
+	       eth->vlan_count < NFLOG_ETH_VLAN_MAX && off + 6 <= len) {
+		eth->vlan_tpid[eth->vlan_count] = proto;
+		eth->vlan_tci[eth->vlan_count] = get_u16(p + off + 2);
+		eth->vlan_count++;
+		off += 4;
+		proto = get_u16(p + off);
+	}
+	eth->proto = proto;
+	eth->hdrlen = off + 2;
+
+	return 0;
+}
+
+/**
+ * nflog_eth_parse - decode an Ethernet header and its VLAN tags
+ * \param hdr pointer to the link layer header
+ * \param len length of the link layer header
+ * \param eth structure to fill with the decoded information
+ *
+ * Decodes the destination and source MAC addresses and up to
+ * NFLOG_ETH_VLAN_MAX 802.1Q / 802.1ad tags, outermost first. The VLAN id of
+ * a tag is the lower 12 bits of its _vlan_tci_. _proto_ is set to the
+ * ethertype that follows the last decoded tag and _hdrlen_ to the number of
+ * bytes decoded. All integer fields are in host byte order.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * \b EINVAL _hdr_ is shorter than an Ethernet header
+ */
+int nflog_eth_parse(const void *hdr, size_t len, struct nflog_eth *eth)
+{
+	memset(eth, 0, sizeof(*eth));
+
+	return eth_parse(eth, hdr, len);
+}
+
+/**
+ * nflog_get_eth - decode the Ethernet header of a logged packet
+ * \param nfad Netlink packet data handle passed to callback function
+ * \param eth structure to fill with the decoded information
+ *
+ * Decodes the full link layer header that is attached to bridged packets,
+ * or the hardware header (see nflog_get_msg_packet_hwhdr()) of packets
+ * received on an Ethernet device otherwise. If the device stripped the
+ * outer VLAN tag, the kernel reports it separately and it is stored as the
+ * first tag of _eth_. See nflog_eth_parse() for the meaning of the fields.
+ *
+ * \return 0 on success, -1 if no Ethernet header is available or on failure
+ * with \b errno set.
+ * \par Errors
+ * \b EINVAL the header is shorter than an Ethernet header
+ */
+int nflog_get_eth(struct nflog_data *nfad, struct nflog_eth *eth)
+{
+	struct nlattr *hdr = (struct nlattr *)nfad->nfa[NFULA_L2HDR - 1];
+	struct nlattr *vlan = (struct nlattr *)nfad->nfa[NFULA_VLAN - 1];
+	struct nlattr *attr;
+
+	memset(eth, 0, sizeof(*eth));
+
+	if (!hdr) {
+		if (nflog_get_hwtype(nfad) != ARPHRD_ETHER)
+			return -1;
+		hdr = (struct nlattr *)nfad->nfa[NFULA_HWHEADER - 1];
+		if (!hdr)
+			return -1;
+	}
+
+	if (vlan) {
+		mnl_attr_for_each_nested(attr, vlan) {
+			if (mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
+				continue;
+
+			switch (mnl_attr_get_type(attr)) {
+			case NFULA_VLAN_PROTO:
+				eth->vlan_tpid[0] =
+					ntohs(mnl_attr_get_u16(attr));
+				break;
+			case NFULA_VLAN_TCI:
+				eth->vlan_tci[0] =
+					ntohs(mnl_attr_get_u16(attr));
+				break;
+			}
+		}
+		eth->vlan_count = 1;
+	}
+
+	return eth_parse(eth, mnl_attr_get_payload(hdr),
+			 mnl_attr_get_payload_len(hdr));
+}
+
+#define UDP_PORT_VXLAN		4789
+#define UDP_PORT_GENEVE		6081
+
+#define GRE_F_CSUM		0x8000
+#define GRE_F_KEY		0x2000
+#define GRE_F_SEQ		0x1000
+#define GRE_VERSION		0x0007
+
+#define ETH_P_TEB		0x6558
+
+/* map an ethertype to the protocol family of the header that follows */
+static uint8_t ethertype_family(uint16_t proto)
+{
+	switch (proto) {
+	case 0x0800:
+		return AF_INET;
+	case 0x86dd:
+		return AF_INET6;
+	}
+	return AF_UNSPEC;
+}
+
+/* skip the inner Ethernet header of a bridged tunnel, 0 if not IP */
+static size_t tunnel_eth(const uint8_t *p, size_t len, size_t off,
+			 uint8_t *family)
+{
+	struct nflog_eth eth = {};
+
+	if (eth_parse(&eth, p + off, len - off) < 0)
+		return 0;
+
+	*family = ethertype_family(eth.proto);
+	if (*family == AF_UNSPEC)
+		return 0;
+
+	return off + eth.hdrlen;
+}
+
+/*
+ * Look for a tunnel carried by _outer_, return the offset of the inner
+ * network header in _p_ or 0 if there is none that we know of.
+ */
+static size_t tunnel_inner(const struct nflog_pkt *outer, const uint8_t *p,
+			   size_t len, uint8_t *family, uint8_t *encap,
+			   uint32_t *id)
+{
+	size_t off = outer->l4_offset;
+	uint16_t flags, proto;
+
+	if (outer->flags & NFLOG_PKT_F_TRUNC || outer->frag_off)
+		return 0;
+
+	*id = 0;
+
+	switch (outer->l4proto) {
+	case IPPROTO_IPIP:
+	case IPPROTO_IPV6:
+		*encap = NFLOG_ENCAP_IPIP;
+		*family = outer->l4proto == IPPROTO_IPIP ? AF_INET : AF_INET6;
+		return off;
+	case IPPROTO_GRE:
+		if (off + 4 > len)
+			return 0;
+
+		flags = get_u16(p + off);
+		proto = get_u16(p + off + 2);
+		if (flags & GRE_VERSION)
+			return 0;
+
+		off += 4;
+		if (flags & GRE_F_CSUM)
+			off += 4;
+		if (flags & GRE_F_KEY) {
+			if (off + 4 > len)
+				return 0;
+			memcpy(id, p + off, sizeof(*id));
+			*id = ntohl(*id);
+			off += 4;
+		}
+		if (flags & GRE_F_SEQ)
+			off += 4;
+		if (off > len)
+			return 0;
+
+		*encap = NFLOG_ENCAP_GRE;
+		if (proto == ETH_P_TEB)
+			return tunnel_eth(p, len, off, family);
+
+		*family = ethertype_family(proto);
+		return *family == AF_UNSPEC ? 0 : off;
+	case IPPROTO_UDP:
+		if (!(outer->flags & NFLOG_PKT_F_L4))
+			return 0;
+
+		off += 8;
+		if (off + 8 > len)
+			return 0;
+
+		switch (outer->dport) {
+		case UDP_PORT_VXLAN:
+			/* the I flag must be set for the VNI to be valid */
+			if (!(p[off] & 0x08))
+				return 0;
+
+			*encap = NFLOG_ENCAP_VXLAN;
+			*id = p[off + 4] << 16 | p[off + 5] << 8 | p[off + 6];
+			return tunnel_eth(p, len, off + 8, family);
+		case UDP_PORT_GENEVE:
+			if (p[off] >> 6)
+				return 0;
+
+			*encap = NFLOG_ENCAP_GENEVE;
+			*id = p[off + 4] << 16 | p[off + 5] << 8 | p[off + 6];
+			proto = get_u16(p + off + 2);
+			off += 8 + ((p[off] & 0x3f) << 2);
+			if (off > len)
+				return 0;
+
+			if (proto == ETH_P_TEB)
+				return tunnel_eth(p, len, off, family);
+
+			*family = ethertype_family(proto);
+			return *family == AF_UNSPEC ? 0 : off;
+		}
+		break;
+	}
+	return 0;
+}
+
+/**
+ * nflog_payload_parse_tunnel - decode a payload and the tunnels it carries
+ * \param payload pointer to the logged payload (see nflog_get_payload())
+ * \param len length of the payload
+ * \param family protocol family of the logged packet, see
+ * nflog_payload_parse()
+ * \param pkt array of structures to fill, outermost header first
+ * \param depth number of elements in _pkt_, i.e. the maximum number of
+ * headers to decode
+ *
+ * Decodes the outer headers like nflog_payload_parse() does, then unwraps
+ * IP-in-IP (IPv4 or IPv6), GRE (including transparent Ethernet bridging),
+ * VXLAN (UDP port 4789) and GENEVE (UDP port 6081) tunnels and decodes the
+ * inner headers into the following elements of _pkt_, until _depth_ headers
+ * have been decoded or no known tunnel is found.
+ *
+ * For the inner headers, _encap_ tells which kind of tunnel carried them
+ * (one of NFLOG_ENCAP_*), _tun_id_ holds the GRE key or the VXLAN / GENEVE
+ * network identifier, if any, and _l3_offset_ and _l4_offset_ are relative
+ * to the start of _payload_. The outermost header has _encap_ set to
+ * NFLOG_ENCAP_NONE.
+ *
+ * \return the number of elements of _pkt_ that were filled (at least 1) on
+ * success, -1 on failure with \b errno set.
+ * \par Errors
+ * \b EINVAL _depth_ is zero or _payload_ does not start with a valid IP
+ * header
+ * \n
+ * \b EAFNOSUPPORT _family_ could not be resolved to AF_INET or AF_INET6
+ */
+int nflog_payload_parse_tunnel(const void *payload, size_t len, uint8_t family,
+			       struct nflog_pkt *pkt, unsigned int depth)
+{
+	const uint8_t *p = payload;
+	unsigned int n;
+	uint8_t encap;
+	uint32_t id;
+	size_t off;
+
+	if (depth == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (nflog_payload_parse(p, len, family, &pkt[0]) < 0)
+		return -1;
+
+	for (n = 1; n < depth; n++) {
+		off = tunnel_inner(&pkt[n - 1], p, len, &family, &encap, &id);
+		if (off == 0 || off >= len ||
+		    nflog_payload_parse(p + off, len - off, family,
+					&pkt[n]) < 0)
+			break;
+
+		pkt[n].encap = encap;
+		pkt[n].tun_id = id;
+		pkt[n].l3_offset = off;
+		pkt[n].l4_offset += off;
+	}
+
+	return n;
+}
+
+/* how far into the payload the decoder read to fill _pkt_ */
+size_t __nflog_pkt_extent(const struct nflog_pkt *pkt, size_t len)
+{
+	size_t extent = pkt->l4_offset;
+
+	if (pkt->flags & NFLOG_PKT_F_TRUNC)
+		return len;
+
+	if (pkt->flags & NFLOG_PKT_F_L4)
+		extent += l4_need(pkt->l4proto);
+
+	return extent < len ? extent : len;
+}
+
+/**
+ * nflog_get_pkt - decode the headers of a logged packet
+ * \param nfad Netlink packet data handle passed to callback function
+ * \param pkt array of _depth_ structures to fill
+ * \param depth maximum number of headers to decode, one to skip tunnels
+ *
+ * This is nflog_payload_parse_tunnel() on the payload of the packet (see
+ * nflog_get_payload()), with the family taken from the hardware protocol
+ * of the packet. It also tells the library how much of the payload has been
+ * used, see nflog_set_adaptive_range().
+ *
+ * \return as for nflog_payload_parse_tunnel()
+ * \par Errors
+ * \b ENOENT there is no payload
+ * \n as for nflog_payload_parse_tunnel()
+ */
+int nflog_get_pkt(struct nflog_data *nfad, struct nflog_pkt *pkt,
+		  unsigned int depth)
+{
+	struct nlattr *attr = (struct nlattr *)nfad->nfa[NFULA_PAYLOAD - 1];
+	struct nlattr *hdr = (struct nlattr *)nfad->nfa[NFULA_PACKET_HDR - 1];
+	uint8_t family = AF_UNSPEC;
+	size_t len;
+	int n;
+
+	if (!attr) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (hdr && mnl_attr_get_payload_len(hdr) >=
+		   sizeof(struct nfulnl_msg_packet_hdr)) {
+		const struct nfulnl_msg_packet_hdr *ph =
+			mnl_attr_get_payload(hdr);
+
+		family = ethertype_family(ntohs(ph->hw_protocol));
+	}
+
+	len = mnl_attr_get_payload_len(attr);
+	n = nflog_payload_parse_tunnel(mnl_attr_get_payload(attr), len, family,
+				       pkt, depth);
+	if (n > 0)
+		__nflog_payload_consumed(nfad,
+					 __nflog_pkt_extent(&pkt[n - 1], len),
+					 len);
+	return n;
+}
+
+static int ct_ip_cb(const struct nlattr *attr, void *data)
+{
+	struct nflog_ct_tuple *t = data;
+
+	switch (mnl_attr_get_type(attr)) {
+	case CTA_IP_V4_SRC:
+	case CTA_IP_V4_DST:
+		if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+			return MNL_CB_ERROR;
+		t->family = AF_INET;
+		break;
+	case CTA_IP_V6_SRC:
+	case CTA_IP_V6_DST:
+		if (mnl_attr_validate2(attr, MNL_TYPE_BINARY,
+				       sizeof(t->src.v6)) < 0)
+			return MNL_CB_ERROR;
+		t->family = AF_INET6;
+		break;
+	default:
+		return MNL_CB_OK;
+	}
+
+	switch (mnl_attr_get_type(attr)) {
+	case CTA_IP_V4_SRC:
+		t->src.v4 = mnl_attr_get_u32(attr);
+		break;
+	case CTA_IP_V4_DST:
+		t->dst.v4 = mnl_attr_get_u32(attr);
+		break;
+	case CTA_IP_V6_SRC:
+		memcpy(t->src.v6, mnl_attr_get_payload(attr), sizeof(t->src.v6));
+		break;
+	case CTA_IP_V6_DST:
+		memcpy(t->dst.v6, mnl_attr_get_payload(attr), sizeof(t->dst.v6));
+		break;
+	}
+	return MNL_CB_OK;
+}
+
+static int ct_proto_cb(const struct nlattr *attr, void *data)
+{
+	struct nflog_ct_tuple *t = data;
+
+	switch (mnl_attr_get_type(attr)) {
+	case CTA_PROTO_NUM:
+	case CTA_PROTO_ICMP_TYPE:
+	case CTA_PROTO_ICMP_CODE:
+	case CTA_PROTO_ICMPV6_TYPE:
+	case CTA_PROTO_ICMPV6_CODE:
+		if (mnl_attr_validate(attr, MNL_TYPE_U8) < 0)
+			return MNL_CB_ERROR;
+		break;
+	case CTA_PROTO_SRC_PORT:
+	case CTA_PROTO_DST_PORT:
+	case CTA_PROTO_ICMP_ID:
+	case CTA_PROTO_ICMPV6_ID:
+		if (mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
+			return MNL_CB_ERROR;
+		break;
+	}
+
+	switch (mnl_attr_get_type(attr)) {
+	case CTA_PROTO_NUM:
+		t->l4proto = mnl_attr_get_u8(attr);
+		break;
+	case CTA_PROTO_SRC_PORT:
+	case CTA_PROTO_ICMP_ID:
+	case CTA_PROTO_ICMPV6_ID:
+		t->sport = ntohs(mnl_attr_get_u16(attr));
+		break;
+	case CTA_PROTO_DST_PORT:
+		t->dport = ntohs(mnl_attr_get_u16(attr));
+		break;
+	case CTA_PROTO_ICMP_TYPE:
+	case CTA_PROTO_ICMPV6_TYPE:
+		t->icmp_type = mnl_attr_get_u8(attr);
+		break;
+	case CTA_PROTO_ICMP_CODE:
+	case CTA_PROTO_ICMPV6_CODE:
+		t->icmp_code = mnl_attr_get_u8(attr);
+		break;
+	}
+	return MNL_CB_OK;
+}
+
+static int ct_tuple_cb(const struct nlattr *attr, void *data)
+{
+	switch (mnl_attr_get_type(attr)) {
+	case CTA_TUPLE_IP:
+		if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+			return MNL_CB_ERROR;
+		return mnl_attr_parse_nested(attr, ct_ip_cb, data);
+	case CTA_TUPLE_PROTO:
+		if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+			return MNL_CB_ERROR;
+		return mnl_attr_parse_nested(attr, ct_proto_cb, data);
+	}
+	return MNL_CB_OK;
+}
+
+static int ct_cb(const struct nlattr *attr, void *data)
+{
+	struct nflog_ct *ct = data;
+	uint16_t type = mnl_attr_get_type(attr);
+	struct nflog_ct_tuple *t;
+
+	switch (type) {
+	case CTA_TUPLE_ORIG:
+	case CTA_TUPLE_REPLY:
+		if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+			return MNL_CB_ERROR;
+
+		t = type == CTA_TUPLE_ORIG ? &ct->orig : &ct->reply;
+		if (mnl_attr_parse_nested(attr, ct_tuple_cb, t) < 0)
+			return MNL_CB_ERROR;
+
+		ct->attrs |= type == CTA_TUPLE_ORIG ? NFLOG_CT_F_ORIG :
+						      NFLOG_CT_F_REPLY;
+		break;
+	case CTA_STATUS:
+	case CTA_MARK:
+	case CTA_ID:
+	case CTA_TIMEOUT:
+		if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0)
+			return MNL_CB_ERROR;
+
+		switch (type) {
+		case CTA_STATUS:
+			ct->status = ntohl(mnl_attr_get_u32(attr));
+			ct->attrs |= NFLOG_CT_F_STATUS;
+			break;
+		case CTA_MARK:
+			ct->mark = ntohl(mnl_attr_get_u32(attr));
+			ct->attrs |= NFLOG_CT_F_MARK;
+			break;
+		case CTA_ID:
+			ct->id = ntohl(mnl_attr_get_u32(attr));
+			ct->attrs |= NFLOG_CT_F_ID;
+			break;
+		case CTA_TIMEOUT:
+			ct->timeout = ntohl(mnl_attr_get_u32(attr));
+			ct->attrs |= NFLOG_CT_F_TIMEOUT;
+			break;
+		}
+		break;
+	case CTA_ZONE:
+		if (mnl_attr_validate(attr, MNL_TYPE_U16) < 0)
+			return MNL_CB_ERROR;
+
+		ct->zone = ntohs(mnl_attr_get_u16(attr));
+		ct->attrs |= NFLOG_CT_F_ZONE;
+		break;
+	case CTA_LABELS:
+		if (mnl_attr_get_payload_len(attr) > sizeof(ct->labels))
+			return MNL_CB_ERROR;
+
+		memcpy(ct->labels, mnl_attr_get_payload(attr),
+		       mnl_attr_get_payload_len(attr));
+		ct->attrs |= NFLOG_CT_F_LABELS;
+		break;
+	}
+	return MNL_CB_OK;
+}
+
+/**
+ * nflog_ct_parse - decode a conntrack entry
+ * \param payload pointer to the payload of the NFULA_CT attribute
+ * \param len length of the payload
+ * \param ct structure to fill with the decoded information
+ *
+ * Decodes the original and reply tuples, status, mark, zone, id, timeout and
+ * labels of the conntrack entry that the kernel attaches to logged packets,
+ * without the need for libnetfilter_conntrack. The _attrs_ field of _ct_
+ * tells which of these were present, as a combination of NFLOG_CT_F_* flags.
+ *
+ * Addresses are stored in network byte order, everything else in host byte
+ * order. For ICMP and ICMPv6 tuples, _sport_ holds the ICMP identifier.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * \b EINVAL _payload_ contains malformed attributes
+ */
+int nflog_ct_parse(const void *payload, size_t len, struct nflog_ct *ct)
+{
+	memset(ct, 0, sizeof(*ct));
+
+	if (mnl_attr_parse_payload(payload, len, ct_cb, ct) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * nflog_get_ct - decode the conntrack entry of a logged packet
+ * \param nfad Netlink packet data handle passed to callback function
+ * \param ct structure to fill with the decoded information
+ *
+ * You must enable this via nflog_set_flags(). See nflog_ct_parse() for the
+ * meaning of the fields.
+ *
+ * \return 0 on success, -1 if no conntrack entry is available or on failure
+ * with \b errno set.
+ * \par Errors
+ * \b EINVAL the conntrack attribute is malformed
+ */
+int nflog_get_ct(struct nflog_data *nfad, struct nflog_ct *ct)
+{
+	struct nlattr *cta = (struct nlattr *)nfad->nfa[NFULA_CT - 1];
+
+	if (!cta)
+		return -1;
+
+	return nflog_ct_parse(mnl_attr_get_payload(cta),
+			      mnl_attr_get_payload_len(cta), ct);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,297 @@
+/* fair.c: weighted fair dispatch of log messages across groups
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <libnfnetlink/libnfnetlink.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Fair Fair dispatch functions
+ *
+ * By default the callbacks are called in the order the messages arrive, so
+ * a group that logs a flood, eg. a DROP rule under attack, delays the
+ * messages of all other groups bound via the same handle.
+ *
+ * Once fair dispatch is enabled on a group via nflog_set_fair(),
+ * nflog_process() puts the messages it receives in a queue per group, and
+ * drains the queues by deficit round robin over the time spent in the
+ * callbacks: each group gets a share of the dispatch time in proportion to
+ * its weight, however expensive its callback is. A group can also be given
+ * a budget, the time its callback may take per call to nflog_process();
+ * once spent, its messages wait for the next call while the other groups
+ * keep being served. A full queue drops the messages that arrive on top.
+ *
+ * Messages of a group are still passed to the callback in order, messages
+ * of different groups are not. Groups without fair dispatch enabled are
+ * queued too, with the default settings. nflog_handle_packet() is not
+ * affected, it keeps dispatching in arrival order.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#define NFLOG_FAIR_WEIGHT	1
+#define NFLOG_FAIR_QUEUE_MAX	(1 << 20)
+
+/* dispatch time a group of weight one gets per round, in nanoseconds */
+#define NFLOG_FAIR_QUANTUM_NS	50000
+
+static const struct nflog_fair fair_default = {
+	.weight		= NFLOG_FAIR_WEIGHT,
+	.queue_max	= NFLOG_FAIR_QUEUE_MAX,
+};
+
+static const struct nflog_fair *fair_cfg(const struct nflog_g_handle *gh)
+{
+	return gh->fair.enabled ? &gh->fair.cfg : &fair_default;
+}
+
+/**
+ * nflog_set_fair - enable fair dispatch on a group
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param cfg scheduling parameters, or NULL to disable fair dispatch
+ *
+ * Fields of \b cfg left at zero take default values:
+ *	- \b weight: 1
+ *	- \b budget_us: 0 (no budget, the group is only limited by its weight)
+ *	- \b queue_max: 1 MiB
+ *
+ * Fair dispatch applies to the whole handle as long as it is enabled on at
+ * least one group. Messages still queued when it is disabled are passed to
+ * the callbacks by the next calls to nflog_process(), ahead of those received
+ * since.
+ *
+ * \return 0
+ */
+int nflog_set_fair(struct nflog_g_handle *gh, const struct nflog_fair *cfg)
+{
+	struct nflog_fair c;
+
+	if (!cfg) {
+		if (gh->fair.enabled) {
+			gh->fair.enabled = 0;
+			gh->h->fair_groups--;
+		}
+		return 0;
+	}
+
+	c = *cfg;
+	if (!c.weight)
+		c.weight = NFLOG_FAIR_WEIGHT;
+	if (!c.queue_max)
+		c.queue_max = NFLOG_FAIR_QUEUE_MAX;
+
+	if (!gh->fair.enabled) {
+		gh->fair.enabled = 1;
+		gh->h->fair_groups++;
+	}
+	gh->fair.cfg = c;
+
+	return 0;
+}
+
+/* copy a message at the tail of the queue of its group */
+static void fair_push(struct nflog_g_handle *gh, const struct nlmsghdr *nlh)
+{
+	struct nflog_fair_queue *q = &gh->fair;
+	size_t len = NLMSG_ALIGN(nlh->nlmsg_len), size;
+	uint32_t max = fair_cfg(gh)->queue_max;
+	char *buf;
+
+	if (q->tail - q->head + len > max) {
+		q->dropped++;
+		return;
+	}
+
+	if (q->tail + len > q->size && q->head) {
+		memmove(q->buf, q->buf + q->head, q->tail - q->head);
+		q->tail -= q->head;
+		q->head = 0;
+	}
+
+	if (q->tail + len > q->size) {
+		size = q->size ? q->size : NFLOG_RECV_BATCH * 4096;
+		while (size < q->tail + len)
+			size *= 2;
+
+		buf = realloc(q->buf, size);
+		if (!buf) {
+			q->dropped++;
+			return;
+		}
+		q->buf = buf;
+		q->size = size;
+	}
+
+	memcpy(q->buf + q->tail, nlh, nlh->nlmsg_len);
+	q->tail += len;
+	q->queued++;
+	gh->h->fair_queued++;
+}
+
+static struct nflog_g_handle *fair_group(struct nflog_handle *h,
+					 const struct nlmsghdr *nlh)
+{
+	const struct nfgenmsg *nfmsg = NLMSG_DATA(nlh);
+	struct nflog_g_handle *gh;
+
+	if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_ULOG ||
+	    NFNL_MSG_TYPE(nlh->nlmsg_type) != NFULNL_MSG_PACKET ||
+	    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*nfmsg)))
+		return NULL;
+
+	for (gh = h->gh_list; gh; gh = gh->next) {
+		if (gh->id == ntohs(nfmsg->res_id) && !gh->unbound)
+			return gh->cb ? gh : NULL;
+	}
+	return NULL;
+}
+
+/*
+ * Queue the log messages of a datagram by group, and handle anything else,
+ * eg. errors, right away.
+ */
+void __nflog_fair_enqueue(struct nflog_handle *h, char *buf, size_t len)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct nflog_g_handle *gh;
+	int left = len;
+
+	nflog_nlmsg_account(&h->stats, buf, len);
+
+	for (; NLMSG_OK(nlh, left); nlh = NLMSG_NEXT(nlh, left)) {
+		gh = fair_group(h, nlh);
+		if (gh)
+			fair_push(gh, nlh);
+		else if (!__nflog_config_reply(h, nlh, left))
+			nfnl_handle_packet(h->nfnlh, (char *)nlh,
+					   nlh->nlmsg_len);
+	}
+}
+
+/* pass the message at the head of the queue to the callback */
+static void fair_pop(struct nflog_g_handle *gh)
+{
+	struct nflog_fair_queue *q = &gh->fair;
+	struct nlmsghdr *nlh = (struct nlmsghdr *)(q->buf + q->head);
+	uint64_t start, cost;
+
+	q->head += NLMSG_ALIGN(nlh->nlmsg_len);
+	q->queued--;
+	gh->h->fair_queued--;
+
+	start = __nflog_now_ns();
+	nfnl_handle_packet(gh->h->nfnlh, (char *)nlh, nlh->nlmsg_len);
+	cost = __nflog_now_ns() - start;
+
+	if (q->queued == 0)
+		q->head = q->tail = 0;
+
+	q->deficit -= cost;
+	q->spent += cost;
+	q->busy_ns += cost;
+	q->dispatched++;
+}
+
+static int fair_eligible(const struct nflog_g_handle *gh)
+{
+	uint64_t budget = (uint64_t)fair_cfg(gh)->budget_us * 1000;
+
+	return gh->fair.queued && !gh->unbound &&
+	       (!budget || gh->fair.spent < budget);
+}
+
+/* release the groups unbound by the callbacks while we dispatched */
+static void fair_reap(struct nflog_handle *h)
+{
+	struct nflog_g_handle *gh, *next;
+
+	for (gh = h->gh_list; gh; gh = next) {
+		next = gh->next;
+		if (gh->unbound)
+			__nflog_gh_free(gh);
+	}
+}
+
+/* drain the queues, within the budgets, by deficit round robin */
+void __nflog_fair_dispatch(struct nflog_handle *h)
+{
+	struct nflog_g_handle *gh;
+	int eligible;
+
+	for (gh = h->gh_list; gh; gh = gh->next)
+		gh->fair.spent = 0;
+
+	h->dispatching++;
+	do {
+		eligible = 0;
+		for (gh = h->gh_list; gh; gh = gh->next) {
+			if (!fair_eligible(gh))
+				continue;
+
+			eligible++;
+			gh->fair.deficit += (int64_t)fair_cfg(gh)->weight *
+					    NFLOG_FAIR_QUANTUM_NS;
+			while (gh->fair.deficit > 0 && fair_eligible(gh))
+				fair_pop(gh);
+
+			/* an idle group does not save up for later */
+			if (!gh->fair.queued)
+				gh->fair.deficit = 0;
+		}
+	} while (eligible);
+
+	if (--h->dispatching == 0)
+		fair_reap(h);
+
+	if (h->range_pending)
+		__nflog_range_update(h);
+}
+
+void __nflog_fair_free(struct nflog_g_handle *gh)
+{
+	gh->h->fair_queued -= gh->fair.queued;
+	if (gh->fair.enabled)
+		gh->h->fair_groups--;
+	free(gh->fair.buf);
+	gh->fair = (struct nflog_fair_queue) {};
+}
+
+/**
+ * nflog_get_fair - get the fair dispatch state of a group
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param st structure to fill
+ *
+ * The counters cover all messages that went through the queue of the group,
+ * whether fair dispatch is enabled on it or only on other groups.
+ *
+ * \return 0
+ */
+int nflog_get_fair(struct nflog_g_handle *gh, struct nflog_fair_state *st)
+{
+	st->queued = gh->fair.queued;
+	st->queued_bytes = gh->fair.tail - gh->fair.head;
+	st->dispatched = gh->fair.dispatched;
+	st->dropped = gh->fair.dropped;
+	st->busy_ns = gh->fair.busy_ns;
+
+	return 0;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,273 @@
+/* filter.c: kernel side filtering of log messages
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Filter Kernel side filtering functions
+ *
+ * Log messages that the application is not interested in can be dropped by
+ * the kernel before they are copied to the socket of the handle. The
+ * functions in this group turn a struct nflog_filter into a classic BPF
+ * program that inspects the log message and attach it to the socket.
+ *
+ * A message passes the filter if it matches all the fields that are set in
+ * \b flags:
+ *	- NFLOG_FILTER_F_GROUP: it has been logged to \b group
+ *	- NFLOG_FILTER_F_MARK: its mark is within one of the \b nmarks ranges
+ *	  in \b marks, a packet without mark has mark zero
+ *	- NFLOG_FILTER_F_PREFIX: its prefix is equal to \b prefix
+ *	- NFLOG_FILTER_F_HOOK: it has been logged from the hook \b hook
+ *	- NFLOG_FILTER_F_INDEV: it has been received via the interface with
+ *	  index \b indev, a packet without input interface has index zero
+ *
+ * Other messages, such as acknowledgements to configuration requests,
+ * always pass.
+ *
+ * \warning The filter decides on whole datagrams, and a program cannot loop
+ * over the messages in a datagram, so it only looks at the first one. When
+ * the kernel packs several messages in a datagram (see nflog_set_qthresh()),
+ * the others pass or are dropped along with the first one. Use a queue
+ * threshold of one, or a group per kind of traffic, to filter exactly.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+/* a log message is a nlmsghdr and a nfgenmsg followed by attributes */
+#define NFLOG_OFF_TYPE		offsetof(struct nlmsghdr, nlmsg_type)
+#define NFLOG_OFF_GROUP		(NLMSG_HDRLEN + offsetof(struct nfgenmsg, res_id))
+#define NFLOG_OFF_ATTRS		(NLMSG_HDRLEN + NLMSG_ALIGN(sizeof(struct nfgenmsg)))
+
+struct bpf_builder {
+	struct sock_filter	*insns;
+	unsigned int		len;
+	unsigned int		max;
+};
+
+static void emit(struct bpf_builder *b, uint16_t code, uint8_t jt, uint8_t jf,
+		 uint32_t k)
+{
+	if (b->len < b->max)
+		b->insns[b->len] = (struct sock_filter)BPF_JUMP(code, k, jt, jf);
+	b->len++;
+}
+
+static void emit_stmt(struct bpf_builder *b, uint16_t code, uint32_t k)
+{
+	emit(b, code, 0, 0, k);
+}
+
+/* A must be _k_, drop the datagram otherwise */
+static void emit_expect(struct bpf_builder *b, uint32_t k)
+{
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, k);
+	emit_stmt(b, BPF_RET | BPF_K, 0);
+}
+
+/*
+ * Look up attribute _type_ in the first message and leave its offset in X.
+ * If _optional_, a missing attribute skips the following two instructions
+ * with A = 0, otherwise it drops the datagram.
+ */
+static void emit_find_attr(struct bpf_builder *b, uint16_t type, int optional)
+{
+	emit_stmt(b, BPF_LD | BPF_IMM, NFLOG_OFF_ATTRS);
+	emit_stmt(b, BPF_LDX | BPF_IMM, type);
+	emit_stmt(b, BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_NLATTR);
+	if (optional) {
+		emit(b, BPF_JMP | BPF_JEQ | BPF_K, 2, 0, 0);
+	} else {
+		emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+		emit_stmt(b, BPF_RET | BPF_K, 0);
+	}
+	emit_stmt(b, BPF_MISC | BPF_TAX, 0);
+}
+
+/* host order u16 of the netlink headers as seen by 16-bit BPF loads */
+static uint32_t bpf_host16(uint16_t v)
+{
+	return ntohs(v);
+}
+
+static void emit_prefix(struct bpf_builder *b, const char *prefix)
+{
+	size_t i, len = strlen(prefix) + 1;
+	const uint8_t *p = (const uint8_t *)prefix;
+
+	emit_find_attr(b, NFULA_PREFIX, 0);
+
+	/* the kernel puts the string along with its terminating nul */
+	emit_stmt(b, BPF_LD | BPF_H | BPF_IND, 0);
+	emit_expect(b, bpf_host16(NLA_HDRLEN + len));
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		emit_stmt(b, BPF_LD | BPF_W | BPF_IND, NLA_HDRLEN + i);
+		emit_expect(b, (uint32_t)p[i] << 24 | p[i + 1] << 16 |
+			       p[i + 2] << 8 | p[i + 3]);
+	}
+	if (i + 2 <= len) {
+		emit_stmt(b, BPF_LD | BPF_H | BPF_IND, NLA_HDRLEN + i);
+		emit_expect(b, p[i] << 8 | p[i + 1]);
+		i += 2;
+	}
+	if (i < len) {
+		emit_stmt(b, BPF_LD | BPF_B | BPF_IND, NLA_HDRLEN + i);
+		emit_expect(b, p[i]);
+	}
+}
+
+static void emit_marks(struct bpf_builder *b, const struct nflog_filter *f)
+{
+	unsigned int i;
+
+	emit_find_attr(b, NFULA_MARK, 1);
+	emit_stmt(b, BPF_LD | BPF_W | BPF_IND, NLA_HDRLEN);
+
+	/* on a match, jump over the ranges left and the final drop */
+	for (i = 0; i < f->nmarks; i++) {
+		emit(b, BPF_JMP | BPF_JGE | BPF_K, 0, 2, f->marks[i].min);
+		emit(b, BPF_JMP | BPF_JGT | BPF_K, 1, 0, f->marks[i].max);
+		emit_stmt(b, BPF_JMP | BPF_JA, 3 * (f->nmarks - i) - 2);
+	}
+	emit_stmt(b, BPF_RET | BPF_K, 0);
+}
+
+/**
+ * nflog_filter_compile - turn a filter into a classic BPF program
+ * \param f filter to compile
+ * \param insns array to store the program into
+ * \param max number of instructions \b insns can hold
+ *
+ * This is what nflog_attach_filter() uses. Programs that receive via libmnl
+ * can attach the result to their socket with SO_ATTACH_FILTER themselves.
+ *
+ * \return number of instructions of the program, or -1 on failure with
+ * \b errno set. If the return value is greater than \b max, the program has
+ * not been stored in full.
+ * \par Errors
+ * __EINVAL__ NFLOG_FILTER_F_MARK is set with no or more than
+ * NFLOG_FILTER_MARKS_MAX ranges, or NFLOG_FILTER_F_PREFIX with no or a too
+ * long prefix.
+ */
+int nflog_filter_compile(const struct nflog_filter *f, struct sock_filter *insns,
+			 unsigned int max)
+{
+	struct bpf_builder b = {
+		.insns	= insns,
+		.max	= max,
+	};
+
+	if ((f->flags & NFLOG_FILTER_F_MARK) &&
+	    (f->nmarks == 0 || f->nmarks > NFLOG_FILTER_MARKS_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((f->flags & NFLOG_FILTER_F_PREFIX) &&
+	    (!f->prefix || strlen(f->prefix) >= NFLOG_FILTER_PREFIX_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* let everything that is not a log message through */
+	emit_stmt(&b, BPF_LD | BPF_H | BPF_ABS, NFLOG_OFF_TYPE);
+	emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 1, 0,
+	     bpf_host16(NFNL_SUBSYS_ULOG << 8 | NFULNL_MSG_PACKET));
+	emit_stmt(&b, BPF_RET | BPF_K, 0xffffffff);
+
+	if (f->flags & NFLOG_FILTER_F_GROUP) {
+		emit_stmt(&b, BPF_LD | BPF_H | BPF_ABS, NFLOG_OFF_GROUP);
+		emit_expect(&b, f->group);
+	}
+
+	if (f->flags & NFLOG_FILTER_F_HOOK) {
+		emit_find_attr(&b, NFULA_PACKET_HDR, 0);
+		emit_stmt(&b, BPF_LD | BPF_B | BPF_IND, NLA_HDRLEN +
+			  offsetof(struct nfulnl_msg_packet_hdr, hook));
+		emit_expect(&b, f->hook);
+	}
+
+	if (f->flags & NFLOG_FILTER_F_INDEV) {
+		emit_find_attr(&b, NFULA_IFINDEX_INDEV, 1);
+		emit_stmt(&b, BPF_LD | BPF_W | BPF_IND, NLA_HDRLEN);
+		emit_expect(&b, f->indev);
+	}
+
+	if (f->flags & NFLOG_FILTER_F_MARK)
+		emit_marks(&b, f);
+
+	if (f->flags & NFLOG_FILTER_F_PREFIX)
+		emit_prefix(&b, f->prefix);
+
+	emit_stmt(&b, BPF_RET | BPF_K, 0xffffffff);
+
+	return b.len;
+}
+
+/**
+ * nflog_attach_filter - drop unwanted log messages in the kernel
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param f filter to attach
+ *
+ * This compiles \b f via nflog_filter_compile() and attaches the program to
+ * the socket of the handle, replacing any filter attached before. From then
+ * on, the kernel only queues datagrams that pass the filter to the socket.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * as for nflog_filter_compile()
+ * \n as for __setsockopt__(2)
+ */
+int nflog_attach_filter(struct nflog_handle *h, const struct nflog_filter *f)
+{
+	struct sock_filter insns[NFLOG_FILTER_INSNS_MAX];
+	struct sock_fprog prog = {
+		.filter	= insns,
+	};
+	int len;
+
+	len = nflog_filter_compile(f, insns, NFLOG_FILTER_INSNS_MAX);
+	if (len < 0)
+		return -1;
+
+	prog.len = len;
+	return setsockopt(nflog_fd(h), SOL_SOCKET, SO_ATTACH_FILTER,
+			  &prog, sizeof(prog));
+}
+
+/**
+ * nflog_detach_filter - stop filtering log messages in the kernel
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __ENOENT__ No filter is attached.
+ * \n as for __setsockopt__(2)
+ */
+int nflog_detach_filter(struct nflog_handle *h)
+{
+	int dummy = 0;
+
+	return setsockopt(nflog_fd(h), SOL_SOCKET, SO_DETACH_FILTER,
+			  &dummy, sizeof(dummy));
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,281 @@
+/* handoff.c: pass the socket of a handle to another process
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Handoff Socket handoff functions
+ *
+ * The groups bound via nflog_bind_group() belong to the netlink socket of
+ * the handle, and the kernel releases them when the socket is closed. A
+ * process that restarts, eg. to upgrade, then loses the messages logged
+ * until its successor has bound the groups again.
+ *
+ * Instead, the running process can pass the socket, along with the state of
+ * its groups, to its successor over a UNIX socket via nflog_export(). The
+ * successor picks it up via nflog_import() and keeps receiving where its
+ * predecessor stopped, with nothing lost but the messages the predecessor
+ * received without handling them:
+ *
+ * \verbatim
+	// old process, once the new one has connected to it on fd
+	nflog_export(h, fd);
+	nflog_close(h);
+
+	// new process
+	h = nflog_import(fd);
+	gh = nflog_adopt_group(h, 100);
+	nflog_callback_register(gh, &cb, NULL);
+\endverbatim
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#define NFLOG_HANDOFF_MAGIC	0x6e666c67	/* "nflg" */
+#define NFLOG_HANDOFF_VERSION	1
+
+struct nflog_handoff_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	groups;
+	uint32_t	nlbufsiz;
+};
+
+struct nflog_handoff_group {
+	uint16_t	id;
+	uint8_t		copy_mode;
+	uint8_t		pad;
+	uint32_t	copy_range;
+};
+
+struct nflog_handoff {
+	struct nflog_handoff_hdr	hdr;
+	struct nflog_handoff_group	group[NFLOG_HANDOFF_GROUPS_MAX];
+};
+
+static int handoff_write(int sock, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(sock, buf, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/**
+ * nflog_export - pass the socket of a handle to another process
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param sock connected UNIX socket to the other process
+ *
+ * This sends the netlink socket of \b h over \b sock along with the number
+ * and the copy mode of the groups bound on it. The other process gets a
+ * handle on the same socket via nflog_import().
+ *
+ * Once this returns, the caller should stop receiving, as both processes
+ * now compete for the messages, and close the handle via nflog_close(),
+ * without unbinding the groups. The groups stay bound as long as the other
+ * process holds the socket.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __E2BIG__ More than NFLOG_HANDOFF_GROUPS_MAX groups are bound.
+ * \n as for __sendmsg__(2)
+ */
+int nflog_export(struct nflog_handle *h, int sock)
+{
+	struct nflog_handoff msg = {
+		.hdr = {
+			.magic		= NFLOG_HANDOFF_MAGIC,
+			.version	= NFLOG_HANDOFF_VERSION,
+			.nlbufsiz	= h->nlbufsiz,
+		},
+	};
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	struct iovec iov = {
+		.iov_base	= &msg,
+	};
+	struct msghdr mh = {
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+		.msg_control	= u.buf,
+		.msg_controllen	= sizeof(u.buf),
+	};
+	struct nflog_g_handle *gh;
+	struct cmsghdr *cmsg;
+	int fd = nflog_fd(h);
+	unsigned int n = 0;
+	ssize_t ret;
+
+	for (gh = h->gh_list; gh; gh = gh->next) {
+		/* released by the kernel, see nflog_unbind_group() */
+		if (gh->unbound)
+			continue;
+		if (n == NFLOG_HANDOFF_GROUPS_MAX) {
+			errno = E2BIG;
+			return -1;
+		}
+		msg.group[n].id = gh->id;
+		msg.group[n].copy_mode = gh->copy_mode;
+		msg.group[n].copy_range = gh->copy_range;
+		n++;
+	}
+	msg.hdr.groups = n;
+	iov.iov_len = sizeof(msg.hdr) + n * sizeof(msg.group[0]);
+
+	memset(u.buf, 0, sizeof(u.buf));
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	ret = sendmsg(sock, &mh, MSG_NOSIGNAL);
+	if (ret < 0)
+		return -1;
+
+	/* the descriptor went with the first part, send the rest without */
+	if (ret < (ssize_t)iov.iov_len &&
+	    handoff_write(sock, (char *)&msg + ret, iov.iov_len - ret) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* read the rest of a message that a stream socket delivered in pieces */
+static int handoff_read(int sock, char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = recv(sock, buf, len, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			if (ret == 0)
+				errno = EPROTO;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/**
+ * nflog_import - get a handle on the socket passed by another process
+ * \param sock connected UNIX socket to the process calling nflog_export()
+ *
+ * This receives the netlink socket sent via nflog_export() and opens a
+ * handle on it via nflog_open_fd(). The groups bound on the socket are
+ * adopted along with their copy mode, get their handles via
+ * nflog_adopt_group() to register the callbacks.
+ *
+ * \return a pointer to a new log handle or NULL on failure with \b errno set.
+ * \par Errors
+ * __EPROTO__ What was received is not a socket sent via nflog_export().
+ * \n as for nflog_open_fd()
+ * \n as for __recvmsg__(2)
+ */
+struct nflog_handle *nflog_import(int sock)
+{
+	struct nflog_handoff msg;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	struct iovec iov = {
+		.iov_base	= &msg,
+		.iov_len	= sizeof(msg),
+	};
+	struct msghdr mh = {
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+		.msg_control	= u.buf,
+		.msg_controllen	= sizeof(u.buf),
+	};
+	struct nflog_g_handle *gh;
+	struct nflog_handle *h;
+	struct cmsghdr *cmsg;
+	size_t len, want;
+	ssize_t ret;
+	int fd = -1;
+	unsigned int i;
+
+	do {
+		ret = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return NULL;
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS &&
+	    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	len = ret;
+	if (fd < 0 || (mh.msg_flags & (MSG_CTRUNC | MSG_TRUNC)) ||
+	    len < sizeof(msg.hdr) || msg.hdr.magic != NFLOG_HANDOFF_MAGIC ||
+	    msg.hdr.version != NFLOG_HANDOFF_VERSION ||
+	    msg.hdr.groups > NFLOG_HANDOFF_GROUPS_MAX)
+		goto err_proto;
+
+	want = sizeof(msg.hdr) + msg.hdr.groups * sizeof(msg.group[0]);
+	if (len > want)
+		goto err_proto;
+	if (len < want && handoff_read(sock, (char *)&msg + len, want - len) < 0)
+		goto err;
+
+	h = nflog_open_fd(fd);
+	if (!h)
+		goto err;
+	h->nlbufsiz = msg.hdr.nlbufsiz;
+
+	for (i = 0; i < msg.hdr.groups; i++) {
+		gh = nflog_adopt_group(h, msg.group[i].id);
+		if (!gh) {
+			nflog_close(h);
+			return NULL;
+		}
+		gh->copy_mode = msg.group[i].copy_mode;
+		gh->copy_range = msg.group[i].copy_range;
+	}
+
+	return h;
+
+err_proto:
+	errno = EPROTO;
+err:
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/**
+ * @}
+ */
@@ -213,9 +213,37 @@ next_msg:
 ssize_t ipulog_read(struct ipulog_handle *h, unsigned char *buf,
 		    size_t len, int timeout)
 {
+	struct sockaddr_nl peer = {};
+	struct iovec iov = {
+		.iov_base	= buf,
+		.iov_len	= len,
+	};
+	struct msghdr mh = {
+		.msg_name	= &peer,
+		.msg_namelen	= sizeof(peer),
+		.msg_iov	= &iov,
+		.msg_iovlen	= 1,
+	};
+	ssize_t ret;
+
 	/* 'timeout' was never implemented in the original libipulog,
 	 * so we don't bother emulating it */
-	return nfnl_recv(nflog_nfnlh(h->nfulh), buf, len);
+	ret = recvmsg(nflog_fd(h->nfulh), &mh, 0);
+	if (ret < 0 || mh.msg_namelen != sizeof(peer) || peer.nl_pid != 0) {
+		ipulog_errno = IPULOG_ERR_RECV;
+		return -1;
+	}
+	if (ret == 0) {
+		ipulog_errno = IPULOG_ERR_NLEOF;
+		return -1;
+	}
+	/* the caller would otherwise parse a cut short message */
+	if (mh.msg_flags & MSG_TRUNC) {
+		ipulog_errno = IPULOG_ERR_TRUNC;
+		return -1;
+	}
+
+	return ret;
 }
 
 /* print a human readable description of the last error to stderr */
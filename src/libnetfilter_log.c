@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -25,6 +26,8 @@
 #include <time.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
 #include <sys/socket.h>
 #include "internal.h"
 
@@ -32,6 +35,7 @@
 
 #include <libnfnetlink/libnfnetlink.h>
 #include <libnetfilter_log/libnetfilter_log.h>
+#include <libnetfilter_log/libnetfilter_log_inline.h>
 
 #include <libmnl/libmnl.h>
 #include <linux/netfilter/nfnetlink_conntrack.h>
@@ -57,6 +61,23 @@
  * The current development version of libnetfilter_log can be accessed
  * at https://git.netfilter.org/cgi-bin/gitweb.cgi?p=libnetfilter_log.git
  *
+ * \section Threads
+ * Handles do not share any state, so several threads can each run their own
+ * handle, eg. one per CPU bound to its own group, without any locking. A
+ * handle is used by one thread at a time, along with its group handles,
+ * the data passed to its callbacks and its counters: nflog_get_stats() and
+ * nflog_prefix_name() read what nflog_process() writes, so a thread that
+ * watches another one's handle needs the latter to copy them out. Callbacks
+ * run in the thread that called nflog_process() or nflog_handle_packet().
+ * A handle may move from one thread to another, eg. after nflog_import(),
+ * as long as the two do not use it at the same time.
+ *
+ * nflog_errno is per thread. A fake kernel peer, see nflog_peer_create(),
+ * runs in the thread of its handle. A ring, see nflog_ring_create(), has a
+ * single writer and any number of readers, each with its own
+ * nflog_ring_attach(). The libipulog compatibility API keeps its error in
+ * ipulog_errno, which is shared by all threads.
+ *
  * \section Using libnetfilter_log
  *
  * To write your own program using libnetfilter_log, you should start by
@@ -65,24 +86,22 @@
  *
  */
 
-struct nflog_handle
-{
-	struct nfnl_handle *nfnlh;
-	struct nfnl_subsys_handle *nfnlssh;
-	struct nflog_g_handle *gh_list;
-};
+/* binaries built before nflog_errno was per thread read this one */
+#undef nflog_errno
+int nflog_errno;
 
-struct nflog_g_handle
-{
-	struct nflog_g_handle *next;
-	struct nflog_handle *h;
-	uint16_t id;
+static __thread int nflog_errno_tls;
 
-	nflog_callback *cb;
-	void *data;
-};
+int *__nflog_errno_location(void)
+{
+	return &nflog_errno_tls;
+}
 
-int nflog_errno;
+static void nflog_set_errno(int err)
+{
+	nflog_errno_tls = err;
+	nflog_errno = err;
+}
 
 /***********************************************************************
  * low level stuff
@@ -115,12 +134,31 @@ static struct nflog_g_handle *find_gh(struct nflog_handle *h, uint16_t group)
 	struct nflog_g_handle *gh;
 
 	for (gh = h->gh_list; gh; gh = gh->next) {
-		if (gh->id == group)
+		if (gh->id == group && !gh->unbound)
 			return gh;
 	}
 	return NULL;
 }
 
+/* unlink a group handle and release it */
+void __nflog_gh_free(struct nflog_g_handle *gh)
+{
+	del_gh(gh);
+	__nflog_fair_free(gh);
+	if (gh->shed.enabled)
+		gh->h->shed_groups--;
+	free(gh);
+}
+
+/* send a request to the kernel, or to the peer standing in for it */
+static int nflog_query(struct nflog_handle *h, struct nlmsghdr *nlh)
+{
+	if (h->peer)
+		return __nflog_peer_query(h, nlh);
+
+	return nfnl_query(h->nfnlh, nlh);
+}
+
 /* build a NFULNL_MSG_CONFIG message */
 static int
 __build_send_cfg_msg(struct nflog_handle *h, uint8_t command,
@@ -139,7 +177,104 @@ __build_send_cfg_msg(struct nflog_handle *h, uint8_t command,
 	cmd.command = command;
 	nfnl_addattr_l(&u.nmh, sizeof(u), NFULA_CFG_CMD, &cmd, sizeof(cmd));
 
-	return nfnl_query(h->nfnlh, &u.nmh);
+	return nflog_query(h, &u.nmh);
+}
+
+union nflog_mode_msg {
+	char buf[NFNL_HEADER_LEN
+		+NFA_LENGTH(sizeof(struct nfulnl_msg_config_mode))];
+	struct nlmsghdr nmh;
+};
+
+/* build a NFULNL_MSG_CONFIG message setting the copy mode */
+static void build_mode_msg(struct nflog_g_handle *gh, union nflog_mode_msg *u,
+			   uint16_t flags, uint8_t mode, uint32_t range)
+{
+	struct nfulnl_msg_config_mode params;
+
+	nfnl_fill_hdr(gh->h->nfnlssh, &u->nmh, 0, AF_UNSPEC, gh->id,
+		      NFULNL_MSG_CONFIG, flags);
+
+	params.copy_range = htonl(range);	/* copy_range is short */
+	params.copy_mode = mode;
+	nfnl_addattr_l(&u->nmh, sizeof(*u), NFULA_CFG_MODE, &params,
+		       sizeof(params));
+}
+
+/*
+ * Send a configuration request from the receive path, eg. when shedding load.
+ * The request asks for no ack: waiting for it, as nflog_set_mode() does, would
+ * handle the messages received meanwhile right here, behind the back of
+ * nflog_process(). Should the kernel refuse the request, its error comes in
+ * with the log messages, see __nflog_config_reply(). Both kinds of failures
+ * are counted in the statistics returned by nflog_get_stats().
+ */
+static int config_send(struct nflog_handle *h, struct nlmsghdr *nlh)
+{
+	int ret;
+
+	if (h->peer)
+		ret = send(nflog_fd(h), nlh, nlh->nlmsg_len, 0);
+	else
+		ret = nfnl_send(h->nfnlh, nlh);
+	if (ret < 0) {
+		h->stats.config_errors++;
+		return -1;
+	}
+	return 0;
+}
+
+/* change the copy mode from the receive path */
+int __nflog_send_mode(struct nflog_g_handle *gh, uint8_t mode, uint32_t range)
+{
+	union nflog_mode_msg u;
+
+	build_mode_msg(gh, &u, NLM_F_REQUEST, mode, range);
+	if (config_send(gh->h, &u.nmh) < 0)
+		return -1;
+
+	gh->copy_mode = mode;
+	gh->copy_range = range;
+	return 0;
+}
+
+/* the same for the batching parameters, in a single request */
+int __nflog_send_tuning(struct nflog_g_handle *gh,
+			const struct nflog_tuning *t)
+{
+	union {
+		char buf[NFNL_HEADER_LEN+3*NFA_LENGTH(sizeof(uint32_t))];
+		struct nlmsghdr nmh;
+	} u;
+
+	nfnl_fill_hdr(gh->h->nfnlssh, &u.nmh, 0, AF_UNSPEC, gh->id,
+		      NFULNL_MSG_CONFIG, NLM_F_REQUEST);
+
+	nfnl_addattr32(&u.nmh, sizeof(u), NFULA_CFG_TIMEOUT, htonl(t->timeout));
+	nfnl_addattr32(&u.nmh, sizeof(u), NFULA_CFG_QTHRESH, htonl(t->qthresh));
+	nfnl_addattr32(&u.nmh, sizeof(u), NFULA_CFG_NLBUFSIZ,
+		       htonl(t->nlbufsiz));
+
+	if (config_send(gh->h, &u.nmh) < 0)
+		return -1;
+
+	if (t->nlbufsiz > gh->h->nlbufsiz)
+		gh->h->nlbufsiz = t->nlbufsiz;
+	return 0;
+}
+
+/* account the error the kernel sent for such a request, 1 if _nlh_ was one */
+int __nflog_config_reply(struct nflog_handle *h, const struct nlmsghdr *nlh,
+			 size_t len)
+{
+	const struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+	if (len < NLMSG_SPACE(sizeof(*err)) || nlh->nlmsg_type != NLMSG_ERROR)
+		return 0;
+
+	if (err->error)
+		h->stats.config_errors++;
+	return 1;
 }
 
 static int __nflog_rcv_pkt(struct nlmsghdr *nlh, struct nfattr *nfa[],
@@ -157,7 +292,11 @@ static int __nflog_rcv_pkt(struct nlmsghdr *nlh, struct nfattr *nfa[],
 	if (!gh->cb)
 		return -ENODEV;
 
+	gh->obs_msgs++;
+	gh->obs_bytes += nlh->nlmsg_len;
+
 	nfldata.nfa = nfa;
+	nfldata.gh = gh;
 	return gh->cb(gh, nfmsg, &nfldata, gh->data);
 }
 
@@ -256,28 +395,33 @@ struct nflog_handle *nflog_open_nfnl(struct nfnl_handle *nfnlh)
 	};
 
 	h = calloc(1, sizeof(*h));
-	if (!h)
+	if (!h) {
+		nflog_set_errno(errno);
 		return NULL;
+	}
 
 	h->nfnlh = nfnlh;
+	h->node = -1;
+	h->capture_fd = -1;
 
 	h->nfnlssh = nfnl_subsys_open(h->nfnlh, NFNL_SUBSYS_ULOG,
 				      NFULNL_MSG_MAX, 0);
 	if (!h->nfnlssh) {
-		/* FIXME: nflog_errno */
+		nflog_set_errno(errno);
 		goto out_free;
 	}
 
 	pkt_cb.data = h;
 	err = nfnl_callback_register(h->nfnlssh, NFULNL_MSG_PACKET, &pkt_cb);
 	if (err < 0) {
-		nflog_errno = err;
+		nflog_set_errno(err);
 		goto out_close;
 	}
 
 	return h;
 out_close:
-	nfnl_close(h->nfnlh);
+	/* the caller closes nfnlh, which it opened */
+	nfnl_subsys_close(h->nfnlssh);
 out_free:
 	free(h);
 	return NULL;
@@ -307,7 +451,7 @@ struct nflog_handle *nflog_open(void)
 
 	nfnlh = nfnl_open();
 	if (!nfnlh) {
-		/* FIXME: nflog_errno */
+		nflog_set_errno(errno);
 		return NULL;
 	}
 
@@ -321,6 +465,70 @@ struct nflog_handle *nflog_open(void)
 	return lh;
 }
 
+/**
+ * nflog_open_fd - open a nflog handler on an existing netlink socket
+ * \param fd netfilter netlink socket, eg. received via nflog_import()
+ *
+ * This function obtains a netfilter log connection handle like nflog_open()
+ * does, but on a socket that another handle created, possibly in another
+ * process. The groups bound on the socket stay bound, get handles for them
+ * via nflog_adopt_group() instead of nflog_bind_group(). On success, the
+ * handle owns \b fd, which is closed, and the groups it holds released, by
+ * nflog_close() once no other process holds it.
+ *
+ * \return a pointer to a new log handle or NULL on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ \b fd is not a netfilter netlink socket.
+ * \n from underlying calls, in exceptional circumstances
+ */
+struct nflog_handle *nflog_open_fd(int fd)
+{
+	int domain, proto;
+	socklen_t len = sizeof(int);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0 ||
+	    getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &proto, &len) < 0)
+		return NULL;
+
+	if (domain != AF_NETLINK || proto != NETLINK_NETFILTER) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return __nflog_open_fd(fd);
+}
+
+/* open a handle on fd, whatever it is connected to */
+struct nflog_handle *__nflog_open_fd(int fd)
+{
+	struct nfnl_handle *nfnlh;
+	struct nflog_handle *lh;
+
+	nfnlh = nfnl_open();
+	if (!nfnlh) {
+		nflog_set_errno(errno);
+		return NULL;
+	}
+
+	/* libnfnetlink cannot wrap a socket, put ours in place of its own */
+	if (dup2(fd, nfnl_fd(nfnlh)) < 0) {
+		nflog_set_errno(errno);
+		nfnl_close(nfnlh);
+		return NULL;
+	}
+
+	nfnl_unset_sequence_tracking(nfnlh);
+
+	lh = nflog_open_nfnl(nfnlh);
+	if (!lh) {
+		nfnl_close(nfnlh);
+		return NULL;
+	}
+
+	close(fd);
+	return lh;
+}
+
 /**
  * @}
  */
@@ -356,6 +564,8 @@ int nflog_callback_register(struct nflog_g_handle *gh, nflog_callback *cb,
  *
  * Triggers an associated callback for each packet contained in \b buf.
  * Data can be read from the queue using nflog_fd() and \b recv().
+ * The datagram is accounted in the batching histograms returned by
+ * nflog_get_stats(), see nflog_nlmsg_account().
  * See example code in the Detailed Description.
  * \return 0 on success, -1 if either the callback returned -ve or \b buf
  * contains corrupt data. \b errno is not reliably set:
@@ -364,7 +574,21 @@ int nflog_callback_register(struct nflog_g_handle *gh, nflog_callback *cb,
 
 int nflog_handle_packet(struct nflog_handle *h, char *buf, int len)
 {
-	return nfnl_handle_packet(h->nfnlh, buf, len);
+	int ret;
+
+	if (len > 0 &&
+	    __nflog_config_reply(h, (struct nlmsghdr *)buf, len))
+		return 0;
+
+	if (len > 0)
+		nflog_nlmsg_account(&h->stats, buf, len);
+
+	ret = nfnl_handle_packet(h->nfnlh, buf, len);
+
+	if (h->range_pending)
+		__nflog_range_update(h);
+
+	return ret;
 }
 
 /**
@@ -399,7 +623,16 @@ int nflog_handle_packet(struct nflog_handle *h, char *buf, int len)
  */
 int nflog_close(struct nflog_handle *h)
 {
+	struct nflog_g_handle *gh;
 	int ret = nfnl_close(h->nfnlh);
+
+	for (gh = h->gh_list; gh; gh = gh->next)
+		__nflog_fair_free(gh);
+	__nflog_prefix_table_free(&h->prefixes);
+	if (h->peer)
+		__nflog_peer_detach(h->peer);
+	if (h->recv.buf)
+		nflog_free_buf(h->recv.buf, h->recv.slot * NFLOG_RECV_BATCH);
 	free(h);
 	return ret;
 }
@@ -485,6 +718,41 @@ nflog_bind_group(struct nflog_handle *h, uint16_t num)
 	return gh;
 }
 
+/**
+ * nflog_adopt_group - get a handle for a group already bound on the socket
+ * \param h Netfilter log handle obtained via call to nflog_open_fd()
+ * \param num the number of the group
+ *
+ * Unlike nflog_bind_group(), this does not ask the kernel to bind the group,
+ * so that no message is lost while the socket changes hands, see
+ * nflog_open_fd(). If the group has already been adopted, eg. by
+ * nflog_import(), its handle is returned.
+ *
+ * \return a nflog_g_handle pointing to the group, or NULL on failure with
+ * \b errno set.
+ * \par Errors
+ * __ENOMEM__ No memory for the handle.
+ */
+struct nflog_g_handle *
+nflog_adopt_group(struct nflog_handle *h, uint16_t num)
+{
+	struct nflog_g_handle *gh;
+
+	gh = find_gh(h, num);
+	if (gh)
+		return gh;
+
+	gh = calloc(1, sizeof(*gh));
+	if (!gh)
+		return NULL;
+
+	gh->h = h;
+	gh->id = num;
+
+	add_gh(gh);
+	return gh;
+}
+
 /**
  * @}
  */
@@ -506,8 +774,12 @@ int nflog_unbind_group(struct nflog_g_handle *gh)
 {
 	int ret = __build_send_cfg_msg(gh->h, NFULNL_CFG_CMD_UNBIND, gh->id, 0);
 	if (ret == 0) {
-		del_gh(gh);
-		free(gh);
+		/* from a callback, fair dispatch still holds on to it */
+		if (gh->h->dispatching) {
+			gh->unbound = 1;
+			gh->cb = NULL;
+		} else
+			__nflog_gh_free(gh);
 	}
 
 	return ret;
@@ -533,22 +805,16 @@ int nflog_unbind_group(struct nflog_g_handle *gh)
 int nflog_set_mode(struct nflog_g_handle *gh,
 		   uint8_t mode, uint32_t range)
 {
-	union {
-		char buf[NFNL_HEADER_LEN
-			+NFA_LENGTH(sizeof(struct nfulnl_msg_config_mode))];
-		struct nlmsghdr nmh;
-	} u;
-	struct nfulnl_msg_config_mode params;
+	union nflog_mode_msg u;
 
-	nfnl_fill_hdr(gh->h->nfnlssh, &u.nmh, 0, AF_UNSPEC, gh->id,
-		      NFULNL_MSG_CONFIG, NLM_F_REQUEST|NLM_F_ACK);
+	build_mode_msg(gh, &u, NLM_F_REQUEST|NLM_F_ACK, mode, range);
 
-	params.copy_range = htonl(range);	/* copy_range is short */
-	params.copy_mode = mode;
-	nfnl_addattr_l(&u.nmh, sizeof(u), NFULA_CFG_MODE, &params,
-		       sizeof(params));
+	if (nflog_query(gh->h, &u.nmh) < 0)
+		return -1;
 
-	return nfnl_query(gh->h->nfnlh, &u.nmh);
+	gh->copy_mode = mode;
+	gh->copy_range = range;
+	return 0;
 }
 
 /**
@@ -577,7 +843,7 @@ int nflog_set_timeout(struct nflog_g_handle *gh, uint32_t timeout)
 
 	nfnl_addattr32(&u.nmh, sizeof(u), NFULA_CFG_TIMEOUT, htonl(timeout));
 
-	return nfnl_query(gh->h->nfnlh, &u.nmh);
+	return nflog_query(gh->h, &u.nmh);
 }
 
 /**
@@ -604,7 +870,7 @@ int nflog_set_qthresh(struct nflog_g_handle *gh, uint32_t qthresh)
 
 	nfnl_addattr32(&u.nmh, sizeof(u), NFULA_CFG_QTHRESH, htonl(qthresh));
 
-	return nfnl_query(gh->h->nfnlh, &u.nmh);
+	return nflog_query(gh->h, &u.nmh);
 }
 
 /**
@@ -636,11 +902,14 @@ int nflog_set_nlbufsiz(struct nflog_g_handle *gh, uint32_t nlbufsiz)
 
 	nfnl_addattr32(&u.nmh, sizeof(u), NFULA_CFG_NLBUFSIZ, htonl(nlbufsiz));
 
-	status = nfnl_query(gh->h->nfnlh, &u.nmh);
+	status = nflog_query(gh->h, &u.nmh);
 
 	/* we try to have space for at least 10 messages in the socket buffer */
-	if (status >= 0)
+	if (status >= 0) {
 		nfnl_rcvbufsiz(gh->h->nfnlh, 10*nlbufsiz);
+		if (nlbufsiz > gh->h->nlbufsiz)
+			gh->h->nlbufsiz = nlbufsiz;
+	}
 
 	return status;
 }
@@ -672,7 +941,7 @@ int nflog_set_flags(struct nflog_g_handle *gh, uint16_t flags)
 
 	nfnl_addattr16(&u.nmh, sizeof(u), NFULA_CFG_FLAGS, htons(flags));
 
-	return nfnl_query(gh->h->nfnlh, &u.nmh);
+	return nflog_query(gh->h, &u.nmh);
 }
 
 /**
@@ -691,6 +960,31 @@ int nflog_set_flags(struct nflog_g_handle *gh, uint16_t flags)
  * @{
  */
 
+/* the inline accessors read struct nflog_data through its public layout */
+_Static_assert(sizeof(struct nflog_data) == sizeof(struct nflog_data_layout) &&
+	       offsetof(struct nflog_data, nfa) ==
+	       offsetof(struct nflog_data_layout, attr) &&
+	       sizeof(struct nfattr) == sizeof(struct nlattr),
+	       "bump NFLOG_DATA_LAYOUT");
+
+/**
+ * nflog_data_layout - get the layout of the logged packet data
+ *
+ * The accessors in libnetfilter_log_inline.h, eg. nflog_inline_get_nfmark(),
+ * do what the nflog_get_*() functions of this group do without calling into
+ * the library, so that the compiler can inline them in the callback. They
+ * read the data passed to the callback as laid out in version
+ * NFLOG_DATA_LAYOUT of that header. Applications check once that it matches
+ * the library they run with, via nflog_inline_usable(), and fall back to
+ * the functions otherwise.
+ *
+ * \return the version of the layout of struct nflog_data.
+ */
+int nflog_data_layout(void)
+{
+	return NFLOG_DATA_LAYOUT;
+}
+
 /**
  * nflog_get_msg_packet_hdr - return the metaheader that wraps the packet
  * \param nfad Netlink packet data handle passed to callback function
@@ -901,6 +1195,62 @@ char *nflog_get_prefix(struct nflog_data *nfad)
 	return nfnl_get_pointer_to_data(nfad->nfa, NFULA_PREFIX, char);
 }
 
+/**
+ * nflog_get_prefix_id - get a small integer identifying the logging prefix
+ * \param nfad Netlink packet data handle passed to callback function
+ *
+ * Every handle keeps a table of the prefixes it has seen so far. The first
+ * packet carrying a given prefix adds it to the table, later packets with
+ * the same prefix get the same identifier back. Identifiers are allocated
+ * from zero upwards and stay valid until nflog_close(), so they can be used
+ * as array indexes or dictionary keys instead of the prefix string. Use
+ * nflog_prefix_name() to turn the identifier back into the string.
+ *
+ * This is only available to packets received through nflog_handle_packet().
+ *
+ * \return the prefix identifier or -1 if there is no prefix or it could not
+ * be stored, in which case \b errno is set.
+ * \par Errors
+ * __ENOENT__ The packet has no prefix or was not received via a handle.
+ * \n __ENOSPC__ Too many distinct prefixes have been seen on this handle.
+ * \n __ENOMEM__ No memory to store a new prefix.
+ */
+int nflog_get_prefix_id(struct nflog_data *nfad)
+{
+	struct nfattr *attr = nfad->nfa[NFULA_PREFIX - 1];
+	const char *prefix;
+	int len;
+
+	if (!attr || !nfad->gh) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	prefix = NFA_DATA(attr);
+	len = NFA_PAYLOAD(attr);
+	if (len > 0 && prefix[len - 1] == '\0')
+		len--;
+
+	return __nflog_prefix_intern(&nfad->gh->h->prefixes, prefix, len);
+}
+
+/**
+ * nflog_prefix_name - get the prefix string for a prefix identifier
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param id prefix identifier returned by nflog_get_prefix_id()
+ *
+ * The string is owned by the handle and remains valid until nflog_close().
+ *
+ * \return the prefix string or NULL if \b id is unknown on this handle.
+ */
+const char *nflog_prefix_name(struct nflog_handle *h, int id)
+{
+	if (id < 0)
+		return NULL;
+
+	return __nflog_prefix_name(&h->prefixes, id);
+}
+
 /**
  * nflog_get_uid - get the UID of the user that generated the packet
  * \param nfad Netlink packet data handle passed to callback function
@@ -1013,209 +1363,938 @@ int nflog_get_ctid(struct nflog_data *nfad, uint32_t *id)
  * @}
  */
 
-#define SNPRINTF_FAILURE(ret, rem, offset, len)			\
-do {								\
-	if (ret < 0)						\
-		return ret;					\
-	len += ret;						\
-	if (ret > rem)						\
-		ret = rem;					\
-	offset += ret;						\
-	rem -= ret;						\
-} while (0)
-
-/**
- * \defgroup Printing Printing
- * \manonly
-.SH SYNOPSIS
-.nf
-\fB
-#include <libnetfilter_log/libnetfilter_log.h>
-\endmanonly
- * @{
+/*
+ * The printers write through an output cursor. Over a plain buffer it keeps
+ * the snprintf() semantics: what does not fit is cut, but still counted in
+ * the length returned. Over a string buffer, see nflog_strbuf_append_xml(),
+ * it grows the buffer instead, so every record is formatted exactly once.
  */
+struct nflog_out {
+	char			*buf;
+	size_t			size;
+	size_t			off;	/* where the next piece goes */
+	int			len;	/* of the whole output, as snprintf() */
+	struct nflog_strbuf	*sb;	/* grow this one, if set */
+};
 
-/**
- * nflog_snprintf_xml - print the logged packet in XML format into a buffer
- * \param buf The buffer that you want to use to print the logged packet
- * \param rem The size of the buffer that you have passed
- * \param tb Netlink packet data handle passed to callback function
- * \param flags The flag that tell what to print into the buffer
- *
- * This function supports the following flags:
- *
- *	- NFLOG_XML_PREFIX: include the string prefix
- *	- NFLOG_XML_HW: include the hardware link layer address
- *	- NFLOG_XML_MARK: include the packet mark
- *	- NFLOG_XML_DEV: include the device information
- *	- NFLOG_XML_PHYSDEV: include the physical device information
- *	- NFLOG_XML_PAYLOAD: include the payload (in hexadecimal)
- *	- NFLOG_XML_TIME: include the timestamp
- *	- NFLOG_XML_CTID: include conntrack id
- *	- NFLOG_XML_ALL: include all the logging information (all flags set)
- *
- * You can combine these flags with a bitwise OR.
- *
- * \return -1 in case of failure, otherwise the length of the string that
- * would have been printed into the buffer (in case that there is enough
- * room in it). See snprintf() return value for more information.
- * \par Errors
- * from underlying calls, in exceptional circumstances
- */
-int nflog_snprintf_xml(char *buf, size_t rem, struct nflog_data *tb, int flags)
+/* make room for _need_ more bytes and the terminating NUL */
+static int nflog_out_reserve(struct nflog_out *o, size_t need)
 {
-	int size, offset = 0, len = 0, ret;
-	struct nfulnl_msg_packet_hw *hwph;
-	struct nfulnl_msg_packet_hdr *ph;
-	uint32_t mark, ifi, ctid;
-	char *data;
+	size_t size = o->size ? o->size : 256;
+	char *buf;
 
-	size = snprintf(buf + offset, rem, "<log>");
-	SNPRINTF_FAILURE(size, rem, offset, len);
+	if (!o->sb || o->size - o->off > need)
+		return 0;
 
-	if (flags & NFLOG_XML_TIME) {
-		time_t t;
-		struct tm tm;
+	while (size - o->off <= need)
+		size *= 2;
 
-		t = time(NULL);
-		if (localtime_r(&t, &tm) == NULL)
-			return -1;
+	buf = realloc(o->buf, size);
+	if (!buf)
+		return -1;
+
+	o->buf = o->sb->data = buf;
+	o->size = o->sb->size = size;
+	return 0;
+}
 
-		size = snprintf(buf + offset, rem, "<when>");
-		SNPRINTF_FAILURE(size, rem, offset, len);
+/* account _len_ bytes of output, of which what fitted was written */
+static void nflog_out_advance(struct nflog_out *o, size_t len)
+{
+	size_t room = o->size - o->off;
 
-		size = snprintf(buf + offset, rem,
-				"<hour>%d</hour>", tm.tm_hour);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+	o->len += len;
+	o->off += len < room ? len : room;
+}
 
-		size = snprintf(buf + offset,
-				rem, "<min>%02d</min>", tm.tm_min);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+static int __attribute__((format(printf, 2, 3)))
+nflog_out_printf(struct nflog_out *o, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	for (;;) {
+		va_start(ap, fmt);
+		ret = vsnprintf(o->buf + o->off, o->size - o->off, fmt, ap);
+		va_end(ap);
+		if (ret < 0)
+			return -1;
 
-		size = snprintf(buf + offset,
-				rem, "<sec>%02d</sec>", tm.tm_sec);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		/* this piece did not fit, format it again once grown */
+		if (!o->sb || (size_t)ret < o->size - o->off)
+			break;
+		if (nflog_out_reserve(o, ret) < 0)
+			return -1;
+	}
 
-		size = snprintf(buf + offset, rem, "<wday>%d</wday>",
-				tm.tm_wday + 1);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+	nflog_out_advance(o, ret);
+	return 0;
+}
 
-		size = snprintf(buf + offset, rem, "<day>%d</day>", tm.tm_mday);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+#define OUT_PRINTF(o, ...)					\
+do {								\
+	if (nflog_out_printf(o, __VA_ARGS__) < 0)		\
+		return -1;					\
+} while (0)
 
-		size = snprintf(buf + offset, rem, "<month>%d</month>",
-				tm.tm_mon + 1);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+/* as a "%.*s" printf, without going through the format parser */
+static int nflog_out_mem(struct nflog_out *o, const char *data, size_t len)
+{
+	size_t room;
 
-		size = snprintf(buf + offset, rem, "<year>%d</year>",
-				1900 + tm.tm_year);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+	if (nflog_out_reserve(o, len) < 0)
+		return -1;
 
-		size = snprintf(buf + offset, rem, "</when>");
-		SNPRINTF_FAILURE(size, rem, offset, len);
-	}
+	room = o->size - o->off;
+	if (room) {
+		size_t n = len < room ? len : room - 1;
 
-	data = nflog_get_prefix(tb);
-	if (data && (flags & NFLOG_XML_PREFIX)) {
-		size = snprintf(buf + offset, rem, "<prefix>%s</prefix>", data);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		memcpy(o->buf + o->off, data, n);
+		o->buf[o->off + n] = '\0';
 	}
 
-	ph = nflog_get_msg_packet_hdr(tb);
-	if (ph) {
-		size = snprintf(buf + offset, rem, "<hook>%u</hook>", ph->hook);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+	nflog_out_advance(o, len);
+	return 0;
+}
 
-		hwph = nflog_get_packet_hw(tb);
-		if (hwph && (flags & NFLOG_XML_HW)) {
-			int i, hlen = ntohs(hwph->hw_addrlen);
+/* as printing every byte of _data_ with "%02x", in one go */
+static int nflog_out_hex(struct nflog_out *o, const void *data, size_t len)
+{
+	static const char digits[] = "0123456789abcdef";
+	const unsigned char *p = data;
+	size_t i, room;
 
-			size = snprintf(buf + offset, rem, "<hw><proto>%04x"
-							   "</proto>",
-					ntohs(ph->hw_protocol));
-			SNPRINTF_FAILURE(size, rem, offset, len);
+	if (nflog_out_reserve(o, 2 * len) < 0)
+		return -1;
 
-			size = snprintf(buf + offset, rem, "<src>");
-			SNPRINTF_FAILURE(size, rem, offset, len);
+	room = o->size - o->off;
+	if (room) {
+		size_t n = 2 * len < room ? 2 * len : room - 1;
+		char *s = o->buf + o->off;
 
-			for (i=0; i<hlen; i++) {
-				size = snprintf(buf + offset, rem, "%02x",
-						hwph->hw_addr[i]);
-				SNPRINTF_FAILURE(size, rem, offset, len);
-			}
+		for (i = 0; i < n; i++)
+			s[i] = digits[(p[i / 2] >> (i & 1 ? 0 : 4)) & 0xf];
+		s[n] = '\0';
+	}
+
+	nflog_out_advance(o, 2 * len);
+	return 0;
+}
+
+/* guess the payload family from the link layer protocol, if known */
+static uint8_t nflog_pkt_family(const struct nfulnl_msg_packet_hdr *ph)
+{
+	if (!ph)
+		return AF_UNSPEC;
+
+	switch (ntohs(ph->hw_protocol)) {
+	case ETHERTYPE_IP:
+		return AF_INET;
+	case ETHERTYPE_IPV6:
+		return AF_INET6;
+	}
+	return AF_UNSPEC;
+}
+
+/* maximum number of tunnel headers unwrapped by the printers */
+#define NFLOG_PKT_DEPTH	4
+
+static const char *nflog_encap_name[] = {
+	[NFLOG_ENCAP_NONE]	= "none",
+	[NFLOG_ENCAP_IPIP]	= "ipip",
+	[NFLOG_ENCAP_GRE]	= "gre",
+	[NFLOG_ENCAP_VXLAN]	= "vxlan",
+	[NFLOG_ENCAP_GENEVE]	= "geneve",
+};
+
+static int nflog_pkt_print_xml(struct nflog_out *o, const struct nflog_pkt *pkt)
+{
+	const char *tag = pkt->encap ? "inner" : "pkt";
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(pkt->family, &pkt->src, src, sizeof(src));
+	inet_ntop(pkt->family, &pkt->dst, dst, sizeof(dst));
+
+	OUT_PRINTF(o, "<%s>", tag);
+
+	if (pkt->encap)
+		OUT_PRINTF(o, "<encap>%s</encap><tunid>%u</tunid>",
+			   nflog_encap_name[pkt->encap], pkt->tun_id);
+
+	OUT_PRINTF(o, "<src>%s</src><dst>%s</dst>"
+		   "<proto>%u</proto><ttl>%u</ttl>",
+		   src, dst, pkt->l4proto, pkt->ttl);
+
+	if (pkt->flags & NFLOG_PKT_F_FRAG)
+		OUT_PRINTF(o, "<frag><id>%u</id>"
+			   "<off>%u</off><mf>%u</mf></frag>",
+			   pkt->frag_id, pkt->frag_off,
+			   !!(pkt->flags & NFLOG_PKT_F_MF));
+
+	if (pkt->flags & NFLOG_PKT_F_L4) {
+		switch (pkt->l4proto) {
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			OUT_PRINTF(o, "<type>%u</type><code>%u</code>",
+				   pkt->icmp_type, pkt->icmp_code);
+			break;
+		case IPPROTO_TCP:
+			OUT_PRINTF(o, "<sport>%u</sport><dport>%u</dport>"
+				   "<flags>%02x</flags>",
+				   pkt->sport, pkt->dport, pkt->tcp_flags);
+			break;
+		default:
+			OUT_PRINTF(o, "<sport>%u</sport><dport>%u</dport>",
+				   pkt->sport, pkt->dport);
+			break;
+		}
+	}
+
+	OUT_PRINTF(o, "</%s>", tag);
+
+	return 0;
+}
+
+static int nflog_pkt_print_json(struct nflog_out *o,
+				const struct nflog_pkt *pkt)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(pkt->family, &pkt->src, src, sizeof(src));
+	inet_ntop(pkt->family, &pkt->dst, dst, sizeof(dst));
+
+	OUT_PRINTF(o, "{");
+
+	if (pkt->encap)
+		OUT_PRINTF(o, "\"encap\":\"%s\",\"tunid\":%u,",
+			   nflog_encap_name[pkt->encap], pkt->tun_id);
+
+	OUT_PRINTF(o, "\"src\":\"%s\",\"dst\":\"%s\","
+		   "\"proto\":%u,\"ttl\":%u",
+		   src, dst, pkt->l4proto, pkt->ttl);
+
+	if (pkt->flags & NFLOG_PKT_F_FRAG)
+		OUT_PRINTF(o, ",\"frag\":{\"id\":%u,"
+			   "\"off\":%u,\"mf\":%u}",
+			   pkt->frag_id, pkt->frag_off,
+			   !!(pkt->flags & NFLOG_PKT_F_MF));
+
+	if (pkt->flags & NFLOG_PKT_F_L4) {
+		switch (pkt->l4proto) {
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			OUT_PRINTF(o, ",\"type\":%u,\"code\":%u",
+				   pkt->icmp_type, pkt->icmp_code);
+			break;
+		case IPPROTO_TCP:
+			OUT_PRINTF(o, ",\"sport\":%u,\"dport\":%u,"
+				   "\"flags\":\"%02x\"",
+				   pkt->sport, pkt->dport, pkt->tcp_flags);
+			break;
+		default:
+			OUT_PRINTF(o, ",\"sport\":%u,\"dport\":%u",
+				   pkt->sport, pkt->dport);
+			break;
+		}
+	}
+
+	OUT_PRINTF(o, "}");
+
+	return 0;
+}
+
+static int nflog_eth_print_xml(struct nflog_out *o, const struct nflog_eth *eth)
+{
+	int i;
+
+	OUT_PRINTF(o, "<eth><dst>%02x%02x%02x%02x%02x%02x"
+		   "</dst><src>%02x%02x%02x%02x%02x%02x</src>",
+		   eth->dst[0], eth->dst[1], eth->dst[2],
+		   eth->dst[3], eth->dst[4], eth->dst[5],
+		   eth->src[0], eth->src[1], eth->src[2],
+		   eth->src[3], eth->src[4], eth->src[5]);
+
+	for (i = 0; i < eth->vlan_count; i++)
+		OUT_PRINTF(o, "<vlan><tpid>%04x</tpid>"
+			   "<id>%u</id><pcp>%u</pcp></vlan>",
+			   eth->vlan_tpid[i], eth->vlan_tci[i] & 0x0fff,
+			   eth->vlan_tci[i] >> 13);
+
+	OUT_PRINTF(o, "<proto>%04x</proto></eth>", eth->proto);
+
+	return 0;
+}
+
+static int nflog_eth_print_json(struct nflog_out *o,
+				const struct nflog_eth *eth)
+{
+	int i;
+
+	OUT_PRINTF(o, "\"eth\":{"
+		   "\"dst\":\"%02x%02x%02x%02x%02x%02x\","
+		   "\"src\":\"%02x%02x%02x%02x%02x%02x\",\"vlan\":[",
+		   eth->dst[0], eth->dst[1], eth->dst[2],
+		   eth->dst[3], eth->dst[4], eth->dst[5],
+		   eth->src[0], eth->src[1], eth->src[2],
+		   eth->src[3], eth->src[4], eth->src[5]);
+
+	for (i = 0; i < eth->vlan_count; i++)
+		OUT_PRINTF(o, "%s{\"tpid\":\"%04x\","
+			   "\"id\":%u,\"pcp\":%u}", i ? "," : "",
+			   eth->vlan_tpid[i], eth->vlan_tci[i] & 0x0fff,
+			   eth->vlan_tci[i] >> 13);
+
+	OUT_PRINTF(o, "],\"proto\":\"%04x\"}", eth->proto);
+
+	return 0;
+}
+
+static int nflog_ct_tuple_print_xml(struct nflog_out *o, const char *tag,
+				    const struct nflog_ct_tuple *t)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(t->family, &t->src, src, sizeof(src));
+	inet_ntop(t->family, &t->dst, dst, sizeof(dst));
+
+	switch (t->l4proto) {
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		OUT_PRINTF(o, "<%s><src>%s</src>"
+			   "<dst>%s</dst><proto>%u</proto><type>%u</type>"
+			   "<code>%u</code><id>%u</id></%s>",
+			   tag, src, dst, t->l4proto, t->icmp_type,
+			   t->icmp_code, t->sport, tag);
+		break;
+	default:
+		OUT_PRINTF(o, "<%s><src>%s</src>"
+			   "<dst>%s</dst><proto>%u</proto>"
+			   "<sport>%u</sport><dport>%u</dport></%s>",
+			   tag, src, dst, t->l4proto, t->sport, t->dport,
+			   tag);
+		break;
+	}
+
+	return 0;
+}
+
+static int nflog_ct_print_xml(struct nflog_out *o, const struct nflog_ct *ct)
+{
+	OUT_PRINTF(o, "<ct>");
+
+	if ((ct->attrs & NFLOG_CT_F_ORIG) &&
+	    nflog_ct_tuple_print_xml(o, "orig", &ct->orig) < 0)
+		return -1;
+	if ((ct->attrs & NFLOG_CT_F_REPLY) &&
+	    nflog_ct_tuple_print_xml(o, "reply", &ct->reply) < 0)
+		return -1;
+	if (ct->attrs & NFLOG_CT_F_STATUS)
+		OUT_PRINTF(o, "<status>%x</status>", ct->status);
+	if (ct->attrs & NFLOG_CT_F_MARK)
+		OUT_PRINTF(o, "<mark>%u</mark>", ct->mark);
+	if (ct->attrs & NFLOG_CT_F_ZONE)
+		OUT_PRINTF(o, "<zone>%u</zone>", ct->zone);
+	if (ct->attrs & NFLOG_CT_F_ID)
+		OUT_PRINTF(o, "<id>%u</id>", ct->id);
+	if (ct->attrs & NFLOG_CT_F_TIMEOUT)
+		OUT_PRINTF(o, "<timeout>%u</timeout>", ct->timeout);
+	if (ct->attrs & NFLOG_CT_F_LABELS) {
+		OUT_PRINTF(o, "<labels>");
+		if (nflog_out_hex(o, ct->labels, sizeof(ct->labels)) < 0)
+			return -1;
+		OUT_PRINTF(o, "</labels>");
+	}
+
+	OUT_PRINTF(o, "</ct>");
+
+	return 0;
+}
+
+static int nflog_ct_tuple_print_json(struct nflog_out *o, const char *key,
+				     const struct nflog_ct_tuple *t)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(t->family, &t->src, src, sizeof(src));
+	inet_ntop(t->family, &t->dst, dst, sizeof(dst));
+
+	switch (t->l4proto) {
+	case IPPROTO_ICMP:
+	case IPPROTO_ICMPV6:
+		OUT_PRINTF(o, "\"%s\":{\"src\":\"%s\","
+			   "\"dst\":\"%s\",\"proto\":%u,\"type\":%u,"
+			   "\"code\":%u,\"id\":%u}",
+			   key, src, dst, t->l4proto, t->icmp_type,
+			   t->icmp_code, t->sport);
+		break;
+	default:
+		OUT_PRINTF(o, "\"%s\":{\"src\":\"%s\","
+			   "\"dst\":\"%s\",\"proto\":%u,\"sport\":%u,"
+			   "\"dport\":%u}",
+			   key, src, dst, t->l4proto, t->sport, t->dport);
+		break;
+	}
+
+	return 0;
+}
 
-			size = snprintf(buf + offset, rem, "</src></hw>");
-			SNPRINTF_FAILURE(size, rem, offset, len);
+static int nflog_ct_print_json(struct nflog_out *o, const struct nflog_ct *ct)
+{
+	const char *sep = "";
+
+	OUT_PRINTF(o, "\"ct\":{");
+
+	if (ct->attrs & NFLOG_CT_F_ORIG) {
+		if (nflog_ct_tuple_print_json(o, "orig", &ct->orig) < 0)
+			return -1;
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_REPLY) {
+		OUT_PRINTF(o, "%s", sep);
+		if (nflog_ct_tuple_print_json(o, "reply", &ct->reply) < 0)
+			return -1;
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_STATUS) {
+		OUT_PRINTF(o, "%s\"status\":%u", sep, ct->status);
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_MARK) {
+		OUT_PRINTF(o, "%s\"mark\":%u", sep, ct->mark);
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_ZONE) {
+		OUT_PRINTF(o, "%s\"zone\":%u", sep, ct->zone);
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_ID) {
+		OUT_PRINTF(o, "%s\"id\":%u", sep, ct->id);
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_TIMEOUT) {
+		OUT_PRINTF(o, "%s\"timeout\":%u", sep, ct->timeout);
+		sep = ",";
+	}
+	if (ct->attrs & NFLOG_CT_F_LABELS) {
+		OUT_PRINTF(o, "%s\"labels\":\"", sep);
+		if (nflog_out_hex(o, ct->labels, sizeof(ct->labels)) < 0)
+			return -1;
+		OUT_PRINTF(o, "\"");
+	}
+
+	OUT_PRINTF(o, "}");
+
+	return 0;
+}
+
+/* print _str_ as a JSON string, escaping what needs to be escaped */
+static int nflog_json_print_str(struct nflog_out *o, const char *str)
+{
+	const char *c;
+	size_t n;
+
+	OUT_PRINTF(o, "\"");
+
+	for (c = str; *c; c += n) {
+		/* the run of characters that go as they are */
+		for (n = 0; c[n] && c[n] != '"' && c[n] != '\\' &&
+			    (unsigned char)c[n] >= 0x20; n++)
+			;
+		if (n) {
+			if (nflog_out_mem(o, c, n) < 0)
+				return -1;
+			continue;
+		}
+
+		if (*c == '"' || *c == '\\')
+			OUT_PRINTF(o, "\\%c", *c);
+		else
+			OUT_PRINTF(o, "\\u%04x", (unsigned char)*c);
+		n = 1;
+	}
+
+	OUT_PRINTF(o, "\"");
+
+	return 0;
+}
+
+/* NFLOG_XML_ALL predates the decoded fields, they have to be asked for */
+static int nflog_print_flags(int flags)
+{
+	if ((unsigned int)flags == NFLOG_XML_ALL)
+		return flags & ~NFLOG_XML_EXT;
+
+	return flags;
+}
+
+static int nflog_print_xml(struct nflog_out *o, struct nflog_data *tb,
+			   int flags)
+{
+	struct nfulnl_msg_packet_hw *hwph;
+	struct nfulnl_msg_packet_hdr *ph;
+	uint32_t mark, ifi, ctid;
+	char *data;
+	int ret;
+
+	flags = nflog_print_flags(flags);
+
+	OUT_PRINTF(o, "<log>");
+
+	if (flags & NFLOG_XML_TIME) {
+		time_t t;
+		struct tm tm;
+
+		t = time(NULL);
+		if (localtime_r(&t, &tm) == NULL)
+			return -1;
+
+		OUT_PRINTF(o, "<when><hour>%d</hour><min>%02d</min>"
+			   "<sec>%02d</sec><wday>%d</wday><day>%d</day>"
+			   "<month>%d</month><year>%d</year></when>",
+			   tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_wday + 1,
+			   tm.tm_mday, tm.tm_mon + 1, 1900 + tm.tm_year);
+	}
+
+	data = nflog_get_prefix(tb);
+	if (data && (flags & NFLOG_XML_PREFIX))
+		OUT_PRINTF(o, "<prefix>%s</prefix>", data);
+
+	if (data && (flags & NFLOG_XML_PREFIXID)) {
+		int id = nflog_get_prefix_id(tb);
+
+		if (id >= 0)
+			OUT_PRINTF(o, "<prefixid>%d</prefixid>", id);
+	}
+
+	ph = nflog_get_msg_packet_hdr(tb);
+	if (ph) {
+		OUT_PRINTF(o, "<hook>%u</hook>", ph->hook);
+
+		hwph = nflog_get_packet_hw(tb);
+		if (hwph && (flags & NFLOG_XML_HW)) {
+			OUT_PRINTF(o, "<hw><proto>%04x</proto><src>",
+				   ntohs(ph->hw_protocol));
+			if (nflog_out_hex(o, hwph->hw_addr,
+					  ntohs(hwph->hw_addrlen)) < 0)
+				return -1;
+			OUT_PRINTF(o, "</src></hw>");
 		} else if (flags & NFLOG_XML_HW) {
-			size = snprintf(buf + offset, rem, "<hw><proto>%04x"
-						    "</proto></hw>",
-				 ntohs(ph->hw_protocol));
-			SNPRINTF_FAILURE(size, rem, offset, len);
+			OUT_PRINTF(o, "<hw><proto>%04x</proto></hw>",
+				   ntohs(ph->hw_protocol));
+		}
+	}
+
+	if (flags & NFLOG_XML_ETH) {
+		struct nflog_eth eth;
+
+		if (nflog_get_eth(tb, &eth) == 0 &&
+		    nflog_eth_print_xml(o, &eth) < 0)
+			return -1;
+	}
+
+	mark = nflog_get_nfmark(tb);
+	if (mark && (flags & NFLOG_XML_MARK))
+		OUT_PRINTF(o, "<mark>%u</mark>", mark);
+
+	ifi = nflog_get_indev(tb);
+	if (ifi && (flags & NFLOG_XML_DEV))
+		OUT_PRINTF(o, "<indev>%u</indev>", ifi);
+
+	ifi = nflog_get_outdev(tb);
+	if (ifi && (flags & NFLOG_XML_DEV))
+		OUT_PRINTF(o, "<outdev>%u</outdev>", ifi);
+
+	ifi = nflog_get_physindev(tb);
+	if (ifi && (flags & NFLOG_XML_PHYSDEV))
+		OUT_PRINTF(o, "<physindev>%u</physindev>", ifi);
+
+	ifi = nflog_get_physoutdev(tb);
+	if (ifi && (flags & NFLOG_XML_PHYSDEV))
+		OUT_PRINTF(o, "<physoutdev>%u</physoutdev>", ifi);
+
+	if ((flags & NFLOG_XML_CTID) && nflog_get_ctid(tb, &ctid) >= 0)
+		OUT_PRINTF(o, "<ctid>%u</ctid>", ctid);
+
+	if (flags & NFLOG_XML_CT) {
+		struct nflog_ct ct;
+
+		if (nflog_get_ct(tb, &ct) == 0 &&
+		    nflog_ct_print_xml(o, &ct) < 0)
+			return -1;
+	}
+
+	ret = nflog_get_payload(tb, &data);
+	if (ret >= 0 && (flags & NFLOG_XML_PKT)) {
+		struct nflog_pkt pkt[NFLOG_PKT_DEPTH];
+		int i, n;
+
+		n = nflog_payload_parse_tunnel(data, ret, nflog_pkt_family(ph),
+					       pkt, NFLOG_PKT_DEPTH);
+		if (n > 0)
+			__nflog_payload_consumed(tb,
+				__nflog_pkt_extent(&pkt[n - 1], ret), ret);
+		for (i = 0; i < n; i++) {
+			if (nflog_pkt_print_xml(o, &pkt[i]) < 0)
+				return -1;
+		}
+	}
+
+	if (ret >= 0 && (flags & NFLOG_XML_PAYLOAD)) {
+		__nflog_payload_consumed(tb, ret, ret);
+
+		OUT_PRINTF(o, "<payload>");
+		if (nflog_out_hex(o, data, ret) < 0)
+			return -1;
+		OUT_PRINTF(o, "</payload>");
+	}
+
+	OUT_PRINTF(o, "</log>");
+
+	return 0;
+}
+
+static int nflog_print_json(struct nflog_out *o, struct nflog_data *tb,
+			    int flags)
+{
+	struct nfulnl_msg_packet_hw *hwph;
+	struct nfulnl_msg_packet_hdr *ph;
+	uint32_t mark, ifi, ctid;
+	const char *sep = "";
+	char *data;
+	int ret;
+
+	flags = nflog_print_flags(flags);
+
+	OUT_PRINTF(o, "{");
+
+	if (flags & NFLOG_XML_TIME) {
+		time_t t;
+		struct tm tm;
+
+		t = time(NULL);
+		if (localtime_r(&t, &tm) == NULL)
+			return -1;
+
+		OUT_PRINTF(o, "\"when\":{\"hour\":%d,"
+			   "\"min\":%d,\"sec\":%d,\"wday\":%d,\"day\":%d,"
+			   "\"month\":%d,\"year\":%d}",
+			   tm.tm_hour, tm.tm_min, tm.tm_sec,
+			   tm.tm_wday + 1, tm.tm_mday, tm.tm_mon + 1,
+			   1900 + tm.tm_year);
+		sep = ",";
+	}
+
+	data = nflog_get_prefix(tb);
+	if (data && (flags & NFLOG_XML_PREFIX)) {
+		OUT_PRINTF(o, "%s\"prefix\":", sep);
+		if (nflog_json_print_str(o, data) < 0)
+			return -1;
+		sep = ",";
+	}
+
+	if (data && (flags & NFLOG_XML_PREFIXID)) {
+		int id = nflog_get_prefix_id(tb);
+
+		if (id >= 0) {
+			OUT_PRINTF(o, "%s\"prefixid\":%d", sep, id);
+			sep = ",";
+		}
+	}
+
+	ph = nflog_get_msg_packet_hdr(tb);
+	if (ph) {
+		OUT_PRINTF(o, "%s\"hook\":%u", sep, ph->hook);
+		sep = ",";
+
+		if (flags & NFLOG_XML_HW) {
+			OUT_PRINTF(o, ",\"hw\":{\"proto\":\"%04x\"",
+				   ntohs(ph->hw_protocol));
+
+			hwph = nflog_get_packet_hw(tb);
+			if (hwph) {
+				OUT_PRINTF(o, ",\"src\":\"");
+				if (nflog_out_hex(o, hwph->hw_addr,
+						  ntohs(hwph->hw_addrlen)) < 0)
+					return -1;
+				OUT_PRINTF(o, "\"");
+			}
+
+			OUT_PRINTF(o, "}");
+		}
+	}
+
+	if (flags & NFLOG_XML_ETH) {
+		struct nflog_eth eth;
+
+		if (nflog_get_eth(tb, &eth) == 0) {
+			OUT_PRINTF(o, "%s", sep);
+			if (nflog_eth_print_json(o, &eth) < 0)
+				return -1;
+			sep = ",";
 		}
 	}
 
 	mark = nflog_get_nfmark(tb);
 	if (mark && (flags & NFLOG_XML_MARK)) {
-		size = snprintf(buf + offset, rem, "<mark>%u</mark>", mark);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		OUT_PRINTF(o, "%s\"mark\":%u", sep, mark);
+		sep = ",";
 	}
 
 	ifi = nflog_get_indev(tb);
 	if (ifi && (flags & NFLOG_XML_DEV)) {
-		size = snprintf(buf + offset, rem, "<indev>%u</indev>", ifi);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		OUT_PRINTF(o, "%s\"indev\":%u", sep, ifi);
+		sep = ",";
 	}
 
 	ifi = nflog_get_outdev(tb);
 	if (ifi && (flags & NFLOG_XML_DEV)) {
-		size = snprintf(buf + offset, rem, "<outdev>%u</outdev>", ifi);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		OUT_PRINTF(o, "%s\"outdev\":%u", sep, ifi);
+		sep = ",";
 	}
 
 	ifi = nflog_get_physindev(tb);
 	if (ifi && (flags & NFLOG_XML_PHYSDEV)) {
-		size = snprintf(buf + offset, rem,
-				"<physindev>%u</physindev>", ifi);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		OUT_PRINTF(o, "%s\"physindev\":%u", sep, ifi);
+		sep = ",";
 	}
 
 	ifi = nflog_get_physoutdev(tb);
 	if (ifi && (flags & NFLOG_XML_PHYSDEV)) {
-		size = snprintf(buf + offset, rem,
-				"<physoutdev>%u</physoutdev>", ifi);
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		OUT_PRINTF(o, "%s\"physoutdev\":%u", sep, ifi);
+		sep = ",";
+	}
+
+	if ((flags & NFLOG_XML_CTID) && nflog_get_ctid(tb, &ctid) >= 0) {
+		OUT_PRINTF(o, "%s\"ctid\":%u", sep, ctid);
+		sep = ",";
 	}
 
-	if (flags & NFLOG_XML_CTID) {
-		ret = nflog_get_ctid(tb, &ctid);
-		if (ret >= 0) {
-			size = snprintf(buf + offset, rem,
-					"<ctid>%u</ctid>", ctid);
-			SNPRINTF_FAILURE(size, rem, offset, len);
+	if (flags & NFLOG_XML_CT) {
+		struct nflog_ct ct;
+
+		if (nflog_get_ct(tb, &ct) == 0) {
+			OUT_PRINTF(o, "%s", sep);
+			if (nflog_ct_print_json(o, &ct) < 0)
+				return -1;
+			sep = ",";
 		}
 	}
 
 	ret = nflog_get_payload(tb, &data);
+	if (ret >= 0 && (flags & NFLOG_XML_PKT)) {
+		struct nflog_pkt pkt[NFLOG_PKT_DEPTH];
+		int i, n;
+
+		n = nflog_payload_parse_tunnel(data, ret, nflog_pkt_family(ph),
+					       pkt, NFLOG_PKT_DEPTH);
+		if (n > 0)
+			__nflog_payload_consumed(tb,
+				__nflog_pkt_extent(&pkt[n - 1], ret), ret);
+		for (i = 0; i < n; i++) {
+			if (i == 0)
+				OUT_PRINTF(o, "%s\"pkt\":", sep);
+			else if (i == 1)
+				OUT_PRINTF(o, ",\"inner\":[");
+			else
+				OUT_PRINTF(o, ",");
+
+			if (nflog_pkt_print_json(o, &pkt[i]) < 0)
+				return -1;
+			sep = ",";
+		}
+		if (n > 1)
+			OUT_PRINTF(o, "]");
+	}
+
 	if (ret >= 0 && (flags & NFLOG_XML_PAYLOAD)) {
-		int i;
+		__nflog_payload_consumed(tb, ret, ret);
 
-		size = snprintf(buf + offset, rem, "<payload>");
-		SNPRINTF_FAILURE(size, rem, offset, len);
+		OUT_PRINTF(o, "%s\"payload\":\"", sep);
+		if (nflog_out_hex(o, data, ret) < 0)
+			return -1;
+		OUT_PRINTF(o, "\"");
+	}
 
-		for (i=0; i<ret; i++) {
-			size = snprintf(buf + offset, rem, "%02x",
-					data[i] & 0xff);
-			SNPRINTF_FAILURE(size, rem, offset, len);
-		}
+	OUT_PRINTF(o, "}");
+
+	return 0;
+}
+
+/**
+ * \defgroup Printing Printing
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+/**
+ * nflog_snprintf_xml - print the logged packet in XML format into a buffer
+ * \param buf The buffer that you want to use to print the logged packet
+ * \param rem The size of the buffer that you have passed
+ * \param tb Netlink packet data handle passed to callback function
+ * \param flags The flag that tell what to print into the buffer
+ *
+ * This function supports the following flags:
+ *
+ *	- NFLOG_XML_PREFIX: include the string prefix
+ *	- NFLOG_XML_PREFIXID: include the prefix identifier
+ *	  (see nflog_get_prefix_id())
+ *	- NFLOG_XML_HW: include the hardware link layer address
+ *	- NFLOG_XML_MARK: include the packet mark
+ *	- NFLOG_XML_DEV: include the device information
+ *	- NFLOG_XML_PHYSDEV: include the physical device information
+ *	- NFLOG_XML_PAYLOAD: include the payload (in hexadecimal)
+ *	- NFLOG_XML_TIME: include the timestamp
+ *	- NFLOG_XML_CTID: include conntrack id
+ *	- NFLOG_XML_CT: include the decoded conntrack entry (see nflog_get_ct())
+ *	- NFLOG_XML_PKT: include the network and transport header fields
+ *	  decoded from the payload, and those of the packets it tunnels
+ *	  (see nflog_payload_parse_tunnel())
+ *	- NFLOG_XML_ETH: include the decoded Ethernet header and VLAN tags
+ *	  (see nflog_get_eth())
+ *	- NFLOG_XML_ALL: include all the logging information, except the
+ *	  decoded fields
+ *	- NFLOG_XML_EXT: include the decoded fields, ie. NFLOG_XML_PKT,
+ *	  NFLOG_XML_ETH, NFLOG_XML_CT and NFLOG_XML_PREFIXID
+ *	- NFLOG_XML_ALL_EXT: include all the logging information
+ *
+ * You can combine these flags with a bitwise OR. As NFLOG_XML_ALL sets every
+ * bit, the decoded fields are left out whenever \b flags is exactly
+ * NFLOG_XML_ALL, so that existing callers keep their output. Passing
+ * NFLOG_XML_PKT without NFLOG_XML_PAYLOAD prints the decoded header fields
+ * instead of the raw payload.
+ *
+ * A record that does not fit has to be formatted again into a larger
+ * buffer; nflog_strbuf_append_xml() formats it once into one that grows.
+ *
+ * \return -1 in case of failure, otherwise the length of the string that
+ * would have been printed into the buffer (in case that there is enough
+ * room in it). See snprintf() return value for more information.
+ * \par Errors
+ * from underlying calls, in exceptional circumstances
+ */
+int nflog_snprintf_xml(char *buf, size_t rem, struct nflog_data *tb, int flags)
+{
+	struct nflog_out o = { .buf = buf, .size = rem };
+
+	if (nflog_print_xml(&o, tb, flags) < 0)
+		return -1;
+
+	return o.len;
+}
+
+/**
+ * nflog_snprintf_json - print the logged packet in JSON format into a buffer
+ * \param buf The buffer that you want to use to print the logged packet
+ * \param rem The size of the buffer that you have passed
+ * \param tb Netlink packet data handle passed to callback function
+ * \param flags The flag that tell what to print into the buffer
+ *
+ * This function prints the same information as nflog_snprintf_xml() as a
+ * single JSON object, and supports the same flags.
+ *
+ * \return -1 in case of failure, otherwise the length of the string that
+ * would have been printed into the buffer (in case that there is enough
+ * room in it). See snprintf() return value for more information.
+ * \par Errors
+ * from underlying calls, in exceptional circumstances
+ */
+int nflog_snprintf_json(char *buf, size_t rem, struct nflog_data *tb, int flags)
+{
+	struct nflog_out o = { .buf = buf, .size = rem };
+
+	if (nflog_print_json(&o, tb, flags) < 0)
+		return -1;
+
+	return o.len;
+}
 
-		size = snprintf(buf + offset, rem, "</payload>");
-		SNPRINTF_FAILURE(size, rem, offset, len);
+/* format once into _sb_, which grows as needed, or leave it as it was */
+static int nflog_strbuf_append(struct nflog_strbuf *sb, struct nflog_data *tb,
+			       int flags,
+			       int (*print)(struct nflog_out *o,
+					    struct nflog_data *tb, int flags))
+{
+	struct nflog_out o = {
+		.buf	= sb->data,
+		.size	= sb->size,
+		.off	= sb->len,
+		.sb	= sb,
+	};
+
+	if (print(&o, tb, flags) < 0) {
+		if (sb->data)
+			sb->data[sb->len] = '\0';
+		return -1;
 	}
 
-	size = snprintf(buf + offset, rem, "</log>");
-	SNPRINTF_FAILURE(size, rem, offset, len);
+	sb->len = o.off;
+	return o.len;
+}
 
-	return len;
+/**
+ * nflog_strbuf_append_xml - append the logged packet in XML format
+ * \param sb string buffer to append to
+ * \param tb Netlink packet data handle passed to callback function
+ * \param flags The flag that tell what to print, see nflog_snprintf_xml()
+ *
+ * nflog_snprintf_xml() follows snprintf() semantics: if the record does not
+ * fit, the caller has to make room and format it all over again. This
+ * function formats the record exactly once, at the end of \b sb, and grows
+ * \b sb as it goes. A zeroed struct nflog_strbuf is a valid empty one.
+ *
+ * To reuse the memory across records, set \b sb->len back to zero once the
+ * output has been consumed: the buffer soon reaches the size of the largest
+ * record, and no more allocations take place. Release it with
+ * nflog_strbuf_release().
+ *
+ * \b sb->data is always NUL terminated after a call, and left as it was on
+ * failure.
+ *
+ * \return the length of the record appended, or -1 on failure
+ * \par Errors
+ * __ENOMEM__ the buffer could not be grown
+ */
+int nflog_strbuf_append_xml(struct nflog_strbuf *sb, struct nflog_data *tb,
+			    int flags)
+{
+	return nflog_strbuf_append(sb, tb, flags, nflog_print_xml);
+}
+
+/**
+ * nflog_strbuf_append_json - append the logged packet in JSON format
+ * \param sb string buffer to append to
+ * \param tb Netlink packet data handle passed to callback function
+ * \param flags The flag that tell what to print, see nflog_snprintf_xml()
+ *
+ * As nflog_strbuf_append_xml(), printing what nflog_snprintf_json() does.
+ *
+ * \return the length of the record appended, or -1 on failure
+ * \par Errors
+ * __ENOMEM__ the buffer could not be grown
+ */
+int nflog_strbuf_append_json(struct nflog_strbuf *sb, struct nflog_data *tb,
+			     int flags)
+{
+	return nflog_strbuf_append(sb, tb, flags, nflog_print_json);
+}
+
+/**
+ * nflog_strbuf_release - free the memory of a string buffer
+ * \param sb string buffer filled by nflog_strbuf_append_xml() and friends
+ *
+ * \b sb is left empty, and may be appended to again.
+ */
+void nflog_strbuf_release(struct nflog_strbuf *sb)
+{
+	free(sb->data);
+	sb->data = NULL;
+	sb->len = 0;
+	sb->size = 0;
 }
 
 /**
@@ -143,7 +143,12 @@ static int nflog_parse_attr_cb(const struct nlattr *attr, void *data)
 		if (mnl_attr_validate(attr, MNL_TYPE_NUL_STRING) < 0)
 			return MNL_CB_ERROR;
 		break;
+	case NFULA_VLAN:		/* nested vlan info */
+		if (mnl_attr_validate(attr, MNL_TYPE_NESTED) < 0)
+			return MNL_CB_ERROR;
+		break;
 	case NFULA_HWHEADER:		/* hardware header */
+	case NFULA_L2HDR:		/* full L2 header */
 	case NFULA_PAYLOAD:		/* opaque data payload */
 	case NFULA_CT:			/* nf_conntrack_netlink.h */
 		break;
@@ -184,13 +189,25 @@ int nflog_nlmsg_parse(const struct nlmsghdr *nlh, struct nlattr **attr)
  *	- NFLOG_XML_PHYSDEV: include the physical device information
  *	- NFLOG_XML_PAYLOAD: include the payload (in hexadecimal)
  *	- NFLOG_XML_TIME: include the timestamp
- *	- NFLOG_XML_ALL: include all the logging information (all flags set)
+ *	- NFLOG_XML_CTID: include conntrack id
+ *	- NFLOG_XML_CT: include the decoded conntrack entry
+ *	- NFLOG_XML_PKT: include the decoded network and transport headers
+ *	- NFLOG_XML_ETH: include the decoded Ethernet header and VLAN tags
+ *	- NFLOG_XML_PREFIXID: include the prefix identifier
+ *	- NFLOG_XML_ALL: include all the logging information, except the
+ *	  decoded fields
+ *	- NFLOG_XML_EXT: include the decoded fields (CT, PKT, ETH, PREFIXID)
+ *	- NFLOG_XML_ALL_EXT: include all the logging information
+ *
+ *   type: NFLOG_OUTPUT_JSON
+ *	- same flags as NFLOG_OUTPUT_XML, see nflog_snprintf_json()
  *
  * You can combine these flags with a bitwise OR.
  *
  * \return -1 on failure else same as snprintf
  * \par Errors
- * __EOPNOTSUPP__ _type_ is unsupported (i.e. not __NFLOG_OUTPUT_XML__)
+ * __EOPNOTSUPP__ _type_ is unsupported (i.e. neither __NFLOG_OUTPUT_XML__
+ * nor __NFLOG_OUTPUT_JSON__)
  * \sa __snprintf__(3)
  */
 int nflog_nlmsg_snprintf(char *buf, size_t bufsiz, const struct nlmsghdr *nlh,
@@ -207,6 +224,9 @@ int nflog_nlmsg_snprintf(char *buf, size_t bufsiz, const struct nlmsghdr *nlh,
 	case NFLOG_OUTPUT_XML:
 		ret = nflog_snprintf_xml(buf, bufsiz, &nfad, flags);
 		break;
+	case NFLOG_OUTPUT_JSON:
+		ret = nflog_snprintf_json(buf, bufsiz, &nfad, flags);
+		break;
 	default:
 		ret = -1;
 		errno = EOPNOTSUPP;
@@ -215,6 +235,97 @@ int nflog_nlmsg_snprintf(char *buf, size_t bufsiz, const struct nlmsghdr *nlh,
 	return ret;
 }
 
+/**
+ * nflog_nlmsg_strbuf_append - append a nflog nlattrs to a string buffer
+ * \param sb string buffer to append to
+ * \param nlh pointer to netlink message (to get queue num in the future)
+ * \param attr pointer to an array of nlattr of size NFULA_MAX + 1
+ * \param type print message type in enum nflog_output_type
+ * \param flags The flag that tell what to print into the buffer
+ *
+ * As nflog_nlmsg_snprintf(), but formats the message exactly once at the
+ * end of \b sb, growing it as needed. See nflog_strbuf_append_xml() on how
+ * to reuse \b sb across messages.
+ *
+ * \return the length of the message appended, or -1 on failure
+ * \par Errors
+ * __EOPNOTSUPP__ _type_ is unsupported (i.e. neither __NFLOG_OUTPUT_XML__
+ * nor __NFLOG_OUTPUT_JSON__)
+ * \n __ENOMEM__ the buffer could not be grown
+ */
+int nflog_nlmsg_strbuf_append(struct nflog_strbuf *sb,
+			      const struct nlmsghdr *nlh, struct nlattr **attr,
+			      enum nflog_output_type type, uint32_t flags)
+{
+	struct nflog_data nfad = {
+		.nfa	= (struct nfattr **)&attr[1],
+	};
+	int ret;
+
+	switch (type) {
+	case NFLOG_OUTPUT_XML:
+		ret = nflog_strbuf_append_xml(sb, &nfad, flags);
+		break;
+	case NFLOG_OUTPUT_JSON:
+		ret = nflog_strbuf_append_json(sb, &nfad, flags);
+		break;
+	default:
+		ret = -1;
+		errno = EOPNOTSUPP;
+		break;
+	}
+	return ret;
+}
+
+/* bucket i counts values in (2^(i-1), 2^i], the last one is open ended */
+static unsigned int nflog_hist_bucket(uint64_t v)
+{
+	unsigned int b = v <= 1 ? 0 : 64 - __builtin_clzll(v - 1);
+
+	return b < NFLOG_HIST_BUCKETS ? b : NFLOG_HIST_BUCKETS - 1;
+}
+
+/**
+ * nflog_nlmsg_account - account a datagram in the batching histograms
+ * \param stats statistics to update
+ * \param buf datagram received from the kernel
+ * \param len length of the datagram
+ *
+ * With a queue threshold above one (see nflog_set_qthresh()), the kernel
+ * packs several log messages into every datagram. This function counts the
+ * log messages in \b buf, and adds the datagram to the \b msgs_hist and
+ * \b bytes_hist histograms of \b stats, which tell how well batching works.
+ * Bucket \b i of each histogram counts the datagrams carrying more than
+ * 2^(i-1) and at most 2^i messages, respectively bytes, and the last bucket
+ * also counts everything beyond.
+ *
+ * nflog_handle_packet() calls this on the statistics of the handle, which
+ * nflog_get_stats() returns. Programs that receive via libmnl can call it on
+ * statistics of their own.
+ *
+ * \return number of log messages in \b buf
+ */
+unsigned int nflog_nlmsg_account(struct nflog_stats *stats, const void *buf,
+				 size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+	int rem = len;
+	unsigned int msgs = 0;
+
+	/* skip the NLMSG_DONE the kernel appends to multi-message batches */
+	for (; mnl_nlmsg_ok(nlh, rem); nlh = mnl_nlmsg_next(nlh, &rem)) {
+		if (nlh->nlmsg_type >= NLMSG_MIN_TYPE)
+			msgs++;
+	}
+
+	stats->messages += msgs;
+	stats->bytes += len;
+	stats->msgs_hist[nflog_hist_bucket(msgs)]++;
+	stats->bytes_hist[nflog_hist_bucket(len)]++;
+
+	return msgs;
+}
+
 /**
  * @}
  */
@@ -0,0 +1,299 @@
+/* overload.c: load shedding by downgrading the copy mode of groups
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Overload Load shedding functions
+ *
+ * When the application falls behind, the socket buffer fills up and the
+ * kernel drops log messages, which the application only learns about via
+ * ENOBUFS. It is usually better to keep receiving all of them with less
+ * payload than to lose some of them entirely.
+ *
+ * Once enabled on a group via nflog_set_overload(), the library watches the
+ * socket backlog and overruns, and when the backlog exceeds the high
+ * watermark or an overrun occurs, it makes the group cheaper, one step at a
+ * time: it divides the copy range by eight, down to the minimum range, then
+ * switches to NFULNL_COPY_META. When the backlog stays below the low
+ * watermark for the hold time, it goes back up one step, until the mode set
+ * via nflog_set_mode() is restored.
+ *
+ * Transitions are counted in the statistics returned by nflog_get_stats()
+ * and nflog_get_overload(), so that short payloads can be told apart from
+ * short packets.
+ *
+ * The mode changes are requested from within nflog_process(), without
+ * waiting for the kernel to answer, so that no log message is handled out
+ * of turn. Requests that fail are counted in \b config_errors of the
+ * statistics returned by nflog_get_stats().
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#ifndef SO_MEMINFO
+#define SO_MEMINFO	55
+#endif
+
+#define NFLOG_SHED_HIGH		75
+#define NFLOG_SHED_LOW		25
+#define NFLOG_SHED_HOLD_MS	1000
+#define NFLOG_SHED_MIN_RANGE	128
+
+/* give a step the time to show its effect before taking the next one */
+#define NFLOG_SHED_STEP_NS	200000000ULL
+
+/* how often nflog_process() looks at the backlog */
+#define NFLOG_SHED_CHECK_NS	10000000ULL
+
+/* mode and range of the group at _level_, -1 if there is no such level */
+static int shed_level(const struct nflog_g_handle *gh, unsigned int level,
+		      uint8_t *mode, uint32_t *range)
+{
+	const struct nflog_overload *cfg = &gh->shed.cfg;
+	uint32_t r = gh->shed.range ? gh->shed.range : 0xffff;
+
+	*mode = gh->shed.mode;
+	*range = gh->shed.range;
+	if (level == 0)
+		return 0;
+
+	if (gh->shed.mode != NFULNL_COPY_PACKET)
+		return -1;
+
+	while (level--) {
+		if (r <= cfg->min_range) {
+			if (level)
+				return -1;
+
+			*mode = NFULNL_COPY_META;
+			*range = 0;
+			return 0;
+		}
+
+		r /= 8;
+		if (r < cfg->min_range)
+			r = cfg->min_range;
+	}
+
+	*range = r;
+	return 0;
+}
+
+static int shed_apply(struct nflog_g_handle *gh, unsigned int level)
+{
+	uint8_t mode;
+	uint32_t range;
+
+	if (shed_level(gh, level, &mode, &range) < 0)
+		return -1;
+
+	/* from the receive path, without waiting for the kernel to answer */
+	if (__nflog_send_mode(gh, mode, range) < 0)
+		return -1;
+
+	if (level > gh->shed.level) {
+		gh->shed.down++;
+		gh->h->stats.overload_down++;
+	} else {
+		gh->shed.up++;
+		gh->h->stats.overload_up++;
+	}
+	gh->shed.level = level;
+	gh->shed.changed = time(NULL);
+
+	return 0;
+}
+
+/**
+ * nflog_set_overload - enable load shedding on a group
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param cfg thresholds, or NULL to disable load shedding
+ *
+ * The group must have been set up via nflog_set_mode() first, that mode is
+ * the one that is restored when the pressure goes away. Fields of \b cfg
+ * left at zero take default values:
+ *	- \b high: 75 (percent of the socket receive buffer)
+ *	- \b low: 25 (percent of the socket receive buffer)
+ *	- \b hold_ms: 1000
+ *	- \b min_range: 128 (bytes, enough for the network and transport
+ *	  headers)
+ *
+ * nflog_process() checks the backlog on its own. Applications that receive
+ * by other means have to call nflog_overload_check().
+ *
+ * Disabling load shedding restores the mode set via nflog_set_mode().
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ the low watermark is not below the high one.
+ * \n from underlying calls, in exceptional circumstances
+ */
+int nflog_set_overload(struct nflog_g_handle *gh,
+		       const struct nflog_overload *cfg)
+{
+	struct nflog_overload c;
+
+	if (!cfg) {
+		if (!gh->shed.enabled)
+			return 0;
+
+		if (gh->shed.level && shed_apply(gh, 0) < 0)
+			return -1;
+
+		gh->shed.enabled = 0;
+		gh->h->shed_groups--;
+		return 0;
+	}
+
+	c = *cfg;
+	if (!c.high)
+		c.high = NFLOG_SHED_HIGH;
+	if (!c.low)
+		c.low = NFLOG_SHED_LOW;
+	if (!c.hold_ms)
+		c.hold_ms = NFLOG_SHED_HOLD_MS;
+	if (!c.min_range)
+		c.min_range = NFLOG_SHED_MIN_RANGE;
+
+	if (c.low >= c.high) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!gh->shed.enabled) {
+		gh->shed.mode = gh->copy_mode;
+		gh->shed.range = gh->copy_range;
+		gh->shed.level = 0;
+		gh->shed.enabled = 1;
+		gh->h->shed_groups++;
+	}
+	gh->shed.cfg = c;
+
+	return 0;
+}
+
+/*
+ * socket backlog in percent of the receive buffer, -1 if unknown, in which
+ * case only overruns tell about pressure
+ */
+static int shed_backlog(struct nflog_handle *h)
+{
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
+
+	if (getsockopt(nflog_fd(h), SOL_SOCKET, SO_MEMINFO, mem, &len) < 0 ||
+	    len < sizeof(mem) || mem[SK_MEMINFO_RCVBUF] == 0)
+		return -1;
+
+	return (uint64_t)mem[SK_MEMINFO_RMEM_ALLOC] * 100 /
+	       mem[SK_MEMINFO_RCVBUF];
+}
+
+/**
+ * nflog_overload_check - update the load shedding state of a handle
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param overrun non-zero if receiving failed with ENOBUFS
+ *
+ * This looks at the socket backlog and steps the groups with load shedding
+ * enabled down or up as needed. Call it whenever receiving fails with
+ * ENOBUFS, and every few milliseconds otherwise. nflog_process() does so
+ * on its own.
+ *
+ * A group whose mode cannot be changed is left as it is until the next call,
+ * and the failure is counted in the \b config_errors statistic; the other
+ * groups are stepped all the same.
+ *
+ * \return number of groups whose mode changed
+ */
+int nflog_overload_check(struct nflog_handle *h, int overrun)
+{
+	struct nflog_g_handle *gh;
+	uint64_t now = __nflog_now_ns();
+	int backlog, changed = 0;
+	struct nflog_overload *cfg;
+	uint32_t range;
+	uint8_t mode;
+
+	h->shed_next = now + NFLOG_SHED_CHECK_NS;
+	if (!h->shed_groups)
+		return 0;
+
+	backlog = shed_backlog(h);
+
+	for (gh = h->gh_list; gh; gh = gh->next) {
+		if (!gh->shed.enabled || gh->unbound)
+			continue;
+
+		cfg = &gh->shed.cfg;
+		if (overrun || backlog >= (int)cfg->high) {
+			gh->shed.pressure = now;
+			if (now - gh->shed.step < NFLOG_SHED_STEP_NS ||
+			    shed_level(gh, gh->shed.level + 1,
+				       &mode, &range) < 0)
+				continue;
+
+			/* counted, the other groups still have to shed */
+			if (shed_apply(gh, gh->shed.level + 1) < 0)
+				continue;
+		} else if (gh->shed.level && backlog <= (int)cfg->low &&
+			   now - gh->shed.pressure >=
+			   (uint64_t)cfg->hold_ms * 1000000) {
+			if (shed_apply(gh, gh->shed.level - 1) < 0)
+				continue;
+
+			/* wait for another calm period before the next step */
+			gh->shed.pressure = now;
+		} else {
+			continue;
+		}
+
+		gh->shed.step = now;
+		changed++;
+	}
+
+	return changed;
+}
+
+/**
+ * nflog_get_overload - get the load shedding state of a group
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param st structure to fill
+ *
+ * \return 0 on success, -1 if load shedding is not enabled on the group.
+ */
+int nflog_get_overload(struct nflog_g_handle *gh,
+		       struct nflog_overload_state *st)
+{
+	if (!gh->shed.enabled)
+		return -1;
+
+	st->level = gh->shed.level;
+	st->copy_mode = gh->copy_mode;
+	st->copy_range = gh->copy_range;
+	st->down = gh->shed.down;
+	st->up = gh->shed.up;
+	st->changed = gh->shed.changed;
+
+	return 0;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,781 @@
+/* peer.c: userspace stand-in for the kernel side of nfnetlink_log
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/netlink.h>
+#include <linux/if_ether.h>
+#include <linux/netfilter.h>
+#include <libnfnetlink/libnfnetlink.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Peer Fake kernel peer functions
+ *
+ * Configuring a group, via nflog_bind_group() or nflog_set_mode() for
+ * instance, takes a kernel with nfnetlink_log and CAP_NET_ADMIN. A peer
+ * stands in for the kernel instead, so that the configuration path of an
+ * application can be tested, and benchmarked, anywhere.
+ *
+ * A peer speaks the NFULNL_MSG_CONFIG protocol over a socketpair with the
+ * handle opened on it via nflog_open_peer(). It keeps the state of each
+ * bound group, answers requests with the acknowledgements and the errors
+ * the kernel would send, and logs packets to the bound groups, either one
+ * at a time via nflog_peer_inject() or at a steady rate set via
+ * nflog_peer_set_traffic(). It batches log messages like the kernel does,
+ * after the threshold, the buffer size and the timeout of each group, and
+ * numbers them when asked to via nflog_set_flags().
+ *
+ * The peer runs in the thread that uses the handle: requests are answered
+ * as they are sent, traffic is generated by nflog_peer_service(), which the
+ * receive loop calls before receiving, as nflog_peer_process() does:
+ *
+ * \verbatim
+	p = nflog_peer_create();
+	h = nflog_open_peer(p);
+	gh = nflog_bind_group(h, 1);
+	nflog_callback_register(gh, &cb, NULL);
+	nflog_peer_set_traffic(p, 1, 100000, NULL, 64);
+
+	for (;;)
+		nflog_peer_process(h);
+\endverbatim
+ *
+ * Conntrack information is not emulated, nor is the binding of protocol
+ * families, which current kernels ignore as well.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+/* what the kernel uses, see net/netfilter/nfnetlink_log.c */
+#define NFLOG_PEER_NLBUFSIZ_DEFAULT	4096
+#define NFLOG_PEER_NLBUFSIZ_MAX		131072
+#define NFLOG_PEER_TIMEOUT_DEFAULT	100	/* in 1/100 s */
+#define NFLOG_PEER_QTHRESH_DEFAULT	100
+#define NFLOG_PEER_COPY_RANGE_MAX	0xffff
+
+/* the largest datagram: a full buffer, or a single message larger still */
+#define NFLOG_PEER_BUFSIZ		(NFLOG_PEER_NLBUFSIZ_MAX + 0x10000 + 512)
+
+/* messages generated per call at most, a late caller does not catch up */
+#define NFLOG_PEER_BURST		65536
+
+struct nflog_peer_inst {
+	struct nflog_peer_inst *next;
+	uint16_t id;
+	struct nflog_peer_group st;
+	uint32_t seq;
+	char *batch;			/* messages not sent yet */
+	size_t len;
+	size_t size;
+	unsigned int qlen;
+	uint64_t first;			/* when the first one was logged */
+	uint32_t rate;			/* per second, see nflog_peer_set_traffic() */
+	char *payload;
+	size_t payload_len;
+	uint64_t start;
+	uint64_t generated;
+};
+
+struct nflog_peer {
+	int fd;				/* our end of the socketpair */
+	int hfd;			/* the end of the handle, until opened */
+	struct nflog_handle *h;
+	struct nflog_peer_inst *inst;
+	uint32_t seq_global;
+	uint64_t datagrams;
+	char buf[NFLOG_PEER_BUFSIZ];
+};
+
+static struct nflog_peer_inst *peer_inst(struct nflog_peer *p, uint16_t id)
+{
+	struct nflog_peer_inst *inst;
+
+	for (inst = p->inst; inst; inst = inst->next) {
+		if (inst->id == id)
+			return inst;
+	}
+	return NULL;
+}
+
+/**
+ * nflog_peer_create - create a stand-in for the kernel
+ *
+ * \return a pointer to the new peer or NULL on failure with \b errno set.
+ * \par Errors
+ * __ENOMEM__ No memory for the peer.
+ * \n as for __socketpair__(2)
+ */
+struct nflog_peer *nflog_peer_create(void)
+{
+	struct nflog_peer *p;
+	int fd[2];
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fd) < 0) {
+		free(p);
+		return NULL;
+	}
+	p->fd = fd[0];
+	p->hfd = fd[1];
+
+	return p;
+}
+
+static void peer_inst_free(struct nflog_peer_inst *inst)
+{
+	free(inst->batch);
+	free(inst->payload);
+	free(inst);
+}
+
+/**
+ * nflog_peer_destroy - destroy a peer
+ * \param p peer obtained via call to nflog_peer_create()
+ *
+ * The handle opened on the peer should be closed first, requests sent on it
+ * afterwards fail.
+ */
+void nflog_peer_destroy(struct nflog_peer *p)
+{
+	struct nflog_peer_inst *inst;
+
+	while ((inst = p->inst)) {
+		p->inst = inst->next;
+		peer_inst_free(inst);
+	}
+
+	if (p->h)
+		p->h->peer = NULL;
+	if (p->hfd >= 0)
+		close(p->hfd);
+	close(p->fd);
+	free(p);
+}
+
+/**
+ * nflog_open_peer - open a nflog handler on a peer
+ * \param p peer obtained via call to nflog_peer_create()
+ *
+ * This function obtains a netfilter log connection handle like nflog_open()
+ * does, but talking to \b p instead of the kernel. A netlink socket is still
+ * created, which takes no privilege, as libnfnetlink requires one. A peer
+ * serves a single handle.
+ *
+ * \return a pointer to a new log handle or NULL on failure with \b errno set.
+ * \par Errors
+ * __EBUSY__ A handle was already opened on \b p.
+ * \n from underlying calls, in exceptional circumstances
+ */
+struct nflog_handle *nflog_open_peer(struct nflog_peer *p)
+{
+	struct nflog_handle *h;
+
+	if (p->hfd < 0) {
+		errno = EBUSY;
+		return NULL;
+	}
+
+	h = __nflog_open_fd(p->hfd);
+	if (!h)
+		return NULL;
+
+	p->hfd = -1;
+	p->h = h;
+	h->peer = p;
+
+	return h;
+}
+
+void __nflog_peer_detach(struct nflog_peer *p)
+{
+	p->h = NULL;
+}
+
+/* pass the pending messages of a group to the handle */
+static void peer_flush(struct nflog_peer *p, struct nflog_peer_inst *inst)
+{
+	struct nlmsghdr *nlh;
+	struct nfgenmsg *nfmsg;
+
+	if (!inst->qlen)
+		return;
+
+	/* the kernel terminates batches of several messages */
+	if (inst->qlen > 1) {
+		nlh = (struct nlmsghdr *)(inst->batch + inst->len);
+		nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*nfmsg));
+		nlh->nlmsg_type = NLMSG_DONE;
+		nlh->nlmsg_flags = NLM_F_MULTI;
+		nlh->nlmsg_seq = 0;
+		nlh->nlmsg_pid = 0;
+
+		nfmsg = NLMSG_DATA(nlh);
+		nfmsg->nfgen_family = AF_UNSPEC;
+		nfmsg->version = NFNETLINK_V0;
+		nfmsg->res_id = htons(inst->id);
+		inst->len += NLMSG_ALIGN(nlh->nlmsg_len);
+	}
+
+	if (send(p->fd, inst->batch, inst->len, MSG_DONTWAIT) < 0) {
+		inst->st.dropped += inst->qlen;
+	} else {
+		inst->st.datagrams++;
+		inst->st.messages += inst->qlen;
+		p->datagrams++;
+	}
+
+	inst->len = 0;
+	inst->qlen = 0;
+}
+
+/* log a packet to a group, as nfulnl_log_packet() does */
+static int peer_log(struct nflog_peer *p, struct nflog_peer_inst *inst,
+		    const void *payload, size_t len)
+{
+	struct nfulnl_msg_packet_hdr ph = {
+		.hw_protocol	= htons(ETH_P_IP),
+		.hook		= NF_INET_LOCAL_IN,
+	};
+	struct nfulnl_msg_packet_timestamp ts;
+	size_t copy = 0, size, done, need;
+	struct nfgenmsg *nfmsg;
+	struct nlmsghdr *nlh;
+	struct timeval tv;
+	char *batch;
+
+	switch (inst->st.copy_mode) {
+	case NFULNL_COPY_NONE:
+		return 0;
+	case NFULNL_COPY_PACKET:
+		copy = len < inst->st.copy_range ? len : inst->st.copy_range;
+		break;
+	}
+
+	size = NLMSG_SPACE(sizeof(*nfmsg)) +
+	       NFA_ALIGN(NFA_LENGTH(sizeof(ph))) +
+	       NFA_ALIGN(NFA_LENGTH(sizeof(ts))) +
+	       2 * NFA_ALIGN(NFA_LENGTH(sizeof(uint32_t))) +
+	       NFA_ALIGN(NFA_LENGTH(copy));
+	done = NLMSG_SPACE(sizeof(*nfmsg));
+
+	if (inst->qlen && inst->len + size + done > inst->st.nlbufsiz)
+		peer_flush(p, inst);
+
+	need = inst->len + size + done;
+	if (need > inst->size) {
+		batch = realloc(inst->batch, need);
+		if (!batch)
+			return -1;
+		inst->batch = batch;
+		inst->size = need;
+	}
+
+	nlh = (struct nlmsghdr *)(inst->batch + inst->len);
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*nfmsg));
+	nlh->nlmsg_type = (NFNL_SUBSYS_ULOG << 8) | NFULNL_MSG_PACKET;
+	nlh->nlmsg_flags = inst->st.qthresh > 1 ? NLM_F_MULTI : 0;
+	nlh->nlmsg_seq = 0;
+	nlh->nlmsg_pid = 0;
+
+	nfmsg = NLMSG_DATA(nlh);
+	nfmsg->nfgen_family = AF_INET;
+	nfmsg->version = NFNETLINK_V0;
+	nfmsg->res_id = htons(inst->id);
+
+	nfnl_addattr_l(nlh, size, NFULA_PACKET_HDR, &ph, sizeof(ph));
+
+	gettimeofday(&tv, NULL);
+	ts.sec = htobe64(tv.tv_sec);
+	ts.usec = htobe64(tv.tv_usec);
+	nfnl_addattr_l(nlh, size, NFULA_TIMESTAMP, &ts, sizeof(ts));
+
+	if (inst->st.flags & NFULNL_CFG_F_SEQ)
+		nfnl_addattr32(nlh, size, NFULA_SEQ, htonl(inst->seq++));
+	if (inst->st.flags & NFULNL_CFG_F_SEQ_GLOBAL)
+		nfnl_addattr32(nlh, size, NFULA_SEQ_GLOBAL,
+			       htonl(++p->seq_global));
+	if (inst->st.copy_mode == NFULNL_COPY_PACKET)
+		nfnl_addattr_l(nlh, size, NFULA_PAYLOAD, payload, copy);
+
+	inst->len += NLMSG_ALIGN(nlh->nlmsg_len);
+	if (inst->qlen++ == 0)
+		inst->first = __nflog_now_ns();
+
+	if (inst->qlen >= inst->st.qthresh)
+		peer_flush(p, inst);
+
+	return 0;
+}
+
+static int peer_bind(struct nflog_peer *p, uint16_t id)
+{
+	struct nflog_peer_inst *inst;
+
+	inst = calloc(1, sizeof(*inst));
+	if (!inst)
+		return -ENOMEM;
+
+	inst->id = id;
+	inst->st.copy_mode = NFULNL_COPY_PACKET;
+	inst->st.copy_range = NFLOG_PEER_COPY_RANGE_MAX;
+	inst->st.nlbufsiz = NFLOG_PEER_NLBUFSIZ_DEFAULT;
+	inst->st.timeout = NFLOG_PEER_TIMEOUT_DEFAULT;
+	inst->st.qthresh = NFLOG_PEER_QTHRESH_DEFAULT;
+
+	inst->next = p->inst;
+	p->inst = inst;
+	return 0;
+}
+
+static void peer_unbind(struct nflog_peer *p, struct nflog_peer_inst *inst)
+{
+	struct nflog_peer_inst **pp;
+
+	peer_flush(p, inst);
+
+	for (pp = &p->inst; *pp != inst; pp = &(*pp)->next)
+		;
+	*pp = inst->next;
+	peer_inst_free(inst);
+}
+
+static int peer_set_mode(struct nflog_peer_inst *inst,
+			 const struct nfulnl_msg_config_mode *params)
+{
+	uint32_t range = ntohl(params->copy_range);
+
+	switch (params->copy_mode) {
+	case NFULNL_COPY_NONE:
+	case NFULNL_COPY_META:
+		inst->st.copy_range = 0;
+		break;
+	case NFULNL_COPY_PACKET:
+		if (range == 0 || range > NFLOG_PEER_COPY_RANGE_MAX)
+			range = NFLOG_PEER_COPY_RANGE_MAX;
+		inst->st.copy_range = range;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	inst->st.copy_mode = params->copy_mode;
+	return 0;
+}
+
+/* handle a request as nfulnl_recv_config() does, return a negative errno */
+static int peer_config(struct nflog_peer *p, const struct nlmsghdr *nlh)
+{
+	struct nfattr *tb[NFULA_CFG_MAX];
+	struct nfulnl_msg_config_cmd *cmd = NULL;
+	struct nflog_peer_inst *inst;
+	struct nfgenmsg *nfmsg;
+	uint32_t nlbufsiz;
+	uint16_t id;
+	int ret;
+
+	if (NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_ULOG ||
+	    NFNL_MSG_TYPE(nlh->nlmsg_type) != NFULNL_MSG_CONFIG ||
+	    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*nfmsg)))
+		return -EINVAL;
+
+	nfmsg = NLMSG_DATA(nlh);
+	id = ntohs(nfmsg->res_id);
+	memset(tb, 0, sizeof(tb));
+	nfnl_parse_attr(tb, NFULA_CFG_MAX, NFM_NFA(nfmsg), NFM_PAYLOAD(nlh));
+
+	if (tb[NFULA_CFG_CMD-1]) {
+		cmd = NFA_DATA(tb[NFULA_CFG_CMD-1]);
+		switch (cmd->command) {
+		case NFULNL_CFG_CMD_PF_BIND:
+		case NFULNL_CFG_CMD_PF_UNBIND:
+			return 0;
+		}
+	}
+
+	inst = peer_inst(p, id);
+	if (cmd) {
+		switch (cmd->command) {
+		case NFULNL_CFG_CMD_BIND:
+			if (inst)
+				return -EBUSY;
+			ret = peer_bind(p, id);
+			if (ret < 0)
+				return ret;
+			inst = p->inst;
+			break;
+		case NFULNL_CFG_CMD_UNBIND:
+			if (!inst)
+				return -ENODEV;
+			peer_unbind(p, inst);
+			return 0;
+		default:
+			return -EOPNOTSUPP;
+		}
+	} else if (!inst) {
+		return -ENODEV;
+	}
+
+	if (tb[NFULA_CFG_MODE-1]) {
+		ret = peer_set_mode(inst, NFA_DATA(tb[NFULA_CFG_MODE-1]));
+		if (ret < 0)
+			return ret;
+	}
+	if (tb[NFULA_CFG_TIMEOUT-1])
+		inst->st.timeout =
+			ntohl(*(uint32_t *)NFA_DATA(tb[NFULA_CFG_TIMEOUT-1]));
+	if (tb[NFULA_CFG_NLBUFSIZ-1]) {
+		/* out of range sizes are ignored, the kernel does not tell */
+		nlbufsiz =
+			ntohl(*(uint32_t *)NFA_DATA(tb[NFULA_CFG_NLBUFSIZ-1]));
+		if (nlbufsiz >= NFLOG_PEER_NLBUFSIZ_DEFAULT &&
+		    nlbufsiz <= NFLOG_PEER_NLBUFSIZ_MAX)
+			inst->st.nlbufsiz = nlbufsiz;
+	}
+	if (tb[NFULA_CFG_QTHRESH-1])
+		inst->st.qthresh =
+			ntohl(*(uint32_t *)NFA_DATA(tb[NFULA_CFG_QTHRESH-1]));
+	if (tb[NFULA_CFG_FLAGS-1])
+		inst->st.flags =
+			ntohs(*(uint16_t *)NFA_DATA(tb[NFULA_CFG_FLAGS-1]));
+
+	return 0;
+}
+
+static void peer_ack(struct nflog_peer *p, const struct nlmsghdr *req,
+		     int error)
+{
+	union {
+		char buf[NLMSG_SPACE(sizeof(struct nlmsgerr))];
+		struct nlmsghdr nlh;
+	} u = {};
+	struct nlmsgerr *err = NLMSG_DATA(&u.nlh);
+
+	u.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(*err));
+	u.nlh.nlmsg_type = NLMSG_ERROR;
+	u.nlh.nlmsg_seq = req->nlmsg_seq;
+	u.nlh.nlmsg_pid = req->nlmsg_pid;
+	err->error = error;
+	err->msg = *req;
+
+	send(p->fd, &u, u.nlh.nlmsg_len, MSG_DONTWAIT);
+}
+
+/* answer the requests sent by the handle */
+static void peer_requests(struct nflog_peer *p)
+{
+	struct nlmsghdr *nlh;
+	ssize_t len;
+	int left, ret;
+
+	while ((len = recv(p->fd, p->buf, sizeof(p->buf), MSG_DONTWAIT)) > 0) {
+		nlh = (struct nlmsghdr *)p->buf;
+		for (left = len; NLMSG_OK(nlh, left);
+		     nlh = NLMSG_NEXT(nlh, left)) {
+			if (!(nlh->nlmsg_flags & NLM_F_REQUEST))
+				continue;
+
+			ret = peer_config(p, nlh);
+			if (ret || (nlh->nlmsg_flags & NLM_F_ACK))
+				peer_ack(p, nlh, ret);
+		}
+	}
+}
+
+/*
+ * The nfnl_query() of a handle opened on a peer: the messages logged before
+ * are handled first, then the request is answered right away. As in
+ * nfnl_catch(), what comes before the ack, eg. the batch a group flushes
+ * when unbound, is handled as well.
+ */
+int __nflog_peer_query(struct nflog_handle *h, struct nlmsghdr *nlh)
+{
+	struct nflog_peer *p = h->peer;
+	int fd = nflog_fd(h);
+	struct nlmsghdr *reply;
+	struct nlmsgerr *err;
+	ssize_t len;
+
+	while ((len = recv(fd, p->buf, sizeof(p->buf), MSG_DONTWAIT)) > 0)
+		nflog_handle_packet(h, p->buf, len);
+
+	if (send(fd, nlh, nlh->nlmsg_len, 0) < 0)
+		return -1;
+
+	peer_requests(p);
+
+	for (;;) {
+		len = recv(fd, p->buf, sizeof(p->buf), MSG_DONTWAIT);
+		if (len < 0) {
+			/* no news is good news, as when no ack was asked for */
+			return errno == EAGAIN ? 0 : -1;
+		}
+
+		reply = (struct nlmsghdr *)p->buf;
+		if (!NLMSG_OK(reply, len)) {
+			errno = EPROTO;
+			return -1;
+		}
+		if (reply->nlmsg_type != NLMSG_ERROR) {
+			nflog_handle_packet(h, p->buf, len);
+			continue;
+		}
+		if (reply->nlmsg_seq != nlh->nlmsg_seq)
+			continue;
+		break;
+	}
+
+	if (reply->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	err = NLMSG_DATA(reply);
+	if (err->error) {
+		errno = -err->error;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * nflog_peer_inject - log a packet to a group
+ * \param p peer obtained via call to nflog_peer_create()
+ * \param group number of the group, as passed to nflog_bind_group()
+ * \param payload packet to log, starting at the network header, or NULL for
+ * an IPv4/UDP packet to the discard port of the loopback address
+ * \param len length of the packet, or of the UDP payload if \b payload is NULL
+ *
+ * The packet is logged according to the copy mode of the group, and sent to
+ * the handle in a batch once the threshold of the group is reached, its
+ * buffer is full, or by nflog_peer_service() once its timeout expired. The
+ * log message carries the packet, a kernel timestamp, and the sequence
+ * numbers enabled via nflog_set_flags().
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __ENODEV__ The group is not bound.
+ * \n __ENOMEM__ No memory for the batch.
+ */
+int nflog_peer_inject(struct nflog_peer *p, uint16_t group,
+		      const void *payload, size_t len)
+{
+	struct nflog_peer_inst *inst = peer_inst(p, group);
+
+	if (!inst) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	return peer_log(p, inst, payload, len);
+}
+
+/* an IPv4/UDP packet with _len_ bytes of payload, updated to its length */
+static char *peer_udp_packet(size_t *len)
+{
+	struct iphdr *ip;
+	struct udphdr *udp;
+	char *pkt;
+
+	*len += sizeof(*ip) + sizeof(*udp);
+	pkt = calloc(1, *len);
+	if (!pkt)
+		return NULL;
+
+	ip = (struct iphdr *)pkt;
+	ip->version = 4;
+	ip->ihl = sizeof(*ip) / 4;
+	ip->ttl = 64;
+	ip->protocol = IPPROTO_UDP;
+	ip->tot_len = htons(*len);
+	ip->saddr = htonl(INADDR_LOOPBACK);
+	ip->daddr = htonl(INADDR_LOOPBACK);
+
+	udp = (struct udphdr *)(ip + 1);
+	udp->source = htons(9);
+	udp->dest = htons(9);
+	udp->len = htons(*len - sizeof(*ip));
+
+	return pkt;
+}
+
+/**
+ * nflog_peer_set_traffic - log packets to a group at a steady rate
+ * \param p peer obtained via call to nflog_peer_create()
+ * \param group number of the group, as passed to nflog_bind_group()
+ * \param rate packets per second, 0 to stop
+ * \param payload packet to log, starting at the network header
+ * \param len length of the packet
+ *
+ * The packets are logged by nflog_peer_service(), as many per call as are
+ * due since the traffic was set, as if by nflog_peer_inject(). The traffic
+ * stops when the group is unbound.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __ENODEV__ The group is not bound.
+ * \n __ENOMEM__ No memory for a copy of the packet.
+ */
+int nflog_peer_set_traffic(struct nflog_peer *p, uint16_t group,
+			   uint32_t rate, const void *payload, size_t len)
+{
+	struct nflog_peer_inst *inst = peer_inst(p, group);
+	char *copy = NULL;
+
+	if (!inst) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	if (rate && !payload) {
+		copy = peer_udp_packet(&len);
+		if (!copy)
+			return -1;
+	} else if (rate) {
+		copy = malloc(len ? len : 1);
+		if (!copy)
+			return -1;
+		memcpy(copy, payload, len);
+	}
+
+	free(inst->payload);
+	inst->payload = copy;
+	inst->payload_len = len;
+	inst->rate = rate;
+	inst->start = __nflog_now_ns();
+	inst->generated = 0;
+
+	return 0;
+}
+
+/**
+ * nflog_peer_service - run the peer
+ * \param p peer obtained via call to nflog_peer_create()
+ *
+ * This answers the requests that were sent to the peer without going
+ * through the library, logs the packets due according to the traffic set
+ * via nflog_peer_set_traffic(), and sends the batches whose timeout expired.
+ *
+ * Datagrams that do not fit in the socket buffer of the handle are dropped
+ * and accounted in nflog_peer_get_group(). Their sequence numbers are lost,
+ * as when the kernel fails to deliver.
+ *
+ * \return number of datagrams sent to the handle.
+ */
+int nflog_peer_service(struct nflog_peer *p)
+{
+	uint64_t now = __nflog_now_ns(), before = p->datagrams, due, elapsed;
+	struct nflog_peer_inst *inst, *next;
+
+	peer_requests(p);
+
+	for (inst = p->inst; inst; inst = next) {
+		next = inst->next;
+
+		if (inst->rate) {
+			/* in two parts, the product would overflow at high rates */
+			elapsed = now - inst->start;
+			due = elapsed / 1000000000 * inst->rate +
+			      elapsed % 1000000000 * inst->rate / 1000000000;
+			if (due - inst->generated > NFLOG_PEER_BURST)
+				inst->generated = due - NFLOG_PEER_BURST;
+
+			for (; inst->generated < due; inst->generated++)
+				peer_log(p, inst, inst->payload,
+					 inst->payload_len);
+		}
+
+		if (inst->qlen && inst->st.timeout &&
+		    inst->first + (uint64_t)inst->st.timeout * 10000000 <= now)
+			peer_flush(p, inst);
+	}
+
+	return p->datagrams - before;
+}
+
+/**
+ * nflog_peer_process - run the peer and receive what it sent
+ * \param h Netfilter log handle obtained via call to nflog_open_peer()
+ *
+ * This calls nflog_peer_service(), then nflog_process() until the datagrams
+ * the peer sent have been received, so that a loop calling it drives the
+ * handle as the kernel and nflog_process() would.
+ *
+ * \return number of datagrams sent by the peer, or -1 on failure with
+ * \b errno set.
+ * \par Errors
+ * __EINVAL__ The handle was not obtained via nflog_open_peer().
+ * \n as for nflog_process()
+ */
+int nflog_peer_process(struct nflog_handle *h)
+{
+	int sent, left, ret;
+
+	if (!h->peer) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sent = left = nflog_peer_service(h->peer);
+	while (left > 0) {
+		ret = nflog_process(h);
+		if (ret < 0)
+			return -1;
+		left -= ret;
+	}
+
+	return sent;
+}
+
+/**
+ * nflog_peer_get_group - get the state of a group as the peer sees it
+ * \param p peer obtained via call to nflog_peer_create()
+ * \param group number of the group, as passed to nflog_bind_group()
+ * \param st structure to fill
+ *
+ * This returns the configuration of the group, as set via nflog_set_mode()
+ * and friends after the kernel's rules, and what was logged to it.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __ENODEV__ The group is not bound.
+ */
+int nflog_peer_get_group(struct nflog_peer *p, uint16_t group,
+			 struct nflog_peer_group *st)
+{
+	struct nflog_peer_inst *inst = peer_inst(p, group);
+
+	if (!inst) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	*st = inst->st;
+	return 0;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,287 @@
+/* placement.c: CPU and NUMA placement of nflog consumers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Placement Consumer placement functions
+ *
+ * The kernel appends a logged packet to the netlink socket from the softirq
+ * of the CPU that processed it. On a multi-socket machine, a consumer that
+ * runs on another NUMA node pulls every message across the interconnect.
+ * The functions in this group pin the calling thread close to where the
+ * messages are produced and allocate memory on the node it ends up on.
+ *
+ * Placement applies to the thread that calls these functions, so call them
+ * from the thread that runs the receive loop of the handle, before it
+ * allocates its buffers.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#define NFLOG_NODE_MAX	1024
+
+/* parse a list in the format used by sysfs and procfs, ie. "0-3,8,10-11" */
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(set);
+
+	while (*list && *list != '\n') {
+		first = strtoul(list, &end, 10);
+		if (end == list)
+			goto err;
+
+		last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtoul(list, &end, 10);
+			if (end == list || last < first)
+				goto err;
+		}
+		if (last >= CPU_SETSIZE)
+			goto err;
+
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list && *list != '\n')
+			goto err;
+	}
+
+	if (CPU_COUNT(set) == 0)
+		goto err;
+
+	return 0;
+err:
+	errno = EINVAL;
+	return -1;
+}
+
+static int read_list(const char *path, char *buf, size_t len)
+{
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		return -1;
+
+	if (!fgets(buf, len, fp)) {
+		fclose(fp);
+		errno = EINVAL;
+		return -1;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* the sysfs cpu directory has a nodeN link to the node the CPU belongs to */
+static int cpu_node(unsigned int cpu)
+{
+	char path[64];
+	struct dirent *de;
+	int node = -1;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "node", 4) == 0 &&
+		    sscanf(de->d_name + 4, "%d", &node) == 1)
+			break;
+	}
+
+	closedir(dir);
+	return node;
+}
+
+static int place_cpus(struct nflog_handle *h, const char *cpulist, int node)
+{
+	cpu_set_t set;
+	int cpu;
+
+	if (parse_cpulist(cpulist, &set) < 0)
+		return -1;
+
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		return -1;
+
+	if (node < 0) {
+		/* only keep track of the node if all CPUs are on the same one */
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (!CPU_ISSET(cpu, &set))
+				continue;
+
+			if (node < 0) {
+				node = cpu_node(cpu);
+			} else if (cpu_node(cpu) != node) {
+				node = -1;
+				break;
+			}
+		}
+	}
+
+	h->node = node;
+	return 0;
+}
+
+/**
+ * nflog_place_cpus - pin the calling thread to a set of CPUs
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param cpulist comma separated list of CPUs and CPU ranges, eg. "0-3,8"
+ *
+ * This is the format used by /proc/irq/N/effective_affinity_list and the
+ * cpulist files in sysfs, so the consumer can be colocated with the CPUs
+ * that serve a given set of queues. If all the CPUs belong to the same NUMA
+ * node, later calls to nflog_alloc_buf() allocate memory on that node.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ \b cpulist is malformed or empty.
+ * \n as for __sched_setaffinity__(2)
+ */
+int nflog_place_cpus(struct nflog_handle *h, const char *cpulist)
+{
+	return place_cpus(h, cpulist, -1);
+}
+
+/**
+ * nflog_place_node - pin the calling thread to the CPUs of a NUMA node
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param node NUMA node number
+ *
+ * Later calls to nflog_alloc_buf() allocate memory on \b node.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __ENOENT__ There is no such node.
+ * \n as for __sched_setaffinity__(2)
+ */
+int nflog_place_node(struct nflog_handle *h, int node)
+{
+	char path[64], list[1024];
+
+	if (node < 0 || node >= NFLOG_NODE_MAX) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	if (read_list(path, list, sizeof(list)) < 0)
+		return -1;
+
+	return place_cpus(h, list, node);
+}
+
+/**
+ * nflog_place_irq - pin the calling thread to the CPUs that serve an IRQ
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param irq interrupt number, as listed in /proc/interrupts
+ *
+ * Packets received via the NIC queue that raises \b irq are processed, and
+ * hence logged, on the CPUs that serve it. This places the consumer on the
+ * same CPUs, so that messages are read from a warm cache.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __ENOENT__ There is no such interrupt.
+ * \n as for __sched_setaffinity__(2)
+ */
+int nflog_place_irq(struct nflog_handle *h, unsigned int irq)
+{
+	char path[64], list[1024];
+
+	snprintf(path, sizeof(path),
+		 "/proc/irq/%u/effective_affinity_list", irq);
+	if (read_list(path, list, sizeof(list)) < 0) {
+		/* kernels before 4.15 only have the configured affinity */
+		snprintf(path, sizeof(path),
+			 "/proc/irq/%u/smp_affinity_list", irq);
+		if (read_list(path, list, sizeof(list)) < 0)
+			return -1;
+	}
+
+	return place_cpus(h, list, -1);
+}
+
+/**
+ * nflog_alloc_buf - allocate a buffer close to the calling thread
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param size size of the buffer in bytes
+ *
+ * The buffer is allocated on the NUMA node the handle has been placed on, if
+ * known, and its pages are faulted in right away by the calling thread, so
+ * that they land on the local node even if it is not. Use it for receive
+ * buffers and the like after placing the handle. Release it with
+ * nflog_free_buf().
+ *
+ * \return pointer to the zeroed buffer or NULL on failure with \b errno set.
+ * \par Errors
+ * as for __mmap__(2)
+ */
+void *nflog_alloc_buf(struct nflog_handle *h, size_t size)
+{
+	unsigned long mask[NFLOG_NODE_MAX / (8 * sizeof(unsigned long))] = {};
+	const unsigned int bits = 8 * sizeof(unsigned long);
+	void *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	if (h->node >= 0) {
+		/* a hint only, first touch below does the job if this fails */
+		mask[h->node / bits] |= 1UL << (h->node % bits);
+		syscall(SYS_mbind, buf, size, MPOL_PREFERRED, mask,
+			NFLOG_NODE_MAX + 1, 0);
+	}
+
+	memset(buf, 0, size);
+	return buf;
+}
+
+/**
+ * nflog_free_buf - release a buffer allocated via nflog_alloc_buf()
+ * \param buf the buffer
+ * \param size size passed to nflog_alloc_buf()
+ */
+void nflog_free_buf(void *buf, size_t size)
+{
+	munmap(buf, size);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,159 @@
+/* prefix.c: interning of logging prefixes
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/*
+ * Prefixes come from the ruleset, so there are only a few of them, but a
+ * ruleset that is reloaded over and over with generated names must not make
+ * us grow forever.
+ */
+#define NFLOG_PREFIX_MAX	65536
+
+struct nflog_prefix_slot {
+	uint32_t	hash;
+	uint32_t	id;		/* id + 1, 0 if the slot is empty */
+};
+
+struct nflog_prefix_entry {
+	char		*str;
+	size_t		len;
+};
+
+/* FNV-1a, prefixes are at most 64 bytes long */
+static uint32_t prefix_hash(const char *str, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct nflog_prefix_slot *
+prefix_slot(struct nflog_prefix_slot *slots, unsigned int size, uint32_t hash)
+{
+	unsigned int i;
+
+	for (i = hash & (size - 1); slots[i].id; i = (i + 1) & (size - 1))
+		;
+
+	return &slots[i];
+}
+
+static int prefix_grow(struct nflog_prefix_table *t)
+{
+	unsigned int i, size = t->size ? t->size * 2 : 16;
+	struct nflog_prefix_slot *slots;
+	struct nflog_prefix_entry *entries;
+
+	entries = realloc(t->entries, size / 2 * sizeof(*entries));
+	if (!entries)
+		return -1;
+	t->entries = entries;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots)
+		return -1;
+
+	for (i = 0; i < t->size; i++) {
+		if (t->slots[i].id)
+			*prefix_slot(slots, size, t->slots[i].hash) =
+				t->slots[i];
+	}
+
+	free(t->slots);
+	t->slots = slots;
+	t->size = size;
+
+	return 0;
+}
+
+int __nflog_prefix_intern(struct nflog_prefix_table *t, const char *str,
+			  size_t len)
+{
+	struct nflog_prefix_entry *e;
+	unsigned int i;
+	uint32_t hash;
+
+	/*
+	 * Packets mostly come in runs from the same rule, try the prefix of
+	 * the last one before hashing. Its address tells nothing, the receive
+	 * buffers are reused, so the bytes are compared.
+	 */
+	if (t->last) {
+		e = &t->entries[t->last - 1];
+		if (e->len == len && memcmp(e->str, str, len) == 0)
+			return t->last - 1;
+	}
+
+	hash = prefix_hash(str, len);
+	for (i = hash & (t->size - 1); t->size && t->slots[i].id;
+	     i = (i + 1) & (t->size - 1)) {
+		if (t->slots[i].hash != hash)
+			continue;
+
+		e = &t->entries[t->slots[i].id - 1];
+		if (e->len == len && memcmp(e->str, str, len) == 0) {
+			t->last = t->slots[i].id;
+			return t->last - 1;
+		}
+	}
+
+	/* first sight, keep the table at most half full */
+	if (t->count >= NFLOG_PREFIX_MAX) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	if ((t->count + 1) * 2 > t->size && prefix_grow(t) < 0)
+		return -1;
+
+	e = &t->entries[t->count];
+	e->str = malloc(len + 1);
+	if (!e->str)
+		return -1;
+
+	memcpy(e->str, str, len);
+	e->str[len] = '\0';
+	e->len = len;
+
+	t->count++;
+	*prefix_slot(t->slots, t->size, hash) =
+		(struct nflog_prefix_slot){ .hash = hash, .id = t->count };
+
+	t->last = t->count;
+	return t->count - 1;
+}
+
+const char *__nflog_prefix_name(const struct nflog_prefix_table *t,
+				unsigned int id)
+{
+	if (id >= t->count)
+		return NULL;
+
+	return t->entries[id].str;
+}
+
+void __nflog_prefix_table_free(struct nflog_prefix_table *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->count; i++)
+		free(t->entries[i].str);
+
+	free(t->entries);
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
+}
@@ -0,0 +1,210 @@
+/* range.c: adapt the copy range to the part of the payload that is used
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <errno.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Range Adaptive copy range functions
+ *
+ * Copying the whole packet (a range of 0xffff passed to nflog_set_mode())
+ * is wasteful when the application only looks at the headers: the kernel
+ * copies, and the socket buffers, bytes that nobody reads.
+ *
+ * With adaptive range enabled on a group, the library keeps track of how far
+ * into the payload the application reads, and derives from it the smallest
+ * range that would have been enough, plus some slack. This happens when the
+ * payload is decoded via nflog_get_pkt(), printed via nflog_snprintf_xml()
+ * or nflog_snprintf_json(), or when the application reports what it read
+ * via nflog_payload_consumed(). Packets nobody reported on are not taken
+ * into account, so applications that read the payload by other means must
+ * report, otherwise the range ends up too short for them.
+ *
+ * The range is evaluated every NFLOG_RANGE_WINDOW packets. If packets cut
+ * short by the current range were read up to their end, the range doubles.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+/* room for options and extension headers that the window did not see */
+#define NFLOG_RANGE_SLACK	64
+#define NFLOG_RANGE_ALIGN	64
+
+/* the range the group is configured with, whatever load shedding does */
+static uint32_t range_current(const struct nflog_g_handle *gh)
+{
+	uint32_t range = gh->shed.enabled ? gh->shed.range : gh->copy_range;
+
+	return range ? range : 0xffff;
+}
+
+static uint8_t range_mode(const struct nflog_g_handle *gh)
+{
+	return gh->shed.enabled ? gh->shed.mode : gh->copy_mode;
+}
+
+/**
+ * nflog_set_adaptive_range - track how much of the payload is used
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param mode NFLOG_RANGE_OFF, NFLOG_RANGE_PROPOSE or NFLOG_RANGE_APPLY
+ *
+ * With NFLOG_RANGE_PROPOSE, the library only computes the range, which
+ * nflog_get_range_proposal() returns. With NFLOG_RANGE_APPLY, it also
+ * applies it as nflog_set_mode() would whenever it is at least a quarter
+ * smaller than the current one, or larger. This happens in
+ * nflog_handle_packet(), once the callbacks for the datagram have returned,
+ * without waiting for the kernel to answer so that no message is handled
+ * out of turn meanwhile. Requests that fail are counted in \b config_errors
+ * of the statistics returned by nflog_get_stats(). It only applies to
+ * groups in NFULNL_COPY_PACKET mode. If load shedding is enabled on the
+ * group, the range is the one restored once the pressure goes away.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ \b mode is not valid.
+ */
+int nflog_set_adaptive_range(struct nflog_g_handle *gh,
+			     enum nflog_range_mode mode)
+{
+	switch (mode) {
+	case NFLOG_RANGE_OFF:
+	case NFLOG_RANGE_PROPOSE:
+	case NFLOG_RANGE_APPLY:
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	gh->range = (struct nflog_range) {
+		.mode	= mode,
+	};
+	return 0;
+}
+
+static void range_window(struct nflog_g_handle *gh)
+{
+	uint32_t cur = range_current(gh), proposal;
+
+	if (gh->range.starved) {
+		proposal = cur < 0x8000 ? cur * 2 : 0xffff;
+	} else {
+		proposal = gh->range.hwm + NFLOG_RANGE_SLACK;
+		proposal = (proposal + NFLOG_RANGE_ALIGN - 1) &
+			   ~(NFLOG_RANGE_ALIGN - 1);
+		if (proposal > 0xffff)
+			proposal = 0xffff;
+	}
+
+	gh->range.proposal = proposal;
+	gh->range.hwm = 0;
+	gh->range.samples = 0;
+	gh->range.starved = 0;
+
+	if (gh->range.mode == NFLOG_RANGE_APPLY &&
+	    range_mode(gh) == NFULNL_COPY_PACKET &&
+	    (proposal > cur || proposal < cur - cur / 4)) {
+		gh->range.pending = 1;
+		gh->h->range_pending = 1;
+	}
+}
+
+void __nflog_payload_consumed(struct nflog_data *nfad, size_t bytes,
+			      size_t len)
+{
+	struct nflog_g_handle *gh = nfad->gh;
+
+	if (!gh || gh->range.mode == NFLOG_RANGE_OFF)
+		return;
+
+	if (bytes > len)
+		bytes = len;
+	if (bytes > gh->range.hwm)
+		gh->range.hwm = bytes;
+
+	/* read up to the end of a payload that the range cut short */
+	if (bytes == len && len >= range_current(gh) &&
+	    !(gh->shed.enabled && gh->shed.level))
+		gh->range.starved = 1;
+
+	if (++gh->range.samples >= NFLOG_RANGE_WINDOW)
+		range_window(gh);
+}
+
+/**
+ * nflog_payload_consumed - report how much of the payload has been used
+ * \param nfad Netlink packet data handle passed to callback function
+ * \param bytes number of bytes read from the start of the payload
+ *
+ * Applications that read the payload returned by nflog_get_payload() by
+ * themselves report via this function how far they read, when adaptive
+ * range is enabled on the group, see nflog_set_adaptive_range(). Reporting
+ * the same packet several times is harmless as long as the largest value
+ * comes last, but it counts towards the evaluation window every time.
+ */
+void nflog_payload_consumed(struct nflog_data *nfad, size_t bytes)
+{
+	char *data;
+	int len;
+
+	len = nflog_get_payload(nfad, &data);
+	if (len >= 0)
+		__nflog_payload_consumed(nfad, bytes, len);
+}
+
+/**
+ * nflog_get_range_proposal - get the copy range derived from the payload use
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param range where to store the range
+ *
+ * \return 0 on success, -1 if adaptive range is not enabled on the group or
+ * no evaluation window has completed yet.
+ */
+int nflog_get_range_proposal(struct nflog_g_handle *gh, uint32_t *range)
+{
+	if (gh->range.mode == NFLOG_RANGE_OFF || gh->range.proposal == 0)
+		return -1;
+
+	*range = gh->range.proposal;
+	return 0;
+}
+
+/*
+ * apply pending proposals, outside of callbacks as it talks to the kernel,
+ * and without waiting for it, see __nflog_send_mode()
+ */
+void __nflog_range_update(struct nflog_handle *h)
+{
+	struct nflog_g_handle *gh;
+
+	h->range_pending = 0;
+
+	for (gh = h->gh_list; gh; gh = gh->next) {
+		if (!gh->range.pending)
+			continue;
+
+		gh->range.pending = 0;
+		if (gh->shed.enabled) {
+			gh->shed.range = gh->range.proposal;
+			if (gh->shed.level)
+				continue;
+		}
+		/* a failure is counted, the next proposal tries again */
+		__nflog_send_mode(gh, NFULNL_COPY_PACKET, gh->range.proposal);
+	}
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,425 @@
+/* recv.c: batched and busy-polling receive loop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Receive Receive loop functions
+ *
+ * Instead of calling __recv__(2) and nflog_handle_packet() by hand, the
+ * application can let the library run the receive side of the handle:
+ * nflog_process() waits for log messages, receives them in batches of up to
+ * NFLOG_RECV_BATCH datagrams via a single __recvmmsg__(2) call and passes
+ * them to the callbacks registered via nflog_callback_register().
+ *
+ * By default nflog_process() sleeps in the kernel until messages arrive.
+ * Latency sensitive consumers that can spare a core may switch the handle to
+ * busy-poll mode with nflog_set_recv_mode().
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#define NFLOG_RECV_SLOT		8192
+#define NFLOG_RECV_SLOT_MAX	(1 << 20)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax()	__asm__ __volatile__("yield" ::: "memory")
+#else
+#define cpu_relax()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+/**
+ * nflog_set_recv_mode - select how nflog_process() waits for messages
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param mode NFLOG_RECV_BLOCK or NFLOG_RECV_BUSY_POLL
+ * \param spin_us spinning budget in microseconds, for NFLOG_RECV_BUSY_POLL
+ *
+ * In NFLOG_RECV_BLOCK mode, the default, nflog_process() sleeps in the
+ * kernel until a message is available.
+ *
+ * In NFLOG_RECV_BUSY_POLL mode it polls the socket without blocking and
+ * backs off in three steps while the socket stays empty: it spins for up to
+ * \b spin_us microseconds, then gives up the CPU via __sched_yield__(2) for
+ * up to three times as long, and finally sleeps in __poll__(2). The steps are
+ * adapted to the rate messages have been arriving at so far: spinning is
+ * skipped when messages arrive further apart than \b spin_us, and yielding
+ * too when they arrive further apart than the whole budget, as the
+ * next message is then likely to take long enough to pay for the wakeup.
+ *
+ * The sleep lasts as long as receiving would block, ie. up to the SO_RCVTIMEO
+ * of the socket, and is skipped if the socket is non-blocking. nflog_process()
+ * then fails with EAGAIN, as it does in NFLOG_RECV_BLOCK mode.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ \b mode is not valid.
+ */
+int nflog_set_recv_mode(struct nflog_handle *h, enum nflog_recv_mode mode,
+			unsigned int spin_us)
+{
+	switch (mode) {
+	case NFLOG_RECV_BLOCK:
+	case NFLOG_RECV_BUSY_POLL:
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	h->recv.mode = mode;
+	h->recv.spin_ns = (uint64_t)spin_us * 1000;
+	return 0;
+}
+
+static int recv_alloc(struct nflog_handle *h)
+{
+	size_t slot = h->nlbufsiz > NFLOG_RECV_SLOT ?
+		      h->nlbufsiz : NFLOG_RECV_SLOT;
+
+	if (slot < h->recv.want)
+		slot = h->recv.want;
+
+	if (h->recv.buf && h->recv.slot >= slot)
+		return 0;
+
+	if (h->recv.buf)
+		nflog_free_buf(h->recv.buf, h->recv.slot * NFLOG_RECV_BATCH);
+
+	/* allocate lazily, so it lands where the receiving thread runs */
+	h->recv.buf = nflog_alloc_buf(h, slot * NFLOG_RECV_BATCH);
+	if (!h->recv.buf)
+		return -1;
+
+	h->recv.slot = slot;
+	return 0;
+}
+
+/*
+ * The datagram did not fit: count it, make room for the next ones and keep
+ * the messages that arrived whole.
+ */
+static size_t recv_truncated(struct nflog_handle *h, char *buf, size_t len)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	int left = len;
+
+	h->stats.truncated++;
+	if (h->recv.slot < NFLOG_RECV_SLOT_MAX) {
+		h->recv.want = h->recv.slot * 2;
+		if (h->recv.want > NFLOG_RECV_SLOT_MAX)
+			h->recv.want = NFLOG_RECV_SLOT_MAX;
+	}
+
+	while (NLMSG_OK(nlh, left))
+		nlh = NLMSG_NEXT(nlh, left);
+
+	return len - left;
+}
+
+static int recv_batch(struct nflog_handle *h, struct mmsghdr *msgs,
+		      struct sockaddr_nl *peer, int flags)
+{
+	struct iovec iov[NFLOG_RECV_BATCH];
+	int i, ret;
+
+	for (i = 0; i < NFLOG_RECV_BATCH; i++) {
+		peer[i] = (struct sockaddr_nl) {};
+		iov[i].iov_base = h->recv.buf + i * h->recv.slot;
+		iov[i].iov_len = h->recv.slot;
+		msgs[i].msg_hdr = (struct msghdr) {
+			.msg_name	= &peer[i],
+			.msg_namelen	= sizeof(peer[i]),
+			.msg_iov	= &iov[i],
+			.msg_iovlen	= 1,
+		};
+	}
+
+	ret = recvmmsg(nflog_fd(h), msgs, NFLOG_RECV_BATCH, flags, NULL);
+	if (ret < 0 && errno == ENOBUFS) {
+		h->stats.enobufs++;
+		if (h->shed_groups) {
+			nflog_overload_check(h, 1);
+			errno = ENOBUFS;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * how long receiving waits in NFLOG_RECV_BLOCK mode, in milliseconds as for
+ * poll(), ie. -1 for ever
+ */
+static int recv_timeout(struct nflog_handle *h)
+{
+	struct timeval tv;
+	socklen_t len = sizeof(tv);
+	int flags = fcntl(nflog_fd(h), F_GETFL);
+	uint64_t ms;
+
+	if (flags >= 0 && (flags & O_NONBLOCK))
+		return 0;
+
+	if (getsockopt(nflog_fd(h), SOL_SOCKET, SO_RCVTIMEO, &tv, &len) < 0 ||
+	    (tv.tv_sec == 0 && tv.tv_usec == 0))
+		return -1;
+
+	ms = (uint64_t)tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+	return ms > INT_MAX ? INT_MAX : ms;
+}
+
+/* wait until messages are available and receive them, busy-poll flavour */
+static int recv_busy_poll(struct nflog_handle *h, struct mmsghdr *msgs,
+			  struct sockaddr_nl *peer)
+{
+	uint64_t spin = h->recv.spin_ns, gap = h->recv.gap_ns;
+	uint64_t start = __nflog_now_ns(), waited;
+	struct pollfd pfd = {
+		.fd	= nflog_fd(h),
+		.events	= POLLIN,
+	};
+	int ret, timeout;
+
+	for (;;) {
+		ret = recv_batch(h, msgs, peer, MSG_DONTWAIT);
+		if (ret >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			return ret;
+
+		waited = __nflog_now_ns() - start;
+		if (waited < spin && gap <= spin) {
+			h->stats.spins++;
+			cpu_relax();
+		} else if (waited < 4 * spin && gap <= 4 * spin) {
+			h->stats.yields++;
+			sched_yield();
+		} else {
+			/* as long as the socket would, then give up */
+			timeout = recv_timeout(h);
+			if (timeout == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+
+			h->stats.sleeps++;
+			ret = poll(&pfd, 1, timeout);
+			if (ret < 0)
+				return -1;
+			if (ret == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+		}
+	}
+}
+
+/**
+ * nflog_process - receive log messages and pass them to the callbacks
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ *
+ * This function waits for log messages as set by nflog_set_recv_mode(),
+ * then receives all datagrams that are pending, up to NFLOG_RECV_BATCH, and
+ * calls nflog_handle_packet() on each of them. Datagrams that were not sent
+ * by the kernel are dropped. Call it in a loop from the thread that runs the
+ * receive side of the handle.
+ *
+ * The receive buffers hold the largest datagram the kernel sends given the
+ * buffer sizes set via nflog_set_nlbufsiz(). Should a datagram be truncated
+ * anyway, eg. because another process set a larger size, the messages that
+ * arrived whole are still handled, the datagram is counted in the statistics
+ * returned by nflog_get_stats(), and the buffers grow for the next calls.
+ *
+ * With fair dispatch enabled, see nflog_set_fair(), the messages go through
+ * the group queues instead, and nflog_process() does not wait for new
+ * datagrams while messages are still queued.
+ *
+ * \return number of datagrams received, or -1 on failure with \b errno set.
+ * \par Errors
+ * __ENOBUFS__ The socket buffer overran and log messages have been lost,
+ * calling nflog_process() again resumes receiving.
+ * \n __EAGAIN__ The socket is non-blocking and no message was pending, or
+ * its receive timeout (SO_RCVTIMEO) expired.
+ * \n __ENOMEM__ No memory for the receive buffer.
+ * \n as for __recvmmsg__(2)
+ */
+int nflog_process(struct nflog_handle *h)
+{
+	struct sockaddr_nl peer[NFLOG_RECV_BATCH];
+	struct mmsghdr msgs[NFLOG_RECV_BATCH];
+	uint64_t now, gap, wall = 0;
+	int i, ret;
+
+	if (recv_alloc(h) < 0)
+		return -1;
+
+	if (h->fair_queued) {
+		/* do not wait for more while messages are queued */
+		ret = recv_batch(h, msgs, peer, MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			ret = 0;
+	} else if (h->recv.mode == NFLOG_RECV_BUSY_POLL) {
+		ret = recv_busy_poll(h, msgs, peer);
+	} else {
+		ret = recv_batch(h, msgs, peer, MSG_WAITFORONE);
+	}
+
+	if (ret < 0)
+		return ret;
+	if (ret == 0) {
+		if (h->fair_queued)
+			__nflog_fair_dispatch(h);
+		return 0;
+	}
+
+	/* average time between datagrams, weighted towards recent batches */
+	now = __nflog_now_ns();
+	if (h->recv.last) {
+		gap = (now - h->recv.last) / ret;
+		h->recv.gap_ns = h->recv.gap_ns - h->recv.gap_ns / 8 + gap / 8;
+	}
+	h->recv.last = now;
+
+	h->stats.batches++;
+	h->stats.datagrams += ret;
+
+	/* the whole batch was there when recvmmsg() returned */
+	if (h->capture_fd >= 0)
+		wall = __nflog_wall_ns();
+
+	for (i = 0; i < ret; i++) {
+		char *buf = h->recv.buf + i * h->recv.slot;
+		size_t len = msgs[i].msg_len;
+		int trunc = msgs[i].msg_hdr.msg_flags & MSG_TRUNC;
+
+		if (peer[i].nl_pid != 0)
+			continue;
+
+		if (h->capture_fd >= 0)
+			__nflog_capture(h, buf, len, wall,
+					trunc ? NFLOG_CAPTURE_F_TRUNC : 0);
+
+		if (trunc)
+			len = recv_truncated(h, buf, len);
+
+		/* behind what is still queued, even once disabled */
+		if (h->fair_groups || h->fair_queued)
+			__nflog_fair_enqueue(h, buf, len);
+		else
+			nflog_handle_packet(h, buf, len);
+	}
+
+	if (h->fair_queued)
+		__nflog_fair_dispatch(h);
+
+	if (h->tune_next && now >= h->tune_next)
+		__nflog_autotune(h, now);
+
+	if (h->shed_groups && now >= h->shed_next)
+		nflog_overload_check(h, 0);
+
+	return ret;
+}
+
+/**
+ * nflog_recv - receive a datagram into the buffer of the handle
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param buf where to store the address of the datagram
+ *
+ * This is for applications that run their own receive loop, see nflog_fd(),
+ * and pass what they receive to nflog_handle_packet(). Rather than guessing
+ * the size of a receive buffer, they can let the library receive into a
+ * buffer of the handle, sized after nflog_set_nlbufsiz() and kept across
+ * calls. Truncated datagrams are handled as nflog_process() does. Datagrams
+ * that were not sent by the kernel are skipped.
+ *
+ * \b buf stays valid until the next call to nflog_recv() or nflog_process().
+ *
+ * \return length of the datagram, or -1 on failure with \b errno set.
+ * \par Errors
+ * __ENOMEM__ No memory for the receive buffer.
+ * \n as for __recvmsg__(2)
+ */
+int nflog_recv(struct nflog_handle *h, char **buf)
+{
+	struct sockaddr_nl peer;
+	struct iovec iov;
+	struct msghdr mh;
+	ssize_t ret;
+
+	if (recv_alloc(h) < 0)
+		return -1;
+
+	do {
+		peer = (struct sockaddr_nl) {};
+		iov.iov_base = h->recv.buf;
+		iov.iov_len = h->recv.slot;
+		mh = (struct msghdr) {
+			.msg_name	= &peer,
+			.msg_namelen	= sizeof(peer),
+			.msg_iov	= &iov,
+			.msg_iovlen	= 1,
+		};
+
+		ret = recvmsg(nflog_fd(h), &mh, 0);
+		if (ret < 0) {
+			if (errno == ENOBUFS)
+				h->stats.enobufs++;
+			return -1;
+		}
+	} while (peer.nl_pid != 0);
+
+	h->stats.datagrams++;
+	if (h->capture_fd >= 0)
+		__nflog_capture(h, h->recv.buf, ret, __nflog_wall_ns(),
+				mh.msg_flags & MSG_TRUNC ?
+				NFLOG_CAPTURE_F_TRUNC : 0);
+
+	if (mh.msg_flags & MSG_TRUNC)
+		ret = recv_truncated(h, h->recv.buf, ret);
+
+	*buf = h->recv.buf;
+	return ret;
+}
+
+/**
+ * nflog_get_stats - get the receive statistics of a handle
+ * \param h Netfilter log handle obtained via call to nflog_open()
+ * \param stats structure to fill
+ *
+ * The counters are updated by nflog_process(), nflog_recv() and
+ * nflog_handle_packet(), they start at zero when the handle is opened.
+ *
+ * \return 0
+ */
+int nflog_get_stats(struct nflog_handle *h, struct nflog_stats *stats)
+{
+	*stats = h->stats;
+	return 0;
+}
+
+/**
+ * @}
+ */
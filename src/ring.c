@@ -0,0 +1,402 @@
+/* ring.c: fan log records out to local readers via shared memory
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Ring Shared memory ring functions
+ *
+ * A group can only be bound by one socket, yet several local tools may want
+ * the same log stream. One process receives the messages and publishes them
+ * as records into a ring in shared memory via nflog_ring_publish(), and any
+ * number of readers attach to the ring via nflog_ring_attach() and read the
+ * records via nflog_ring_read(), without any system call per record.
+ *
+ * The ring holds a power of two number of fixed size slots, one record per
+ * slot, the payload being truncated to what fits. The writer never waits for
+ * the readers: each reader has its own cursor, and a reader that falls more
+ * than a ring behind loses the records that have been overwritten, which
+ * nflog_ring_lost() counts.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+#define NFLOG_RING_MAGIC	0x6e666c72	/* "nflr" */
+#define NFLOG_RING_VERSION	1
+#define NFLOG_RING_CACHELINE	64
+
+struct nflog_ring_shm {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	slots;
+	uint32_t	slot_size;
+	char		pad[NFLOG_RING_CACHELINE - 16];
+	/* next sequence number to publish, alone on its cache line */
+	uint64_t	cursor;
+	char		pad2[NFLOG_RING_CACHELINE - 8];
+};
+
+struct nflog_ring_slot {
+	/* sequence number + 1 of the record, 0 while it is being written */
+	uint64_t	seq;
+	char		data[];
+};
+
+struct nflog_ring {
+	struct nflog_ring_shm	*shm;
+	size_t			size;
+	size_t			stride;
+	uint64_t		mask;
+	char			*name;		/* writer only */
+	uint64_t		next;		/* reader only */
+	uint64_t		lost;
+};
+
+static size_t ring_stride(uint32_t slot_size)
+{
+	size_t stride = sizeof(struct nflog_ring_slot) + slot_size;
+
+	return (stride + NFLOG_RING_CACHELINE - 1) &
+	       ~(size_t)(NFLOG_RING_CACHELINE - 1);
+}
+
+static struct nflog_ring_slot *ring_slot(const struct nflog_ring *r,
+					 uint64_t seq)
+{
+	return (struct nflog_ring_slot *)((char *)(r->shm + 1) +
+					  (seq & r->mask) * r->stride);
+}
+
+/**
+ * nflog_ring_create - create a ring to publish log records into
+ * \param name name of the shared memory object, as for __shm_open__(3)
+ * \param slots number of records the ring holds, a power of two
+ * \param slot_size size of a slot, at least sizeof(struct nflog_ring_rec)
+ *
+ * An existing ring of the same name is replaced, readers attached to it keep
+ * reading the old one. The shared memory object is removed by
+ * nflog_ring_close().
+ *
+ * \return a pointer to the ring or NULL on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ \b slots is not a power of two, or \b slot_size is too small.
+ * \n as for __shm_open__(3) and __mmap__(2)
+ */
+struct nflog_ring *nflog_ring_create(const char *name, unsigned int slots,
+				     unsigned int slot_size)
+{
+	struct nflog_ring *r;
+	int fd;
+
+	if (slots == 0 || (slots & (slots - 1)) ||
+	    slot_size < sizeof(struct nflog_ring_rec)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	r->name = strdup(name);
+	if (!r->name)
+		goto err_free;
+
+	r->stride = ring_stride(slot_size);
+	r->mask = slots - 1;
+	r->size = sizeof(struct nflog_ring_shm) + slots * r->stride;
+
+	/* readers must not see a ring that is not set up yet */
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+	if (fd < 0)
+		goto err_free;
+
+	if (ftruncate(fd, r->size) < 0)
+		goto err_unlink;
+
+	r->shm = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r->shm == MAP_FAILED)
+		goto err_unlink;
+	close(fd);
+
+	r->shm->slots = slots;
+	r->shm->slot_size = slot_size;
+	r->shm->version = NFLOG_RING_VERSION;
+	__atomic_store_n(&r->shm->magic, NFLOG_RING_MAGIC, __ATOMIC_RELEASE);
+
+	return r;
+
+err_unlink:
+	close(fd);
+	shm_unlink(name);
+err_free:
+	free(r->name);
+	free(r);
+	return NULL;
+}
+
+/**
+ * nflog_ring_attach - attach to a ring as a reader
+ * \param name name the ring has been created with via nflog_ring_create()
+ *
+ * The reader starts with the next record published.
+ *
+ * \return a pointer to the ring or NULL on failure with \b errno set.
+ * \par Errors
+ * __EPROTO__ The object is not a ring, or not set up yet.
+ * \n as for __shm_open__(3) and __mmap__(2)
+ */
+struct nflog_ring *nflog_ring_attach(const char *name)
+{
+	struct nflog_ring_shm hdr;
+	struct nflog_ring *r;
+	struct stat st;
+	int fd;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+
+	fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		goto err_free;
+
+	if (fstat(fd, &st) < 0)
+		goto err_close;
+	if ((size_t)st.st_size < sizeof(hdr) ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != NFLOG_RING_MAGIC ||
+	    hdr.version != NFLOG_RING_VERSION ||
+	    hdr.slots == 0 || (hdr.slots & (hdr.slots - 1)))
+		goto err_proto;
+
+	r->stride = ring_stride(hdr.slot_size);
+	r->mask = hdr.slots - 1;
+	r->size = sizeof(hdr) + hdr.slots * r->stride;
+	if ((size_t)st.st_size < r->size)
+		goto err_proto;
+
+	r->shm = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (r->shm == MAP_FAILED)
+		goto err_close;
+	close(fd);
+
+	r->next = __atomic_load_n(&r->shm->cursor, __ATOMIC_ACQUIRE);
+	return r;
+
+err_proto:
+	errno = EPROTO;
+err_close:
+	close(fd);
+err_free:
+	free(r);
+	return NULL;
+}
+
+/**
+ * nflog_ring_close - detach from a ring
+ * \param r ring obtained via nflog_ring_create() or nflog_ring_attach()
+ *
+ * If \b r has been obtained via nflog_ring_create(), this also removes the
+ * shared memory object, readers attached keep their mapping.
+ */
+void nflog_ring_close(struct nflog_ring *r)
+{
+	if (r->name) {
+		shm_unlink(r->name);
+		free(r->name);
+	}
+	munmap(r->shm, r->size);
+	free(r);
+}
+
+/**
+ * nflog_ring_slot_size - get the size of the records of a ring
+ * \param r ring obtained via nflog_ring_create() or nflog_ring_attach()
+ *
+ * \return the largest size of a record, what a buffer passed to
+ * nflog_ring_read() should hold.
+ */
+unsigned int nflog_ring_slot_size(const struct nflog_ring *r)
+{
+	return r->shm->slot_size;
+}
+
+/**
+ * nflog_ring_publish - publish a log message into a ring
+ * \param r ring obtained via nflog_ring_create()
+ * \param nfad Netlink packet data handle passed to callback function
+ *
+ * This decodes the message into a struct nflog_ring_rec, followed by as
+ * much of the payload as fits in the slot, and makes it visible to the
+ * readers. Fields the message does not carry are zero, but for \b uid and
+ * \b gid which are NFLOG_RING_NONE.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __EPERM__ \b r has been obtained via nflog_ring_attach().
+ */
+int nflog_ring_publish(struct nflog_ring *r, struct nflog_data *nfad)
+{
+	uint64_t seq = r->shm->cursor;
+	struct nflog_ring_slot *slot = ring_slot(r, seq);
+	struct nflog_ring_rec *rec = (struct nflog_ring_rec *)slot->data;
+	struct nfulnl_msg_packet_hdr *ph;
+	uint32_t room = r->shm->slot_size - sizeof(*rec);
+	struct timeval tv;
+	char *prefix, *payload;
+	int len;
+
+	if (!r->name) {
+		errno = EPERM;
+		return -1;
+	}
+
+	/* readers that copy the slot from now on see it change */
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memset(rec, 0, sizeof(*rec));
+	if (nflog_get_timestamp(nfad, &tv) == 0)
+		rec->tstamp_ns = (uint64_t)tv.tv_sec * 1000000000 +
+				 tv.tv_usec * 1000;
+	if (nfad->gh)
+		rec->group = nfad->gh->id;
+	ph = nflog_get_msg_packet_hdr(nfad);
+	if (ph) {
+		rec->hw_protocol = ntohs(ph->hw_protocol);
+		rec->hook = ph->hook;
+	}
+	rec->mark = nflog_get_nfmark(nfad);
+	rec->indev = nflog_get_indev(nfad);
+	rec->outdev = nflog_get_outdev(nfad);
+	if (nflog_get_uid(nfad, &rec->uid) < 0)
+		rec->uid = NFLOG_RING_NONE;
+	if (nflog_get_gid(nfad, &rec->gid) < 0)
+		rec->gid = NFLOG_RING_NONE;
+	nflog_get_seq(nfad, &rec->seq);
+
+	prefix = nflog_get_prefix(nfad);
+	if (prefix)
+		strncpy(rec->prefix, prefix, sizeof(rec->prefix) - 1);
+
+	len = nflog_get_payload(nfad, &payload);
+	if (len > 0) {
+		rec->payload_len = len;
+		rec->caplen = (uint32_t)len < room ? (uint32_t)len : room;
+		memcpy(rec->payload, payload, rec->caplen);
+	}
+	rec->len = sizeof(*rec) + rec->caplen;
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->shm->cursor, seq + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * nflog_ring_read - read the next record from a ring
+ * \param r ring obtained via nflog_ring_attach()
+ * \param buf buffer to copy the record to, a struct nflog_ring_rec
+ * \param len size of \b buf, see nflog_ring_slot_size()
+ *
+ * This never blocks. Records that have been overwritten before the reader
+ * got to them are skipped and counted, see nflog_ring_lost().
+ *
+ * \return size of the record, 0 if no record is available, or -1 on failure
+ * with \b errno set.
+ * \par Errors
+ * __EMSGSIZE__ \b buf is too small for the record, which stays the next one.
+ */
+int nflog_ring_read(struct nflog_ring *r, void *buf, size_t len)
+{
+	struct nflog_ring_rec *rec = buf;
+	struct nflog_ring_slot *slot;
+	uint64_t cursor, seq;
+	uint32_t size;
+
+	for (;;) {
+		cursor = __atomic_load_n(&r->shm->cursor, __ATOMIC_ACQUIRE);
+		if (r->next >= cursor)
+			return 0;
+
+		/* lapped by the writer, resume with the oldest record left */
+		if (cursor - r->next > r->mask + 1) {
+			r->lost += cursor - (r->mask + 1) - r->next;
+			r->next = cursor - (r->mask + 1);
+		}
+
+		slot = ring_slot(r, r->next);
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == r->next + 1) {
+			size = ((struct nflog_ring_rec *)slot->data)->len;
+			if (size > r->shm->slot_size)
+				size = r->shm->slot_size;
+			if (size > len) {
+				errno = EMSGSIZE;
+				return -1;
+			}
+			memcpy(rec, slot->data, size);
+
+			/* the copy is only good if the writer left it alone */
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq &&
+			    rec->len == size) {
+				r->next++;
+				return size;
+			}
+		}
+
+		r->lost++;
+		r->next++;
+	}
+}
+
+/**
+ * nflog_ring_lost - get the number of records a reader missed
+ * \param r ring obtained via nflog_ring_attach()
+ *
+ * \return number of records overwritten before nflog_ring_read() got to
+ * them since the reader attached.
+ */
+uint64_t nflog_ring_lost(const struct nflog_ring *r)
+{
+	return r->lost;
+}
+
+/**
+ * nflog_ring_lag - get how far behind the writer a reader is
+ * \param r ring obtained via nflog_ring_attach()
+ *
+ * \return number of records published that the reader has not read yet. A
+ * lag larger than the number of slots means records are being lost.
+ */
+uint64_t nflog_ring_lag(const struct nflog_ring *r)
+{
+	return __atomic_load_n(&r->shm->cursor, __ATOMIC_ACQUIRE) - r->next;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,293 @@
+/* tune.c: derive the kernel batching parameters from a latency target
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <libnfnetlink/libnfnetlink.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include "internal.h"
+
+/**
+ * \defgroup Tuning Batching tuning functions
+ *
+ * The kernel does not send every log message on its own. It stacks messages
+ * for a group in a buffer of nlbufsiz bytes, and pushes the buffer to
+ * userspace when it holds qthresh messages, when it is full, or when timeout
+ * hundredths of a second have passed since the first message was stacked.
+ * The socket receive buffer then has to hold the datagrams until the
+ * application reads them.
+ *
+ * Rather than guessing all four values, the application can describe what
+ * it expects, ie. the maximum delay it tolerates between logging and
+ * delivery, the packet rate and the message size, and let nflog_tune()
+ * derive and apply a coherent set.
+ *
+ * \manonly
+.SH SYNOPSIS
+.nf
+\fB
+#include <libnetfilter_log/libnetfilter_log.h>
+\endmanonly
+ * @{
+ */
+
+/* the kernel refuses buffers outside [NLMSG_GOODSIZE, 128 KiB] */
+#define NFLOG_NLBUFSIZ_MIN	8192
+#define NFLOG_NLBUFSIZ_MAX	131072
+
+/* netlink and nfnetlink headers plus the attributes of a log message */
+#define NFLOG_MSG_OVERHEAD	256
+
+/* the socket has to absorb what arrives in this long, in milliseconds */
+#define NFLOG_RCVBUF_WINDOW	100
+
+/* retune from at least this long an observation, in nanoseconds */
+#define NFLOG_TUNE_PERIOD	1000000000ULL
+
+/**
+ * nflog_calc_tuning - compute batching parameters for a latency target
+ * \param t latency_ms, rate and msgsize describe the workload, the other
+ * fields are filled in
+ *
+ * This computes the values that nflog_tune() applies, without applying
+ * them, eg. to put them in NFULA_CFG_TIMEOUT, NFULA_CFG_QTHRESH and
+ * NFULA_CFG_NLBUFSIZ attributes on a libmnl socket. A zero \b msgsize is
+ * taken as a message without payload.
+ *
+ * The timeout is the latency target, the queue threshold is the number of
+ * packets that arrive within it, capped by what fits in the largest buffer
+ * the kernel accepts, and the buffer is sized to hold them. The receive
+ * buffer holds at least ten kernel buffers or what arrives in 100ms,
+ * whichever is larger, doubled to account for the socket buffer overhead.
+ */
+void nflog_calc_tuning(struct nflog_tuning *t)
+{
+	uint64_t qthresh, nlbufsiz, rcvbuf, msgsize = t->msgsize;
+
+	if (msgsize == 0)
+		msgsize = NFLOG_MSG_OVERHEAD;
+
+	qthresh = (uint64_t)t->rate * t->latency_ms / 1000;
+	if (qthresh > NFLOG_NLBUFSIZ_MAX / msgsize)
+		qthresh = NFLOG_NLBUFSIZ_MAX / msgsize;
+	if (qthresh == 0)
+		qthresh = 1;
+
+	nlbufsiz = qthresh * msgsize;
+	if (nlbufsiz < NFLOG_NLBUFSIZ_MIN)
+		nlbufsiz = NFLOG_NLBUFSIZ_MIN;
+	if (nlbufsiz > NFLOG_NLBUFSIZ_MAX)
+		nlbufsiz = NFLOG_NLBUFSIZ_MAX;
+
+	rcvbuf = (uint64_t)t->rate * msgsize * NFLOG_RCVBUF_WINDOW / 1000;
+	if (rcvbuf < 10 * nlbufsiz)
+		rcvbuf = 10 * nlbufsiz;
+	rcvbuf *= 2;
+	if (rcvbuf > INT32_MAX)
+		rcvbuf = INT32_MAX;
+
+	/* the kernel timer ticks in hundredths of a second */
+	t->timeout = t->latency_ms / 10;
+	t->qthresh = qthresh;
+	t->nlbufsiz = nlbufsiz;
+	t->rcvbuf = rcvbuf;
+}
+
+/* the socket is shared, it has to absorb what all the tuned groups send */
+static uint32_t tune_rcvbuf(const struct nflog_g_handle *gh,
+			    const struct nflog_tuning *t)
+{
+	const struct nflog_g_handle *cur;
+	uint64_t rcvbuf = t->rcvbuf;
+
+	for (cur = gh->h->gh_list; cur; cur = cur->next) {
+		if (cur != gh && !cur->unbound && cur->tuning.latency_ms)
+			rcvbuf += cur->tuning.rcvbuf;
+	}
+
+	return rcvbuf > INT32_MAX ? INT32_MAX : rcvbuf;
+}
+
+/*
+ * Waiting for the kernel to ack each value is fine from nflog_tune(), not
+ * from nflog_process() which retunes: the messages received meanwhile would
+ * be handled behind its back. There, the values go in a single request that
+ * asks for no ack, see __nflog_send_tuning().
+ */
+static int tune_apply(struct nflog_g_handle *gh, const struct nflog_tuning *t,
+		      int ack)
+{
+	if (!ack) {
+		if (__nflog_send_tuning(gh, t) < 0)
+			return -1;
+	} else if (nflog_set_timeout(gh, t->timeout) < 0 ||
+		   nflog_set_qthresh(gh, t->qthresh) < 0 ||
+		   nflog_set_nlbufsiz(gh, t->nlbufsiz) < 0)
+		return -1;
+
+	/* after nflog_set_nlbufsiz(), which sets its own receive buffer */
+	nfnl_rcvbufsiz(nflog_nfnlh(gh->h), tune_rcvbuf(gh, t));
+	return 0;
+}
+
+/* what a message of this group is likely to weigh, given its copy mode */
+static uint32_t tune_msgsize(const struct nflog_g_handle *gh)
+{
+	uint32_t range = gh->copy_range;
+
+	if (gh->copy_mode != NFULNL_COPY_PACKET)
+		return NFLOG_MSG_OVERHEAD;
+
+	/* a range of zero or 0xffff copies the whole packet */
+	if (range == 0 || range > 1500)
+		range = 1500;
+
+	return NFLOG_MSG_OVERHEAD + range;
+}
+
+/**
+ * nflog_tune - compute and apply batching parameters for a group
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param t latency_ms, rate and msgsize describe the workload, the other
+ * fields are filled in with the values applied
+ * \param flags NFLOG_TUNE_AUTO or zero
+ *
+ * This sets the timeout, queue threshold and buffer size of the group, as
+ * computed by nflog_calc_tuning(). The socket is shared by all the groups of
+ * the handle, so its receive buffer is set to the sum of the \b rcvbuf values
+ * of the tuned groups rather than to the one of this group alone. If
+ * \b msgsize is zero, it is estimated from the mode set via
+ * nflog_set_mode(), assuming full sized Ethernet frames.
+ *
+ * With NFLOG_TUNE_AUTO, nflog_process() calls nflog_retune() on the group
+ * about once a second, so that the parameters follow the traffic.
+ *
+ * \return 0 on success, -1 on failure with \b errno set.
+ * \par Errors
+ * __EINVAL__ \b latency_ms or \b rate is zero.
+ * \n from underlying calls, in exceptional circumstances
+ */
+int nflog_tune(struct nflog_g_handle *gh, struct nflog_tuning *t,
+	       unsigned int flags)
+{
+	if (t->latency_ms == 0 || t->rate == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (t->msgsize == 0)
+		t->msgsize = tune_msgsize(gh);
+
+	nflog_calc_tuning(t);
+	if (tune_apply(gh, t, 1) < 0)
+		return -1;
+
+	gh->tuning = *t;
+	gh->tune_flags = flags;
+	gh->obs_start = __nflog_now_ns();
+	gh->obs_msgs = gh->obs_bytes = 0;
+
+	if ((flags & NFLOG_TUNE_AUTO) && !gh->h->tune_next)
+		gh->h->tune_next = gh->obs_start + NFLOG_TUNE_PERIOD;
+
+	return 0;
+}
+
+/* true if _new_ is more than 25% away from _old_ */
+static int tune_differs(uint32_t old, uint32_t new)
+{
+	uint32_t delta = old > new ? old - new : new - old;
+
+	return delta > old / 4;
+}
+
+/**
+ * nflog_retune - adjust the batching parameters to the observed traffic
+ * \param gh Netfilter log group handle previously tuned via nflog_tune()
+ *
+ * This recomputes the parameters from the rate and average size of the
+ * messages received on the group since the last call, keeping the latency
+ * target set via nflog_tune(). They are only applied if the queue threshold
+ * or the receive buffer change by more than 25%, so that a steady workload
+ * does not cause configuration traffic. Messages are only accounted for if
+ * they go through nflog_handle_packet(), and nothing happens until at least
+ * one second has been observed.
+ *
+ * As nflog_process() calls it, the new values are sent without waiting for
+ * the kernel to acknowledge them. Should the kernel refuse them, the error
+ * is counted in the \b config_errors statistic, see nflog_get_stats().
+ *
+ * \return 1 if new values have been applied, 0 if not, -1 on failure with
+ * \b errno set.
+ * \par Errors
+ * __EINVAL__ The group has not been tuned via nflog_tune().
+ * \n from underlying calls, in exceptional circumstances
+ */
+int nflog_retune(struct nflog_g_handle *gh)
+{
+	uint64_t now = __nflog_now_ns(), elapsed = now - gh->obs_start;
+	struct nflog_tuning t = gh->tuning;
+
+	if (t.latency_ms == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (elapsed < NFLOG_TUNE_PERIOD || gh->obs_msgs == 0)
+		return 0;
+
+	t.rate = gh->obs_msgs * 1000 / (elapsed / 1000000);
+	if (t.rate == 0)
+		t.rate = 1;
+	t.msgsize = gh->obs_bytes / gh->obs_msgs;
+
+	gh->obs_start = now;
+	gh->obs_msgs = gh->obs_bytes = 0;
+
+	nflog_calc_tuning(&t);
+	if (!tune_differs(gh->tuning.qthresh, t.qthresh) &&
+	    !tune_differs(gh->tuning.rcvbuf, t.rcvbuf))
+		return 0;
+
+	if (tune_apply(gh, &t, 0) < 0)
+		return -1;
+
+	gh->tuning = t;
+	return 1;
+}
+
+/**
+ * nflog_get_tuning - get the batching parameters applied to a group
+ * \param gh Netfilter log group handle obtained by call to nflog_bind_group().
+ * \param t structure to fill
+ *
+ * \return 0 on success, -1 if the group has not been tuned via nflog_tune().
+ */
+int nflog_get_tuning(struct nflog_g_handle *gh, struct nflog_tuning *t)
+{
+	if (gh->tuning.latency_ms == 0)
+		return -1;
+
+	*t = gh->tuning;
+	return 0;
+}
+
+void __nflog_autotune(struct nflog_handle *h, uint64_t now)
+{
+	struct nflog_g_handle *gh;
+
+	for (gh = h->gh_list; gh; gh = gh->next) {
+		if (gh->tune_flags & NFLOG_TUNE_AUTO)
+			nflog_retune(gh);
+	}
+
+	h->tune_next = now + NFLOG_TUNE_PERIOD;
+}
+
+/**
+ * @}
+ */
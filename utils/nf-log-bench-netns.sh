@@ -0,0 +1,100 @@
+#!/bin/sh
+#
+# nf-log-bench-netns.sh: run nf-log-bench against real NFLOG rules
+#
+# Creates a private network namespace linked by a veth pair to a second one,
+# logs the UDP traffic sent over the pair to one or more nflog groups via
+# nftables (or iptables), and runs nf-log-bench in the namespace with its
+# built-in traffic generator. Nothing leaves the host and nothing outside the
+# namespaces is touched. Needs root.
+#
+#	nf-log-bench-netns.sh -n 4 -r 200000 -- -p mnl -q 64
+#
+# Options after -- are passed to nf-log-bench.
+
+BENCH=${BENCH:-$(dirname "$0")/nf-log-bench}
+GROUPS_N=1
+GROUP=1
+PORT=9000
+RATE=100000
+LEN=64
+DURATION=10
+BACKEND=nft
+
+usage() {
+	echo "Usage: $0 [-n groups] [-g first_group] [-r rate] [-l len]" \
+	     "[-t seconds] [-b nft|iptables] [-- bench options]" >&2
+	exit 1
+}
+
+while getopts "n:g:r:l:t:b:" opt; do
+	case $opt in
+	n) GROUPS_N=$OPTARG ;;
+	g) GROUP=$OPTARG ;;
+	r) RATE=$OPTARG ;;
+	l) LEN=$OPTARG ;;
+	t) DURATION=$OPTARG ;;
+	b) BACKEND=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+NS=nflb-$$
+PEER=nflb-peer-$$
+RUN="ip netns exec $NS"
+
+cleanup() {
+	ip netns del $NS 2>/dev/null
+	ip netns del $PEER 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+set -e
+
+ip netns add $NS
+ip netns add $PEER
+ip link add veth0 netns $NS type veth peer name veth1 netns $PEER
+
+$RUN ip link set lo up
+$RUN ip addr add 10.211.0.1/24 dev veth0
+$RUN ip link set veth0 up
+ip netns exec $PEER ip link set lo up
+ip netns exec $PEER ip addr add 10.211.0.2/24 dev veth1
+ip netns exec $PEER ip link set veth1 up
+
+# log on the way out, one destination port per group
+case $BACKEND in
+nft)
+	$RUN nft add table ip nflb
+	$RUN nft add chain ip nflb out \
+		'{ type filter hook output priority 0; }'
+	;;
+iptables)
+	;;
+*)
+	usage
+	;;
+esac
+
+BENCH_GROUPS=
+i=0
+while [ $i -lt $GROUPS_N ]; do
+	g=$((GROUP + i))
+	p=$((PORT + i))
+	if [ $BACKEND = nft ]; then
+		$RUN nft add rule ip nflb out ip daddr 10.211.0.2 \
+			udp dport $p log group $g
+	else
+		$RUN iptables -A OUTPUT -d 10.211.0.2 -p udp --dport $p \
+			-j NFLOG --nflog-group $g
+	fi
+	BENCH_GROUPS="$BENCH_GROUPS -g $g"
+	i=$((i + 1))
+done
+
+# the peer has nothing listening, keep it from answering with ICMP errors
+ip netns exec $PEER sysctl -qw net.ipv4.icmp_ratelimit=1000000 || true
+
+$RUN "$BENCH" $BENCH_GROUPS -G 10.211.0.2:$PORT -r $RATE -l $LEN \
+	-t $DURATION "$@"
@@ -0,0 +1,730 @@
+/* nf-log-bench: measure the receive side of nflog groups
+ *
+ * Binds to one or more groups, receives for a while, either via
+ * nflog_process() or via libmnl, and reports the rate, the CPU time spent,
+ * the delay until delivery to the callback, the messages the kernel lost
+ * and what the receive loop did while it waited.
+ *
+ * For example, with a traffic generator hitting:
+ *
+ *	iptables -I INPUT -p udp --dport 9 -j NFLOG --nflog-group 1
+ *
+ *	nf-log-bench -g 1 -m block
+ *	nf-log-bench -g 1 -m busy -s 50
+ *
+ * With -G, the tool generates the traffic itself: it sends UDP datagrams to
+ * the given port for the first group, the next port for the second group,
+ * and so on, carrying a sequence number and the time they were sent, so the
+ * delay is measured from the send. Loss is found from the NFULA_SEQ numbers
+ * of each group. nf-log-bench-netns.sh sets up matching rules in a private
+ * network namespace:
+ *
+ *	nf-log-bench -g 1 -g 2 -G 10.211.0.2:9000 -r 100000 -p mnl
+ *
+ * With -k, the groups are bound on a fake kernel, see nflog_peer_create(),
+ * which logs the traffic itself, so neither rules nor privileges are needed.
+ * -C times a burst of configuration requests before receiving:
+ *
+ *	nf-log-bench -k -g 1 -r 500000 -C 100000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libmnl/libmnl.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+
+#define LAT_BUCKETS	32
+#define GROUPS_MAX	64
+#define RECV_BUFSIZ	65536
+
+#define BENCH_MAGIC	0x6e666c62	/* "nflb" */
+
+/* what the generator puts at the start of the UDP payload */
+struct bench_hdr {
+	uint32_t	magic;
+	uint32_t	pad;
+	uint64_t	seq;
+	uint64_t	sent_ns;	/* CLOCK_MONOTONIC */
+};
+
+struct group {
+	unsigned int	id;
+	uint64_t	packets;
+	uint64_t	lost;		/* gaps in NFULA_SEQ */
+	uint32_t	next_seq;
+	int		seq_seen;
+};
+
+struct bench {
+	struct group	groups[GROUPS_MAX];
+	unsigned int	ngroups;
+	uint64_t	packets;
+	uint64_t	stamped;
+	uint64_t	lat_sum;	/* in microseconds */
+	uint64_t	lat_max;
+	uint64_t	lat_hist[LAT_BUCKETS];	/* log2 of microseconds */
+	uint64_t	peer_logged;	/* by the fake kernel, see -k */
+};
+
+struct gen {
+	struct sockaddr_in	dst;
+	unsigned int		ports;
+	unsigned int		rate;	/* datagrams per second, 0 for no limit */
+	unsigned int		len;
+	uint64_t		sent;
+	uint64_t		failed;
+};
+
+static struct bench b;
+static struct gen gen = {
+	.len		= 64,
+};
+static volatile int gen_stop;
+static pthread_t gen_thread;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void account_latency(uint64_t lat)
+{
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS - 1 && (1ULL << i) <= lat; i++)
+		;
+
+	b.stamped++;
+	b.lat_sum += lat;
+	b.lat_hist[i]++;
+	if (lat > b.lat_max)
+		b.lat_max = lat;
+}
+
+/* the delay since the generator sent the packet, -1 if it did not send it */
+static int64_t payload_latency(const char *payload, int len)
+{
+	struct bench_hdr hdr;
+	struct nflog_pkt pkt;
+	size_t off;
+
+	if (len <= 0 || nflog_payload_parse(payload, len, AF_INET, &pkt) < 0 ||
+	    !(pkt.flags & NFLOG_PKT_F_L4) || pkt.l4proto != IPPROTO_UDP)
+		return -1;
+
+	off = pkt.l4_offset + 8;
+	if (off + sizeof(hdr) > (size_t)len)
+		return -1;
+
+	memcpy(&hdr, payload + off, sizeof(hdr));
+	if (hdr.magic != BENCH_MAGIC)
+		return -1;
+
+	return (now_ns() - hdr.sent_ns) / 1000;
+}
+
+static void account(struct group *g, const uint32_t *seq, const char *payload,
+		    int len, const struct timeval *tv)
+{
+	struct timeval now;
+	int64_t lat;
+
+	b.packets++;
+	g->packets++;
+
+	/* only set if the group was configured with NFULNL_CFG_F_SEQ */
+	if (seq) {
+		if (g->seq_seen && *seq != g->next_seq)
+			g->lost += (uint32_t)(*seq - g->next_seq);
+		g->seq_seen = 1;
+		g->next_seq = *seq + 1;
+	}
+
+	lat = payload_latency(payload, len);
+	if (lat < 0 && tv) {
+		/* only set if something asked the kernel to timestamp */
+		gettimeofday(&now, NULL);
+		lat = (now.tv_sec - tv->tv_sec) * 1000000 +
+		      now.tv_usec - tv->tv_usec;
+		if (lat < 0)
+			lat = 0;
+	}
+	if (lat >= 0)
+		account_latency(lat);
+}
+
+static int cb(struct nflog_g_handle *gh, struct nfgenmsg *nfmsg,
+	      struct nflog_data *nfa, void *data)
+{
+	struct timeval tv;
+	char *payload;
+	uint32_t seq;
+	int len;
+
+	len = nflog_get_payload(nfa, &payload);
+	account(data, nflog_get_seq(nfa, &seq) == 0 ? &seq : NULL, payload, len,
+		nflog_get_timestamp(nfa, &tv) == 0 ? &tv : NULL);
+
+	return 0;
+}
+
+static struct group *find_group(unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < b.ngroups; i++) {
+		if (b.groups[i].id == id)
+			return &b.groups[i];
+	}
+	return NULL;
+}
+
+static int mnl_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *attrs[NFULA_MAX + 1] = {};
+	struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+	struct nfulnl_msg_packet_timestamp *ts;
+	struct timeval tv;
+	struct group *g;
+	uint32_t seq;
+
+	g = find_group(ntohs(nfg->res_id));
+	if (!g || nflog_nlmsg_parse(nlh, attrs) != MNL_CB_OK)
+		return MNL_CB_OK;
+
+	if (attrs[NFULA_SEQ])
+		seq = ntohl(mnl_attr_get_u32(attrs[NFULA_SEQ]));
+	if (attrs[NFULA_TIMESTAMP]) {
+		ts = mnl_attr_get_payload(attrs[NFULA_TIMESTAMP]);
+		tv.tv_sec = be64toh(ts->sec);
+		tv.tv_usec = be64toh(ts->usec);
+	}
+
+	account(g, attrs[NFULA_SEQ] ? &seq : NULL,
+		attrs[NFULA_PAYLOAD] ?
+			mnl_attr_get_payload(attrs[NFULA_PAYLOAD]) : NULL,
+		attrs[NFULA_PAYLOAD] ?
+			mnl_attr_get_payload_len(attrs[NFULA_PAYLOAD]) : -1,
+		attrs[NFULA_TIMESTAMP] ? &tv : NULL);
+
+	return MNL_CB_OK;
+}
+
+static void *gen_run(void *data)
+{
+	struct bench_hdr hdr = {
+		.magic	= BENCH_MAGIC,
+	};
+	struct sockaddr_in dst = gen.dst;
+	uint64_t start = now_ns(), due;
+	char *buf;
+	int fd;
+
+	buf = calloc(1, gen.len);
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (!buf || fd < 0) {
+		perror("generator");
+		return NULL;
+	}
+
+	while (!gen_stop) {
+		if (gen.rate) {
+			due = (now_ns() - start) * gen.rate / 1000000000ULL;
+			if (hdr.seq >= due) {
+				usleep(100);
+				continue;
+			}
+		}
+
+		dst.sin_port = htons(ntohs(gen.dst.sin_port) +
+				     hdr.seq % gen.ports);
+		hdr.sent_ns = now_ns();
+		memcpy(buf, &hdr, sizeof(hdr));
+
+		if (sendto(fd, buf, gen.len, 0, (struct sockaddr *)&dst,
+			   sizeof(dst)) < 0)
+			gen.failed++;
+		else
+			gen.sent++;
+		hdr.seq++;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int gen_parse(const char *arg)
+{
+	char addr[INET_ADDRSTRLEN];
+	const char *colon = strchr(arg, ':');
+
+	if (!colon || colon - arg >= (int)sizeof(addr))
+		return -1;
+
+	memcpy(addr, arg, colon - arg);
+	addr[colon - arg] = '\0';
+
+	gen.dst.sin_family = AF_INET;
+	gen.dst.sin_port = htons(atoi(colon + 1));
+	return inet_pton(AF_INET, addr, &gen.dst.sin_addr) == 1 ? 0 : -1;
+}
+
+/* start sending once the groups are bound, so the first packets are seen */
+static int gen_start(void)
+{
+	if (!gen.dst.sin_family)
+		return 0;
+
+	gen.ports = b.ngroups;
+	if (pthread_create(&gen_thread, NULL, gen_run, NULL) != 0) {
+		perror("pthread_create");
+		return -1;
+	}
+	return 0;
+}
+
+/* and keep sending until the receive loop is done, so it does not block */
+static void gen_join(void)
+{
+	if (!gen.dst.sin_family)
+		return;
+
+	gen_stop = 1;
+	pthread_join(gen_thread, NULL);
+}
+
+static uint64_t lat_percentile(unsigned int pct)
+{
+	uint64_t seen = 0, want = (b.stamped * pct + 99) / 100;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += b.lat_hist[i];
+		if (seen >= want)
+			return i ? 1ULL << i : 0;
+	}
+	return b.lat_max;
+}
+
+static void print_hist(const char *what, const uint64_t *hist)
+{
+	int i;
+
+	printf("%-12s", what);
+	for (i = 0; i < NFLOG_HIST_BUCKETS; i++) {
+		if (hist[i])
+			printf(" <=%llu:%llu", 1ULL << i,
+			       (unsigned long long)hist[i]);
+	}
+	putchar('\n');
+}
+
+static double tv_sec(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+struct config {
+	enum nflog_recv_mode	mode;
+	unsigned int		spin_us;
+	unsigned int		qthresh;
+	unsigned int		timeout;
+	unsigned int		seconds;
+	unsigned int		storm;	/* configuration requests to time */
+	const char		*cpus;
+	struct nflog_peer	*peer;	/* instead of the kernel */
+};
+
+static double elapsed_since(uint64_t start)
+{
+	return (now_ns() - start) / 1e9;
+}
+
+/* time a burst of configuration requests, eg. from a reconfiguring daemon */
+static void config_storm(struct nflog_g_handle **gh, unsigned int count)
+{
+	uint64_t start = now_ns();
+	unsigned int i;
+	double secs;
+
+	for (i = 0; i < count; i++) {
+		if (nflog_set_mode(gh[i % b.ngroups], NFULNL_COPY_PACKET,
+				   0xffff - (i & 0xff)) < 0) {
+			perror("nflog_set_mode");
+			break;
+		}
+	}
+	secs = elapsed_since(start);
+
+	for (i = 0; i < b.ngroups; i++)
+		nflog_set_mode(gh[i], NFULNL_COPY_PACKET, 0xffff);
+
+	printf("config:     %u requests in %.3f s (%.0f/s)\n", count, secs,
+	       count / secs);
+}
+
+static int run_lib(const struct config *cfg, struct nflog_stats *st,
+		   double *elapsed)
+{
+	struct nflog_g_handle *gh[GROUPS_MAX];
+	struct timeval tmo = { .tv_usec = 100000 };
+	struct nflog_handle *h;
+	unsigned int i;
+	uint64_t start;
+	struct nflog_peer_group pg;
+	int ret;
+
+	h = cfg->peer ? nflog_open_peer(cfg->peer) : nflog_open();
+	if (!h) {
+		perror("nflog_open");
+		return -1;
+	}
+
+	if (cfg->cpus && nflog_place_cpus(h, cfg->cpus) < 0) {
+		perror("nflog_place_cpus");
+		return -1;
+	}
+
+	for (i = 0; i < b.ngroups; i++) {
+		gh[i] = nflog_bind_group(h, b.groups[i].id);
+		if (!gh[i]) {
+			perror("nflog_bind_group");
+			return -1;
+		}
+
+		if (nflog_set_mode(gh[i], NFULNL_COPY_PACKET, 0xffff) < 0 ||
+		    nflog_set_flags(gh[i], NFULNL_CFG_F_SEQ) < 0 ||
+		    (cfg->qthresh &&
+		     nflog_set_qthresh(gh[i], cfg->qthresh) < 0) ||
+		    (cfg->timeout &&
+		     nflog_set_timeout(gh[i], cfg->timeout) < 0)) {
+			perror("nflog_set_mode");
+			return -1;
+		}
+
+		nflog_callback_register(gh[i], &cb, &b.groups[i]);
+	}
+
+	if (cfg->storm)
+		config_storm(gh, cfg->storm);
+
+	for (i = 0; cfg->peer && i < b.ngroups; i++) {
+		if (nflog_peer_set_traffic(cfg->peer, b.groups[i].id,
+					   gen.rate ? gen.rate : 1000000,
+					   NULL, gen.len) < 0) {
+			perror("nflog_peer_set_traffic");
+			return -1;
+		}
+	}
+
+	if (nflog_set_recv_mode(h, cfg->mode, cfg->spin_us) < 0) {
+		perror("nflog_set_recv_mode");
+		return -1;
+	}
+
+	/* so that the loop notices the end without traffic */
+	setsockopt(nflog_fd(h), SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+	if (!cfg->peer && gen_start() < 0)
+		return -1;
+
+	start = now_ns();
+	do {
+		if (cfg->peer)
+			ret = nflog_peer_process(h);
+		else
+			ret = nflog_process(h);
+		if (ret < 0 && errno != ENOBUFS && errno != EAGAIN) {
+			perror("nflog_process");
+			break;
+		}
+		*elapsed = elapsed_since(start);
+	} while (*elapsed < cfg->seconds);
+
+	if (!cfg->peer)
+		gen_join();
+	nflog_get_stats(h, st);
+
+	for (i = 0; cfg->peer && i < b.ngroups; i++) {
+		if (nflog_peer_get_group(cfg->peer, b.groups[i].id, &pg) == 0)
+			b.peer_logged += pg.messages + pg.dropped;
+	}
+
+	for (i = 0; i < b.ngroups; i++)
+		nflog_unbind_group(gh[i]);
+	nflog_close(h);
+
+	return 0;
+}
+
+static int mnl_cfg(struct mnl_socket *nl, uint16_t gnum, uint8_t cmd,
+		   const struct config *cfg)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, AF_INET, gnum);
+	if (cmd) {
+		if (nflog_attr_put_cfg_cmd(nlh, cmd) < 0)
+			return -1;
+	} else {
+		if (nflog_attr_put_cfg_mode(nlh, NFULNL_COPY_PACKET, 0xffff) < 0)
+			return -1;
+		mnl_attr_put_u16(nlh, NFULA_CFG_FLAGS, htons(NFULNL_CFG_F_SEQ));
+		if (cfg->qthresh)
+			mnl_attr_put_u32(nlh, NFULA_CFG_QTHRESH,
+					 htonl(cfg->qthresh));
+		if (cfg->timeout)
+			mnl_attr_put_u32(nlh, NFULA_CFG_TIMEOUT,
+					 htonl(cfg->timeout));
+	}
+
+	return mnl_socket_sendto(nl, nlh, nlh->nlmsg_len);
+}
+
+static int run_mnl(const struct config *cfg, struct nflog_stats *st,
+		   double *elapsed)
+{
+	struct timeval tmo = { .tv_usec = 100000 };
+	struct mnl_socket *nl;
+	unsigned int i, portid;
+	uint64_t start;
+	char *buf;
+	int ret;
+
+	buf = malloc(RECV_BUFSIZ);
+	if (!buf) {
+		perror("malloc");
+		return -1;
+	}
+
+	nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (nl == NULL) {
+		perror("mnl_socket_open");
+		return -1;
+	}
+
+	if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		perror("mnl_socket_bind");
+		return -1;
+	}
+	portid = mnl_socket_get_portid(nl);
+
+	for (i = 0; i < b.ngroups; i++) {
+		if (mnl_cfg(nl, b.groups[i].id, NFULNL_CFG_CMD_BIND, cfg) < 0 ||
+		    mnl_cfg(nl, b.groups[i].id, 0, cfg) < 0) {
+			fprintf(stderr, "group %u: %s\n", b.groups[i].id,
+				strerror(errno));
+			return -1;
+		}
+	}
+
+	setsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_RCVTIMEO, &tmo,
+		   sizeof(tmo));
+
+	if (gen_start() < 0)
+		return -1;
+
+	start = now_ns();
+	do {
+		ret = mnl_socket_recvfrom(nl, buf, RECV_BUFSIZ);
+		if (ret < 0) {
+			if (errno == ENOBUFS) {
+				st->enobufs++;
+			} else if (errno != EAGAIN) {
+				perror("mnl_socket_recvfrom");
+				break;
+			}
+		} else {
+			st->datagrams++;
+			nflog_nlmsg_account(st, buf, ret);
+			if (mnl_cb_run(buf, ret, 0, portid, mnl_cb, NULL) < 0)
+				perror("mnl_cb_run");
+		}
+		*elapsed = elapsed_since(start);
+	} while (*elapsed < cfg->seconds);
+
+	gen_join();
+	for (i = 0; i < b.ngroups; i++)
+		mnl_cfg(nl, b.groups[i].id, NFULNL_CFG_CMD_UNBIND, cfg);
+	mnl_socket_close(nl);
+	free(buf);
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-g group]... [-p lib|mnl] [-m block|busy] "
+			"[-s spin_us] [-t seconds] [-c cpulist] [-q qthresh] "
+			"[-T timeout] [-C requests] [-k | -G addr:port] "
+			"[-r rate] [-l len]\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct config cfg = {
+		.mode		= NFLOG_RECV_BLOCK,
+		.spin_us	= 50,
+		.seconds	= 10,
+	};
+	struct nflog_stats st = {};
+	struct rusage ru;
+	double elapsed = 0;
+	int opt, use_mnl = 0, ret;
+	uint64_t lost = 0;
+	unsigned int i;
+
+	while ((opt = getopt(argc, argv, "g:p:m:s:t:c:q:T:C:kG:r:l:")) != -1) {
+		switch (opt) {
+		case 'g':
+			if (b.ngroups == GROUPS_MAX)
+				usage(argv[0]);
+			b.groups[b.ngroups++].id = atoi(optarg);
+			break;
+		case 'p':
+			if (strcmp(optarg, "lib") == 0)
+				use_mnl = 0;
+			else if (strcmp(optarg, "mnl") == 0)
+				use_mnl = 1;
+			else
+				usage(argv[0]);
+			break;
+		case 'm':
+			if (strcmp(optarg, "block") == 0)
+				cfg.mode = NFLOG_RECV_BLOCK;
+			else if (strcmp(optarg, "busy") == 0)
+				cfg.mode = NFLOG_RECV_BUSY_POLL;
+			else
+				usage(argv[0]);
+			break;
+		case 's':
+			cfg.spin_us = atoi(optarg);
+			break;
+		case 't':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'c':
+			cfg.cpus = optarg;
+			break;
+		case 'q':
+			cfg.qthresh = atoi(optarg);
+			break;
+		case 'T':
+			cfg.timeout = atoi(optarg);
+			break;
+		case 'C':
+			cfg.storm = atoi(optarg);
+			break;
+		case 'k':
+			cfg.peer = nflog_peer_create();
+			if (!cfg.peer) {
+				perror("nflog_peer_create");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'G':
+			if (gen_parse(optarg) < 0)
+				usage(argv[0]);
+			break;
+		case 'r':
+			gen.rate = atoi(optarg);
+			break;
+		case 'l':
+			gen.len = atoi(optarg);
+			if (gen.len < sizeof(struct bench_hdr))
+				gen.len = sizeof(struct bench_hdr);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (b.ngroups == 0)
+		b.groups[b.ngroups++].id = 1;
+
+	if (cfg.peer && (use_mnl || gen.dst.sin_family))
+		usage(argv[0]);
+
+	if (use_mnl)
+		ret = run_mnl(&cfg, &st, &elapsed);
+	else
+		ret = run_lib(&cfg, &st, &elapsed);
+	if (ret < 0)
+		exit(EXIT_FAILURE);
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("path:       %s\n", use_mnl ? "libmnl" : "nflog_process");
+	if (!use_mnl) {
+		printf("mode:       %s (spin %u us)\n",
+		       cfg.mode == NFLOG_RECV_BUSY_POLL ? "busy-poll" : "block",
+		       cfg.spin_us);
+	}
+	printf("elapsed:    %.2f s\n", elapsed);
+	printf("packets:    %llu (%.0f/s)\n",
+	       (unsigned long long)b.packets, b.packets / elapsed);
+	for (i = 0; i < b.ngroups; i++) {
+		printf("group %-5u %llu packets, %llu lost\n", b.groups[i].id,
+		       (unsigned long long)b.groups[i].packets,
+		       (unsigned long long)b.groups[i].lost);
+		lost += b.groups[i].lost;
+	}
+	printf("lost:       %llu (%.3f%%)\n", (unsigned long long)lost,
+	       b.packets + lost ? 100.0 * lost / (b.packets + lost) : 0.0);
+	if (cfg.peer) {
+		printf("generated:  %llu (%.0f/s) by the fake kernel\n",
+		       (unsigned long long)b.peer_logged,
+		       b.peer_logged / elapsed);
+	} else if (gen.dst.sin_family) {
+		printf("generated:  %llu (%.0f/s), %llu send errors\n",
+		       (unsigned long long)gen.sent, gen.sent / elapsed,
+		       (unsigned long long)gen.failed);
+	}
+	printf("datagrams:  %llu in %llu batches\n",
+	       (unsigned long long)st.datagrams,
+	       (unsigned long long)st.batches);
+	if (st.datagrams) {
+		printf("batching:   %.1f messages, %llu bytes per datagram\n",
+		       (double)st.messages / st.datagrams,
+		       (unsigned long long)(st.bytes / st.datagrams));
+	}
+	print_hist("messages:", st.msgs_hist);
+	print_hist("bytes:", st.bytes_hist);
+	printf("cpu:        %.2f s user, %.2f s system\n",
+	       tv_sec(&ru.ru_utime), tv_sec(&ru.ru_stime));
+	printf("waiting:    %llu spins, %llu yields, %llu sleeps\n",
+	       (unsigned long long)st.spins, (unsigned long long)st.yields,
+	       (unsigned long long)st.sleeps);
+	printf("overruns:   %llu\n", (unsigned long long)st.enobufs);
+	printf("truncated:  %llu\n", (unsigned long long)st.truncated);
+	if (b.stamped) {
+		printf("latency:    avg %llu us, p50 <%llu us, p99 <%llu us, "
+		       "max %llu us\n",
+		       (unsigned long long)(b.lat_sum / b.stamped),
+		       (unsigned long long)lat_percentile(50),
+		       (unsigned long long)lat_percentile(99),
+		       (unsigned long long)b.lat_max);
+	} else {
+		printf("latency:    no timestamps\n");
+	}
+
+	return EXIT_SUCCESS;
+}
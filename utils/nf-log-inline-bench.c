@@ -0,0 +1,216 @@
+/* nf-log-inline-bench: compare the exported and the inline accessors
+ *
+ * Builds a datagram of log messages carrying the usual attributes, hands it
+ * to nflog_handle_packet() over and over, and in the callback reads every
+ * field of the message, once with the nflog_get_*() functions and once with
+ * their counterparts in libnetfilter_log_inline.h. No privileges are needed,
+ * nothing is bound in the kernel:
+ *
+ *	nf-log-inline-bench -n 100000 -r 10
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+
+#include <libmnl/libmnl.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+#include <libnetfilter_log/libnetfilter_log_inline.h>
+
+#define GROUP		1
+#define MSGS		16	/* per datagram */
+
+struct bench {
+	unsigned int	reps;		/* reads of each message, per variant */
+	uint64_t	lib_ns;
+	uint64_t	inline_ns;
+	uint64_t	lib_sum;
+	uint64_t	inline_sum;
+	uint64_t	messages;
+};
+
+static struct bench b;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the compiler is to read the message again on every iteration */
+#define BARRIER(p)	__asm__ __volatile__("" : : "r"(p) : "memory")
+
+/* what a consumer typically reads: the same for both variants */
+#define READ_ALL(get, nfa, sum)						\
+do {									\
+	struct nfulnl_msg_packet_hdr *ph;				\
+	struct timeval tv;						\
+	uint32_t v;							\
+	char *p;							\
+									\
+	ph = get##_msg_packet_hdr(nfa);					\
+	sum += ph ? ph->hook : 0;					\
+	sum += get##_nfmark(nfa);					\
+	sum += get##_indev(nfa) + get##_outdev(nfa);			\
+	sum += get##_physindev(nfa) + get##_physoutdev(nfa);		\
+	sum += get##_hwtype(nfa) + get##_msg_packet_hwhdrlen(nfa);	\
+	if (get##_timestamp(nfa, &tv) == 0)				\
+		sum += tv.tv_usec;					\
+	if (get##_uid(nfa, &v) == 0)					\
+		sum += v;						\
+	if (get##_gid(nfa, &v) == 0)					\
+		sum += v;						\
+	if (get##_seq(nfa, &v) == 0)					\
+		sum += v;						\
+	sum += get##_payload(nfa, &p);					\
+	p = get##_prefix(nfa);						\
+	sum += p ? p[0] : 0;						\
+} while (0)
+
+static int cb(struct nflog_g_handle *gh, struct nfgenmsg *nfmsg,
+	      struct nflog_data *nfa, void *data)
+{
+	uint64_t start, mid, end;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < b.reps; i++) {
+		BARRIER(nfa);
+		READ_ALL(nflog_get, nfa, b.lib_sum);
+	}
+	mid = now_ns();
+	for (i = 0; i < b.reps; i++) {
+		BARRIER(nfa);
+		READ_ALL(nflog_inline_get, nfa, b.inline_sum);
+	}
+	end = now_ns();
+
+	b.lib_ns += mid - start;
+	b.inline_ns += end - mid;
+	b.messages++;
+	return 0;
+}
+
+/* a datagram as the kernel sends it for MSGS packets logged to GROUP */
+static size_t build(char *buf, size_t size)
+{
+	struct nfulnl_msg_packet_hdr ph = {
+		.hw_protocol	= htons(0x0800),
+		.hook		= 1,
+	};
+	struct nfulnl_msg_packet_timestamp ts = {
+		.sec		= htobe64(1700000000),
+	};
+	struct nfulnl_msg_packet_hw hw = {
+		.hw_addrlen	= htons(6),
+	};
+	static const char hwhdr[14] = { 0x02, 0, 0, 0, 0, 1, 0x02, 0, 0, 0, 0,
+					2, 0x08, 0x00 };
+	char payload[128] = { 0x45 };
+	struct nlmsghdr *nlh;
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < MSGS; i++) {
+		if (len + MNL_SOCKET_BUFFER_SIZE > size)
+			break;
+
+		nlh = nflog_nlmsg_put_header(buf + len, NFULNL_MSG_PACKET,
+					     AF_INET, GROUP);
+		nlh->nlmsg_flags = NLM_F_MULTI;
+		ts.usec = htobe64(i);
+		mnl_attr_put(nlh, NFULA_PACKET_HDR, sizeof(ph), &ph);
+		mnl_attr_put_u32(nlh, NFULA_MARK, htonl(i));
+		mnl_attr_put(nlh, NFULA_TIMESTAMP, sizeof(ts), &ts);
+		mnl_attr_put_u32(nlh, NFULA_IFINDEX_INDEV, htonl(2));
+		mnl_attr_put_u32(nlh, NFULA_IFINDEX_PHYSINDEV, htonl(3));
+		mnl_attr_put(nlh, NFULA_HWADDR, sizeof(hw), &hw);
+		mnl_attr_put_u16(nlh, NFULA_HWTYPE, htons(1));
+		mnl_attr_put_u16(nlh, NFULA_HWLEN, htons(sizeof(hwhdr)));
+		mnl_attr_put(nlh, NFULA_HWHEADER, sizeof(hwhdr), hwhdr);
+		mnl_attr_put_strz(nlh, NFULA_PREFIX, "inline-bench");
+		mnl_attr_put_u32(nlh, NFULA_UID, htonl(1000));
+		mnl_attr_put_u32(nlh, NFULA_GID, htonl(1000));
+		mnl_attr_put_u32(nlh, NFULA_SEQ, htonl(i));
+		mnl_attr_put(nlh, NFULA_PAYLOAD, sizeof(payload), payload);
+		len += nlh->nlmsg_len;
+	}
+	return len;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n datagrams] [-r reads]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static char buf[MSGS * MNL_SOCKET_BUFFER_SIZE];
+	unsigned int i, datagrams = 100000;
+	struct nflog_g_handle *gh;
+	struct nflog_handle *h;
+	int opt;
+	size_t len;
+
+	b.reps = 10;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+		switch (opt) {
+		case 'n':
+			datagrams = atoi(optarg);
+			break;
+		case 'r':
+			b.reps = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!nflog_inline_usable()) {
+		fprintf(stderr, "the library has data layout %d, this was built "
+				"for %d\n", nflog_data_layout(),
+			NFLOG_DATA_LAYOUT);
+		exit(EXIT_FAILURE);
+	}
+
+	h = nflog_open();
+	if (!h) {
+		perror("nflog_open");
+		exit(EXIT_FAILURE);
+	}
+
+	/* nothing is bound, the datagrams are handed over by hand */
+	gh = nflog_adopt_group(h, GROUP);
+	if (!gh) {
+		perror("nflog_adopt_group");
+		exit(EXIT_FAILURE);
+	}
+	nflog_callback_register(gh, &cb, NULL);
+
+	len = build(buf, sizeof(buf));
+	for (i = 0; i < datagrams; i++)
+		nflog_handle_packet(h, buf, len);
+
+	if (b.lib_sum != b.inline_sum) {
+		fprintf(stderr, "the accessors disagree\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("messages:   %llu, read %u times each\n",
+	       (unsigned long long)b.messages, b.reps);
+	printf("exported:   %.1f ns per message\n",
+	       (double)b.lib_ns / (b.messages * b.reps));
+	printf("inline:     %.1f ns per message\n",
+	       (double)b.inline_ns / (b.messages * b.reps));
+	printf("speedup:    x%.2f\n", (double)b.lib_ns / b.inline_ns);
+
+	nflog_close(h);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,287 @@
+/* nf-log-mt-bench: run one handle per thread and check they do not interfere
+ *
+ * Every thread opens its own handle, binds its own group (the first one
+ * plus the thread number), receives for a while and, with -C, sends a
+ * configuration request every so many datagrams. It reports the rate of
+ * every thread and of all of them, and checks that each callback only saw
+ * the messages of its own group, in sequence, and that nflog_errno kept
+ * the value its thread gave it.
+ *
+ * With -k, every thread runs against its own fake kernel, see
+ * nflog_peer_create(), so neither rules nor privileges are needed:
+ *
+ *	nf-log-mt-bench -k -w 8 -c -C 1000
+ *
+ * Otherwise, log traffic to the groups, eg. with nf-log-bench-netns.sh.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <libnetfilter_log/libnetfilter_log.h>
+
+#define WORKER_MAX	256
+
+struct config {
+	unsigned int	group;		/* of the first worker */
+	unsigned int	seconds;
+	unsigned int	rate;		/* per worker, for the fake kernel */
+	unsigned int	len;
+	unsigned int	storm;		/* datagrams between config requests */
+	int		pin;
+	int		fake;
+};
+
+struct worker {
+	unsigned int		id;
+	pthread_t		thread;
+	const struct config	*cfg;
+	struct nflog_g_handle	*gh;
+	uint64_t		messages;
+	uint64_t		datagrams;
+	uint64_t		lost;
+	uint64_t		misrouted;	/* of another group */
+	uint64_t		requests;
+	uint32_t		next_seq;
+	int			seen;
+	int			errno_ok;
+	int			failed;
+	double			elapsed;
+};
+
+static struct worker workers[WORKER_MAX];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cb(struct nflog_g_handle *gh, struct nfgenmsg *nfmsg,
+	      struct nflog_data *nfa, void *data)
+{
+	struct worker *w = data;
+	uint32_t seq;
+
+	w->messages++;
+	if (gh != w->gh ||
+	    ntohs(nfmsg->res_id) != w->cfg->group + w->id) {
+		w->misrouted++;
+		return 0;
+	}
+
+	if (nflog_get_seq(nfa, &seq) == 0) {
+		if (w->seen && seq != w->next_seq)
+			w->lost += seq - w->next_seq;
+		w->next_seq = seq + 1;
+		w->seen = 1;
+	}
+	return 0;
+}
+
+static int worker_setup(struct worker *w, struct nflog_handle *h,
+			struct nflog_peer *peer)
+{
+	const struct config *cfg = w->cfg;
+	struct timeval tmo = { .tv_usec = 100000 };
+	char cpu[16];
+
+	if (cfg->pin) {
+		snprintf(cpu, sizeof(cpu), "%ld",
+			 w->id % sysconf(_SC_NPROCESSORS_ONLN));
+		if (nflog_place_cpus(h, cpu) < 0)
+			return -1;
+	}
+
+	w->gh = nflog_bind_group(h, cfg->group + w->id);
+	if (!w->gh)
+		return -1;
+
+	if (nflog_set_mode(w->gh, NFULNL_COPY_PACKET, 0xffff) < 0 ||
+	    nflog_set_flags(w->gh, NFULNL_CFG_F_SEQ) < 0)
+		return -1;
+	nflog_callback_register(w->gh, &cb, w);
+
+	/* wake up now and then to check whether the run is over */
+	setsockopt(nflog_fd(h), SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+	if (!peer)
+		return 0;
+
+	return nflog_peer_set_traffic(peer, cfg->group + w->id, cfg->rate,
+				      NULL, cfg->len);
+}
+
+static void *worker_run(void *data)
+{
+	struct worker *w = data;
+	const struct config *cfg = w->cfg;
+	struct nflog_peer *peer = NULL;
+	struct nflog_handle *h;
+	uint64_t start, since = 0;
+	int ret;
+
+	/* each thread has its own, nobody else may change it */
+	nflog_errno = 1000 + w->id;
+
+	if (cfg->fake) {
+		peer = nflog_peer_create();
+		if (!peer) {
+			perror("nflog_peer_create");
+			w->failed = 1;
+			return NULL;
+		}
+	}
+
+	h = peer ? nflog_open_peer(peer) : nflog_open();
+	if (!h || worker_setup(w, h, peer) < 0) {
+		perror("worker");
+		w->failed = 1;
+		goto out;
+	}
+
+	start = now_ns();
+	do {
+		ret = peer ? nflog_peer_process(h) : nflog_process(h);
+		if (ret < 0 && errno != ENOBUFS && errno != EAGAIN) {
+			perror("nflog_process");
+			w->failed = 1;
+			break;
+		}
+		if (ret > 0) {
+			w->datagrams += ret;
+			since += ret;
+		}
+
+		/* configuration requests race the traffic of other threads */
+		if (cfg->storm && since >= cfg->storm) {
+			since = 0;
+			w->requests++;
+			if (nflog_set_qthresh(w->gh, 100 + w->requests % 2) < 0) {
+				perror("nflog_set_qthresh");
+				w->failed = 1;
+				break;
+			}
+		}
+		w->elapsed = (now_ns() - start) / 1e9;
+	} while (w->elapsed < cfg->seconds);
+
+	nflog_unbind_group(w->gh);
+out:
+	if (h)
+		nflog_close(h);
+	if (peer)
+		nflog_peer_destroy(peer);
+
+	w->errno_ok = nflog_errno == (int)(1000 + w->id);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-w workers] [-g first_group] [-t seconds] "
+			"[-c] [-C datagrams] [-k [-r rate] [-l len]]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct config cfg = {
+		.group		= 1,
+		.seconds	= 10,
+		.rate		= 1000000,
+		.len		= 64,
+	};
+	uint64_t messages = 0, lost = 0, misrouted = 0, requests = 0;
+	unsigned int i, nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt, failed = 0, errno_ok = 1;
+	double elapsed = 0;
+
+	while ((opt = getopt(argc, argv, "w:g:t:cC:kr:l:")) != -1) {
+		switch (opt) {
+		case 'w':
+			nworkers = atoi(optarg);
+			break;
+		case 'g':
+			cfg.group = atoi(optarg);
+			break;
+		case 't':
+			cfg.seconds = atoi(optarg);
+			break;
+		case 'c':
+			cfg.pin = 1;
+			break;
+		case 'C':
+			cfg.storm = atoi(optarg);
+			break;
+		case 'k':
+			cfg.fake = 1;
+			break;
+		case 'r':
+			cfg.rate = atoi(optarg);
+			break;
+		case 'l':
+			cfg.len = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (nworkers == 0 || nworkers > WORKER_MAX ||
+	    cfg.group + nworkers > 65536)
+		usage(argv[0]);
+
+	for (i = 0; i < nworkers; i++) {
+		workers[i].id = i;
+		workers[i].cfg = &cfg;
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i]) != 0) {
+			fprintf(stderr, "cannot start worker %u\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		struct worker *w = &workers[i];
+
+		pthread_join(w->thread, NULL);
+		printf("worker %-3u group %-5u %llu messages (%.0f/s), "
+		       "%llu lost, %llu requests%s\n", i, cfg.group + i,
+		       (unsigned long long)w->messages,
+		       w->elapsed ? w->messages / w->elapsed : 0,
+		       (unsigned long long)w->lost,
+		       (unsigned long long)w->requests,
+		       w->failed ? ", failed" : "");
+
+		messages += w->messages;
+		lost += w->lost;
+		misrouted += w->misrouted;
+		requests += w->requests;
+		failed |= w->failed;
+		errno_ok &= w->errno_ok;
+		if (w->elapsed > elapsed)
+			elapsed = w->elapsed;
+	}
+
+	printf("workers:    %u on %s\n", nworkers,
+	       cfg.fake ? "fake kernels" : "the kernel");
+	printf("messages:   %llu (%.0f/s)\n", (unsigned long long)messages,
+	       elapsed ? messages / elapsed : 0);
+	printf("lost:       %llu\n", (unsigned long long)lost);
+	printf("requests:   %llu\n", (unsigned long long)requests);
+	printf("misrouted:  %llu\n", (unsigned long long)misrouted);
+	printf("errno:      %s\n", errno_ok ? "per thread" : "shared");
+
+	return failed || misrouted || !errno_ok ? EXIT_FAILURE : EXIT_SUCCESS;
+}
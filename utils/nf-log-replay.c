@@ -0,0 +1,342 @@
+/* nf-log-replay: feed captured nflog datagrams back to a consumer
+ *
+ * Reads a capture written by nflog_set_capture() or by nf-log -f capture and
+ * hands every datagram to nflog_handle_packet(), or to the libmnl parser,
+ * as if it had just been received: at the pace it arrived, -s times faster,
+ * or as fast as possible with -s 0. No privileges are needed, nothing is
+ * bound in the kernel. It reports the rate the consumer kept up with and,
+ * when paced, how far behind the original schedule it fell:
+ *
+ *	nf-log -f capture -o incident.nflc 1
+ *	nf-log-replay -s 0 -n 10 incident.nflc
+ *	nf-log-replay -p mnl -s 4 -x incident.nflc
+ *
+ * With -x, every message is also formatted as XML, as a typical logging
+ * daemon would.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include <libmnl/libmnl.h>
+#include <libnetfilter_log/libnetfilter_log.h>
+
+#define LATE_NS		1000000		/* behind schedule by more than this */
+
+struct replay {
+	int			use_mnl;
+	int			format;		/* -x */
+	double			speed;		/* 0 for as fast as possible */
+	struct nflog_handle	*h;
+	struct nflog_g_handle	*gh[65536];	/* adopted as they show up */
+	struct nflog_strbuf	fmt;		/* reused across messages */
+	uint64_t		datagrams;
+	uint64_t		messages;
+	uint64_t		bytes;
+	uint64_t		truncated;
+	uint64_t		late;
+	uint64_t		max_lag;
+	uint64_t		touched;	/* keeps the reads from going away */
+};
+
+static struct replay r;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void touch(const char *payload, int len, const char *prefix)
+{
+	r.messages++;
+	if (len > 0)
+		r.touched += payload[0] + payload[len - 1];
+	if (prefix)
+		r.touched += prefix[0];
+}
+
+static int cb(struct nflog_g_handle *gh, struct nfgenmsg *nfmsg,
+	      struct nflog_data *nfa, void *data)
+{
+	char *payload;
+	int len;
+
+	len = nflog_get_payload(nfa, &payload);
+	touch(payload, len, nflog_get_prefix(nfa));
+
+	if (r.format) {
+		r.fmt.len = 0;
+		nflog_strbuf_append_xml(&r.fmt, nfa, NFLOG_XML_ALL_EXT);
+	}
+
+	return 0;
+}
+
+static int mnl_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *attrs[NFULA_MAX + 1] = {};
+
+	if (nflog_nlmsg_parse(nlh, attrs) != MNL_CB_OK)
+		return MNL_CB_OK;
+
+	touch(attrs[NFULA_PAYLOAD] ?
+		mnl_attr_get_payload(attrs[NFULA_PAYLOAD]) : NULL,
+	      attrs[NFULA_PAYLOAD] ?
+		mnl_attr_get_payload_len(attrs[NFULA_PAYLOAD]) : -1,
+	      attrs[NFULA_PREFIX] ?
+		mnl_attr_get_str(attrs[NFULA_PREFIX]) : NULL);
+
+	if (r.format) {
+		r.fmt.len = 0;
+		nflog_nlmsg_strbuf_append(&r.fmt, nlh, attrs, NFLOG_OUTPUT_XML,
+					  NFLOG_XML_ALL_EXT);
+	}
+
+	return MNL_CB_OK;
+}
+
+/*
+ * Length of the whole messages at the start of the datagram, as nflog_process
+ * keeps of a truncated one. Groups seen for the first time are adopted.
+ */
+static size_t walk(char *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = (const struct nlmsghdr *)buf;
+	int rest = len;
+
+	while (mnl_nlmsg_ok(nlh, rest)) {
+		const struct nfgenmsg *nfg = mnl_nlmsg_get_payload(nlh);
+		uint16_t id = ntohs(nfg->res_id);
+
+		if (!r.use_mnl && !r.gh[id] &&
+		    NFNL_SUBSYS_ID(nlh->nlmsg_type) == NFNL_SUBSYS_ULOG) {
+			r.gh[id] = nflog_adopt_group(r.h, id);
+			if (!r.gh[id]) {
+				perror("nflog_adopt_group");
+				exit(EXIT_FAILURE);
+			}
+			nflog_callback_register(r.gh[id], &cb, NULL);
+		}
+		nlh = mnl_nlmsg_next(nlh, &rest);
+	}
+	return len - rest;
+}
+
+/* wait until _target_, or tell how late we are */
+static void pace(uint64_t target)
+{
+	struct timespec ts = {
+		.tv_sec		= target / 1000000000,
+		.tv_nsec	= target % 1000000000,
+	};
+	uint64_t now = now_ns();
+
+	if (now < target) {
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR)
+			;
+		return;
+	}
+
+	if (now - target > r.max_lag)
+		r.max_lag = now - target;
+	if (now - target > LATE_NS)
+		r.late++;
+}
+
+static void replay(char *buf, size_t len)
+{
+	const struct nflog_capture_rec *rec;
+	uint64_t start = now_ns(), first = 0;
+	size_t off = sizeof(struct nflog_capture_hdr), dlen;
+	char *data;
+
+	while (off + sizeof(*rec) <= len) {
+		rec = (const struct nflog_capture_rec *)(buf + off);
+		data = buf + off + sizeof(*rec);
+		if (rec->len > len - off - sizeof(*rec)) {
+			fprintf(stderr, "capture cut short at offset %zu\n", off);
+			break;
+		}
+		off += sizeof(*rec) + NFLOG_CAPTURE_ALIGN(rec->len);
+
+		if (!first)
+			first = rec->tstamp_ns;
+		if (r.speed > 0 && rec->tstamp_ns > first)
+			pace(start + (rec->tstamp_ns - first) / r.speed);
+
+		dlen = walk(data, rec->len);
+		if (rec->flags & NFLOG_CAPTURE_F_TRUNC)
+			r.truncated++;
+
+		r.datagrams++;
+		r.bytes += dlen;
+		if (r.use_mnl) {
+			if (mnl_cb_run(data, dlen, 0, 0, mnl_cb, NULL) < 0)
+				perror("mnl_cb_run");
+		} else {
+			nflog_handle_packet(r.h, data, dlen);
+		}
+	}
+}
+
+/* the time the capture spans */
+static uint64_t span(const char *buf, size_t len)
+{
+	const struct nflog_capture_rec *rec;
+	size_t off = sizeof(struct nflog_capture_hdr);
+	uint64_t first = 0, last = 0;
+
+	while (off + sizeof(*rec) <= len) {
+		rec = (const struct nflog_capture_rec *)(buf + off);
+		if (!first)
+			first = rec->tstamp_ns;
+		last = rec->tstamp_ns;
+		off += sizeof(*rec) + NFLOG_CAPTURE_ALIGN(rec->len);
+	}
+	return last - first;
+}
+
+static double tv_sec(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-p lib|mnl] [-s speed] [-n loops] [-x] "
+			"file\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct nflog_capture_hdr *hdr;
+	unsigned int i, loops = 1;
+	struct rusage ru;
+	struct stat sb;
+	double elapsed;
+	uint64_t start;
+	off_t off;
+	char *buf;
+	int opt, fd;
+
+	r.speed = 1;
+
+	while ((opt = getopt(argc, argv, "p:s:n:x")) != -1) {
+		switch (opt) {
+		case 'p':
+			if (strcmp(optarg, "lib") == 0)
+				r.use_mnl = 0;
+			else if (strcmp(optarg, "mnl") == 0)
+				r.use_mnl = 1;
+			else
+				usage(argv[0]);
+			break;
+		case 's':
+			r.speed = atof(optarg);
+			if (r.speed < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'x':
+			r.format = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	if ((size_t)sb.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not a capture\n", argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* private and writable, the parsers take non-const buffers */
+	buf = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if (buf == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	hdr = (const struct nflog_capture_hdr *)buf;
+	if (hdr->magic != NFLOG_CAPTURE_MAGIC ||
+	    hdr->version != NFLOG_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not a capture, or of another version\n",
+			argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* fault the capture in, reading it is not what we measure */
+	madvise(buf, sb.st_size, MADV_WILLNEED);
+	for (off = 0; off < sb.st_size; off += 4096)
+		r.touched += buf[off];
+
+	if (!r.use_mnl) {
+		r.h = nflog_open();
+		if (!r.h) {
+			perror("nflog_open");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		replay(buf, sb.st_size);
+	elapsed = (now_ns() - start) / 1e9;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("path:       %s\n", r.use_mnl ? "libmnl" : "nflog_handle_packet");
+	if (r.speed > 0)
+		printf("speed:      x%g of %.3f s captured\n", r.speed,
+		       span(buf, sb.st_size) / 1e9);
+	else
+		printf("speed:      as fast as possible\n");
+	printf("elapsed:    %.3f s, %u loops\n", elapsed, loops);
+	printf("datagrams:  %llu (%.0f/s), %llu truncated\n",
+	       (unsigned long long)r.datagrams, r.datagrams / elapsed,
+	       (unsigned long long)r.truncated);
+	printf("messages:   %llu (%.0f/s)\n",
+	       (unsigned long long)r.messages, r.messages / elapsed);
+	printf("bytes:      %llu (%.1f MB/s)\n",
+	       (unsigned long long)r.bytes, r.bytes / elapsed / 1e6);
+	if (r.speed == 0 && r.messages)
+		printf("per msg:    %.0f ns\n", elapsed * 1e9 / r.messages);
+	if (r.speed > 0)
+		printf("lag:        max %llu us, %llu datagrams late by more "
+		       "than %u ms\n", (unsigned long long)r.max_lag / 1000,
+		       (unsigned long long)r.late, LATE_NS / 1000000);
+	printf("cpu:        %.2f s user, %.2f s system\n",
+	       tv_sec(&ru.ru_utime), tv_sec(&ru.ru_stime));
+
+	if (r.h)
+		nflog_close(r.h);
+	nflog_strbuf_release(&r.fmt);
+	munmap(buf, sb.st_size);
+	return EXIT_SUCCESS;
+}
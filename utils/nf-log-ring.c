@@ -0,0 +1,152 @@
+/* nf-log-ring: publish an nflog group into a shared memory ring, or read it
+ *
+ * One instance binds to the group and publishes, any number of instances
+ * attach to the ring and print the records, eg.:
+ *
+ *	nf-log-ring -g 1 -n /nflog-1
+ *	nf-log-ring -r -n /nflog-1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <libnetfilter_log/libnetfilter_log.h>
+
+static int cb(struct nflog_g_handle *gh, struct nfgenmsg *nfmsg,
+	      struct nflog_data *nfa, void *data)
+{
+	return nflog_ring_publish(data, nfa);
+}
+
+static int publish(const char *name, unsigned int group, unsigned int slots,
+		   unsigned int slot_size)
+{
+	struct nflog_g_handle *gh;
+	struct nflog_handle *h;
+	struct nflog_ring *r;
+
+	r = nflog_ring_create(name, slots, slot_size);
+	if (!r) {
+		perror("nflog_ring_create");
+		return EXIT_FAILURE;
+	}
+
+	h = nflog_open();
+	if (!h) {
+		perror("nflog_open");
+		return EXIT_FAILURE;
+	}
+
+	gh = nflog_bind_group(h, group);
+	if (!gh) {
+		perror("nflog_bind_group");
+		return EXIT_FAILURE;
+	}
+
+	if (nflog_set_mode(gh, NFULNL_COPY_PACKET, slot_size) < 0) {
+		perror("nflog_set_mode");
+		return EXIT_FAILURE;
+	}
+
+	nflog_callback_register(gh, &cb, r);
+
+	while (nflog_process(h) >= 0 || errno == ENOBUFS)
+		;
+
+	perror("nflog_process");
+	nflog_ring_close(r);
+	return EXIT_FAILURE;
+}
+
+static int read_ring(const char *name)
+{
+	struct nflog_ring_rec *rec;
+	struct nflog_ring *r;
+	uint64_t lost = 0;
+	int ret;
+
+	r = nflog_ring_attach(name);
+	if (!r) {
+		perror("nflog_ring_attach");
+		return EXIT_FAILURE;
+	}
+
+	rec = malloc(nflog_ring_slot_size(r));
+	if (!rec) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	for (;;) {
+		ret = nflog_ring_read(r, rec, nflog_ring_slot_size(r));
+		if (ret < 0) {
+			perror("nflog_ring_read");
+			break;
+		}
+		if (ret == 0) {
+			usleep(1000);
+			continue;
+		}
+
+		if (nflog_ring_lost(r) != lost) {
+			lost = nflog_ring_lost(r);
+			printf("lost %llu records so far\n",
+			       (unsigned long long)lost);
+		}
+
+		printf("group=%u hook=%u proto=0x%04x mark=%u in=%u out=%u "
+		       "prefix=\"%s\" len=%u cap=%u\n", rec->group, rec->hook,
+		       rec->hw_protocol, rec->mark, rec->indev, rec->outdev,
+		       rec->prefix, rec->payload_len, rec->caplen);
+	}
+
+	free(rec);
+	nflog_ring_close(r);
+	return EXIT_FAILURE;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-g group] [-s slots] [-z slot_size] -n name\n"
+			"       %s -r -n name\n", prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int group = 1, slots = 65536, slot_size = 256;
+	const char *name = NULL;
+	int opt, reader = 0;
+
+	while ((opt = getopt(argc, argv, "g:s:z:n:r")) != -1) {
+		switch (opt) {
+		case 'g':
+			group = atoi(optarg);
+			break;
+		case 's':
+			slots = atoi(optarg);
+			break;
+		case 'z':
+			slot_size = atoi(optarg);
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'r':
+			reader = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!name)
+		usage(argv[0]);
+
+	if (reader)
+		return read_ring(name);
+
+	return publish(name, group, slots, slot_size);
+}
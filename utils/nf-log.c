@@ -1,6 +1,19 @@
 /* This example is placed in the public domain. */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
 #include <libnetfilter_log/linux_nfnetlink_log.h>
@@ -8,13 +21,9 @@
 #include <libmnl/libmnl.h>
 #include <libnetfilter_log/libnetfilter_log.h>
 
-#ifdef BUILD_NFCT
 #include <linux/netfilter/nf_conntrack_common.h>
 #include <linux/netfilter/nf_conntrack_tuple_common.h>
-#include <libnetfilter_conntrack/libnetfilter_conntrack.h>
-#endif
 
-#ifdef BUILD_NFCT
 static int print_ctinfo(const struct nlattr *const attr)
 {
 	uint32_t ctinfo;
@@ -58,12 +67,25 @@ static int print_ctinfo(const struct nlattr *const attr)
 	return MNL_CB_OK;
 }
 
-static int print_nfct(uint8_t family,
-		      const struct nlattr *const info_attr,
+static void print_tuple(const struct nflog_ct_tuple *t)
+{
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	inet_ntop(t->family, &t->src, src, sizeof(src));
+	inet_ntop(t->family, &t->dst, dst, sizeof(dst));
+
+	printf(" src=%s dst=%s", src, dst);
+	if (t->l4proto == IPPROTO_ICMP || t->l4proto == IPPROTO_ICMPV6)
+		printf(" type=%u code=%u id=%u",
+		       t->icmp_type, t->icmp_code, t->sport);
+	else
+		printf(" sport=%u dport=%u", t->sport, t->dport);
+}
+
+static int print_nfct(const struct nlattr *const info_attr,
 		      const struct nlattr *const ct_attr)
 {
-	char buf[4096];
-	struct nf_conntrack *ct = NULL;
+	struct nflog_ct ct;
 
 	if (info_attr != NULL)
 		print_ctinfo(info_attr);
@@ -71,40 +93,32 @@ static int print_nfct(uint8_t family,
 	if (ct_attr == NULL)
 		return MNL_CB_OK;
 
-	ct = nfct_new();
-	if (ct == NULL) {
-		perror("nfct_new");
+	if (nflog_ct_parse(mnl_attr_get_payload(ct_attr),
+			   mnl_attr_get_payload_len(ct_attr), &ct) < 0) {
+		perror("nflog_ct_parse");
 		return MNL_CB_ERROR;
 	}
 
-	if (nfct_payload_parse(mnl_attr_get_payload(ct_attr),
-			       mnl_attr_get_payload_len(ct_attr),
-			       family, ct) < 0) {
-		perror("nfct_payload_parse");
-		nfct_destroy(ct);
-		return MNL_CB_ERROR;
-	}
-
-	nfct_snprintf(buf, sizeof(buf), ct, 0, NFCT_O_DEFAULT, 0);
-	printf("  %s\n", buf);
-	nfct_destroy(ct);
+	printf("  proto=%u", ct.orig.l4proto);
+	if (ct.attrs & NFLOG_CT_F_ORIG)
+		print_tuple(&ct.orig);
+	if (ct.attrs & NFLOG_CT_F_REPLY)
+		print_tuple(&ct.reply);
+	if (ct.attrs & NFLOG_CT_F_MARK)
+		printf(" mark=%u", ct.mark);
+	if (ct.attrs & NFLOG_CT_F_ZONE)
+		printf(" zone=%u", ct.zone);
+	if (ct.attrs & NFLOG_CT_F_ID)
+		printf(" id=%u", ct.id);
+	printf("\n");
 
 	return MNL_CB_OK;
 }
-#else
-static int print_nfct(uint8_t family,
-		      const struct nlattr *const info_attr,
-		      const struct nlattr *const ct_attr)
-{
-	return MNL_CB_OK;
-}
-#endif
 
 static int log_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *attrs[NFULA_MAX + 1] = { NULL };
 	struct nfulnl_msg_packet_hdr *ph = NULL;
-	struct nfgenmsg *nfg;
 	const char *prefix = NULL;
 	uint32_t mark = 0;
 	char buf[4096];
@@ -114,8 +128,6 @@ static int log_cb(const struct nlmsghdr *nlh, void *data)
 	if (ret != MNL_CB_OK)
 		return ret;
 
-	nfg = mnl_nlmsg_get_payload(nlh);
-
 	if (attrs[NFULA_PACKET_HDR])
 		ph = mnl_attr_get_payload(attrs[NFULA_PACKET_HDR]);
 	if (attrs[NFULA_PREFIX])
@@ -128,112 +140,1107 @@ static int log_cb(const struct nlmsghdr *nlh, void *data)
 		mark);
 
 	ret = nflog_nlmsg_snprintf(buf, sizeof(buf), nlh, attrs,
-				   NFLOG_OUTPUT_XML, NFLOG_XML_ALL);
+				   NFLOG_OUTPUT_XML, NFLOG_XML_ALL_EXT);
 	if (ret < 0)
 		return MNL_CB_ERROR;
 	printf("%s (ret=%d)\n", buf, ret);
 
-	print_nfct(nfg->nfgen_family, attrs[NFULA_CT_INFO], attrs[NFULA_CT]);
+	print_nfct(attrs[NFULA_CT_INFO], attrs[NFULA_CT]);
 
 	return MNL_CB_OK;
 }
 
-int main(int argc, char *argv[])
+/* set by SIGINT and SIGTERM */
+static volatile sig_atomic_t stop;
+
+/* a datagram holds at least one message, with up to 64 KiB of packet */
+#define RECV_BUFSIZ	(65536 + 4096)
+
+/*
+ * Daemon mode: serve the records to subscribers connected to a UNIX socket.
+ *
+ * A subscriber connects and sends one line of space separated options:
+ *
+ *	format=text|xml|json	output format, text by default
+ *	prefix=STRING		only records with this prefix
+ *	mark=MIN[-MAX]		only records with a mark in this range
+ *	hook=N			only records logged from this hook
+ *	indev=N			only records received on this interface index
+ *	slow=sample|drop|disconnect
+ *				what to do when the subscriber falls behind
+ *	sample=N		keep one record out of N when sampling
+ *
+ * and then reads one record per line. Records for a subscriber are gathered
+ * in a buffer that is written out once per batch of datagrams. When the
+ * buffer is more than half full, only one record out of N is kept (sample,
+ * the default), and records that do not fit are dropped, a line starting
+ * with '#' telling how many. With slow=disconnect, the subscriber is
+ * disconnected instead. Either way, the daemon never waits for subscribers.
+ */
+#define SUB_MAX		64
+#define SUB_BUFSIZ	(64 * 1024)
+#define SUB_LINE_MAX	512
+#define SUB_SAMPLE	10
+#define RECORD_MAX	8192
+
+enum sub_format {
+	SUB_TEXT,
+	SUB_XML,
+	SUB_JSON,
+	SUB_FORMAT_MAX,
+};
+
+enum sub_slow {
+	SUB_SLOW_SAMPLE,
+	SUB_SLOW_DROP,
+	SUB_SLOW_DISCONNECT,
+};
+
+struct subscriber {
+	int		fd;
+	int		ready;		/* options received */
+	char		line[SUB_LINE_MAX];
+	size_t		line_len;
+
+	enum sub_format	format;
+	char		prefix[64];
+	int		has_prefix;
+	uint32_t	mark_min, mark_max;
+	int		has_mark;
+	int		hook;		/* -1 for any */
+	uint32_t	indev;
+	int		has_indev;
+	enum sub_slow	slow;
+	unsigned int	sample;
+	unsigned int	seen;		/* while sampling */
+	unsigned long long dropped;	/* not reported yet */
+
+	char		buf[SUB_BUFSIZ];
+	size_t		len;
+};
+
+static struct subscriber *subs[SUB_MAX];
+
+/* a log message formatted for the subscribers, on demand */
+struct record {
+	const struct nlmsghdr	*nlh;
+	struct nlattr		*attrs[NFULA_MAX + 1];
+	int			len[SUB_FORMAT_MAX];	/* -1 until formatted */
+	char			buf[SUB_FORMAT_MAX][RECORD_MAX];
+};
+
+static void sub_close(struct subscriber **sp)
 {
-	struct mnl_socket *nl;
-	char buf[MNL_SOCKET_BUFFER_SIZE];
-	struct nlmsghdr *nlh;
+	close((*sp)->fd);
+	free(*sp);
+	*sp = NULL;
+}
+
+static int sub_option(struct subscriber *s, const char *key, const char *val)
+{
+	char *end;
+
+	if (strcmp(key, "format") == 0) {
+		if (strcmp(val, "text") == 0)
+			s->format = SUB_TEXT;
+		else if (strcmp(val, "xml") == 0)
+			s->format = SUB_XML;
+		else if (strcmp(val, "json") == 0)
+			s->format = SUB_JSON;
+		else
+			return -1;
+	} else if (strcmp(key, "prefix") == 0) {
+		if (strlen(val) >= sizeof(s->prefix))
+			return -1;
+		strcpy(s->prefix, val);
+		s->has_prefix = 1;
+	} else if (strcmp(key, "mark") == 0) {
+		s->mark_min = s->mark_max = strtoul(val, &end, 0);
+		if (*end == '-')
+			s->mark_max = strtoul(end + 1, &end, 0);
+		if (*end != '\0' || s->mark_max < s->mark_min)
+			return -1;
+		s->has_mark = 1;
+	} else if (strcmp(key, "hook") == 0) {
+		s->hook = strtoul(val, &end, 0);
+		if (*end != '\0')
+			return -1;
+	} else if (strcmp(key, "indev") == 0) {
+		s->indev = strtoul(val, &end, 0);
+		if (*end != '\0')
+			return -1;
+		s->has_indev = 1;
+	} else if (strcmp(key, "slow") == 0) {
+		if (strcmp(val, "sample") == 0)
+			s->slow = SUB_SLOW_SAMPLE;
+		else if (strcmp(val, "drop") == 0)
+			s->slow = SUB_SLOW_DROP;
+		else if (strcmp(val, "disconnect") == 0)
+			s->slow = SUB_SLOW_DISCONNECT;
+		else
+			return -1;
+	} else if (strcmp(key, "sample") == 0) {
+		s->sample = strtoul(val, &end, 0);
+		if (*end != '\0' || s->sample == 0)
+			return -1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int sub_parse(struct subscriber *s)
+{
+	char *tok, *val, *save;
+
+	for (tok = strtok_r(s->line, " \t\r", &save); tok;
+	     tok = strtok_r(NULL, " \t\r", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+		if (sub_option(s, tok, val) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* read the options line of a new subscriber, or notice it went away */
+static void sub_read(struct subscriber **sp)
+{
+	struct subscriber *s = *sp;
+	char *nl;
+	ssize_t ret;
+
+	ret = recv(s->fd, s->line + s->line_len,
+		   sizeof(s->line) - 1 - s->line_len, MSG_DONTWAIT);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (ret <= 0 || s->ready) {
+		/* subscribers have nothing to say once subscribed */
+		sub_close(sp);
+		return;
+	}
+
+	s->line_len += ret;
+	s->line[s->line_len] = '\0';
+	nl = strchr(s->line, '\n');
+	if (!nl) {
+		if (s->line_len == sizeof(s->line) - 1)
+			sub_close(sp);
+		return;
+	}
+
+	*nl = '\0';
+	if (sub_parse(s) < 0) {
+		send(s->fd, "# bad options\n", 14, MSG_NOSIGNAL);
+		sub_close(sp);
+		return;
+	}
+	s->ready = 1;
+}
+
+static void sub_accept(int lfd)
+{
+	struct subscriber *s;
+	int fd, i;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	for (i = 0; i < SUB_MAX && subs[i]; i++)
+		;
+	if (i == SUB_MAX) {
+		close(fd);
+		return;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		close(fd);
+		return;
+	}
+	s->fd = fd;
+	s->hook = -1;
+	s->sample = SUB_SAMPLE;
+	subs[i] = s;
+}
+
+static void sub_flush(struct subscriber **sp)
+{
+	struct subscriber *s = *sp;
+	ssize_t ret;
+
+	if (s->len == 0)
+		return;
+
+	ret = send(s->fd, s->buf, s->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			sub_close(sp);
+		return;
+	}
+
+	memmove(s->buf, s->buf + ret, s->len - ret);
+	s->len -= ret;
+}
+
+static int sub_match(const struct subscriber *s, struct nlattr **attrs)
+{
+	struct nfulnl_msg_packet_hdr *ph;
+	uint32_t mark = 0, indev = 0;
+
+	if (s->has_prefix &&
+	    (!attrs[NFULA_PREFIX] ||
+	     strcmp(mnl_attr_get_str(attrs[NFULA_PREFIX]), s->prefix) != 0))
+		return 0;
+
+	if (s->has_mark) {
+		if (attrs[NFULA_MARK])
+			mark = ntohl(mnl_attr_get_u32(attrs[NFULA_MARK]));
+		if (mark < s->mark_min || mark > s->mark_max)
+			return 0;
+	}
+
+	if (s->hook >= 0) {
+		if (!attrs[NFULA_PACKET_HDR])
+			return 0;
+		ph = mnl_attr_get_payload(attrs[NFULA_PACKET_HDR]);
+		if (ph->hook != s->hook)
+			return 0;
+	}
+
+	if (s->has_indev) {
+		if (attrs[NFULA_IFINDEX_INDEV])
+			indev = ntohl(mnl_attr_get_u32(attrs[NFULA_IFINDEX_INDEV]));
+		if (indev != s->indev)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int record_format(struct record *r, enum sub_format format)
+{
+	struct nlattr **attrs = r->attrs;
+	struct nfulnl_msg_packet_hdr *ph = NULL;
+	char *buf = r->buf[format];
+	int len;
+
+	if (r->len[format] >= 0)
+		return r->len[format];
+
+	switch (format) {
+	case SUB_TEXT:
+		if (attrs[NFULA_PACKET_HDR])
+			ph = mnl_attr_get_payload(attrs[NFULA_PACKET_HDR]);
+		len = snprintf(buf, RECORD_MAX - 1,
+			       "prefix=\"%s\" hw=0x%04x hook=%u mark=%u",
+			       attrs[NFULA_PREFIX] ?
+			       mnl_attr_get_str(attrs[NFULA_PREFIX]) : "",
+			       ph ? ntohs(ph->hw_protocol) : 0,
+			       ph ? ph->hook : 0,
+			       attrs[NFULA_MARK] ?
+			       ntohl(mnl_attr_get_u32(attrs[NFULA_MARK])) : 0);
+		break;
+	case SUB_XML:
+		len = nflog_nlmsg_snprintf(buf, RECORD_MAX - 1, r->nlh, attrs,
+					   NFLOG_OUTPUT_XML, NFLOG_XML_ALL_EXT);
+		break;
+	case SUB_JSON:
+		len = nflog_nlmsg_snprintf(buf, RECORD_MAX - 1, r->nlh, attrs,
+					   NFLOG_OUTPUT_JSON, NFLOG_XML_ALL_EXT);
+		break;
+	default:
+		len = -1;
+	}
+
+	/* snprintf() style, a record that does not fit is not sent */
+	if (len < 0 || len >= RECORD_MAX - 1) {
+		r->len[format] = 0;
+		return 0;
+	}
+
+	buf[len++] = '\n';
+	r->len[format] = len;
+	return len;
+}
+
+static void sub_queue(struct subscriber **sp, struct record *r)
+{
+	struct subscriber *s = *sp;
+	char note[64];
+	int len, n;
+
+	if (!s->ready || !sub_match(s, r->attrs))
+		return;
+
+	len = record_format(r, s->format);
+	if (len == 0)
+		return;
+
+	if (s->len > SUB_BUFSIZ / 2 && s->slow == SUB_SLOW_SAMPLE &&
+	    s->seen++ % s->sample) {
+		s->dropped++;
+		return;
+	}
+
+	if (s->dropped) {
+		n = snprintf(note, sizeof(note), "# dropped %llu records\n",
+			     s->dropped);
+		if (s->len + n + len <= SUB_BUFSIZ) {
+			memcpy(s->buf + s->len, note, n);
+			s->len += n;
+			s->dropped = 0;
+		}
+	}
+
+	if (s->len + len > SUB_BUFSIZ) {
+		if (s->slow == SUB_SLOW_DISCONNECT)
+			sub_close(sp);
+		else
+			s->dropped++;
+		return;
+	}
+
+	memcpy(s->buf + s->len, r->buf[s->format], len);
+	s->len += len;
+}
+
+static int serve_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct record *r = data;
+	int ret, i;
+
+	memset(r->attrs, 0, sizeof(r->attrs));
+	ret = nflog_nlmsg_parse(nlh, r->attrs);
+	if (ret != MNL_CB_OK)
+		return ret;
+
+	r->nlh = nlh;
+	for (i = 0; i < SUB_FORMAT_MAX; i++)
+		r->len[i] = -1;
+
+	for (i = 0; i < SUB_MAX; i++) {
+		if (subs[i])
+			sub_queue(&subs[i], r);
+	}
+
+	return MNL_CB_OK;
+}
+
+static int serve_listen(const char *path)
+{
+	struct sockaddr_un sun = {
+		.sun_family	= AF_UNIX,
+	};
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    listen(fd, SUB_MAX) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* receive up to this many datagrams before writing to the subscribers */
+#define SERVE_BATCH	16
+
+static void serve(struct mnl_socket *nl, unsigned int portid, int lfd)
+{
+	struct pollfd pfd[2 + SUB_MAX];
+	static char buf[RECV_BUFSIZ];
+	static struct record r;
+	int i, n, ret;
+
+	while (!stop) {
+		pfd[0] = (struct pollfd) {
+			.fd	= mnl_socket_get_fd(nl),
+			.events	= POLLIN,
+		};
+		pfd[1] = (struct pollfd) {
+			.fd	= lfd,
+			.events	= POLLIN,
+		};
+		for (i = 0; i < SUB_MAX; i++) {
+			pfd[2 + i] = (struct pollfd) {
+				.fd	= subs[i] ? subs[i]->fd : -1,
+				.events	= POLLIN,
+			};
+			if (subs[i] && subs[i]->len)
+				pfd[2 + i].events |= POLLOUT;
+		}
+
+		if (poll(pfd, 2 + SUB_MAX, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return;
+		}
+
+		for (n = 0; n < SERVE_BATCH && (pfd[0].revents & POLLIN); n++) {
+			ret = recv(pfd[0].fd, buf, sizeof(buf), MSG_DONTWAIT);
+			if (ret < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				if (errno == ENOBUFS) {
+					fprintf(stderr, "netlink overrun, "
+						"messages lost\n");
+					continue;
+				}
+				perror("recv");
+				return;
+			}
+
+			if (mnl_cb_run(buf, ret, 0, portid, serve_cb, &r) < 0)
+				perror("mnl_cb_run");
+		}
+
+		if (pfd[1].revents & POLLIN)
+			sub_accept(lfd);
+
+		for (i = 0; i < SUB_MAX; i++) {
+			if (subs[i] && (pfd[2 + i].revents &
+					(POLLIN | POLLHUP | POLLERR)))
+				sub_read(&subs[i]);
+			if (subs[i])
+				sub_flush(&subs[i]);
+		}
+	}
+}
+
+
+/*
+ * Collector mode: the groups are spread over several worker threads, each
+ * with its own netlink socket, that receive in batches and write the
+ * messages to a common sink in one of these formats:
+ *
+ *	text	the human readable dump above
+ *	xml	one XML record per line
+ *	json	one JSON object per line
+ *	pcapng	LINKTYPE_NFLOG packets, as read by tcpdump and wireshark
+ *	bin	the netlink messages as received, each padded to 4 bytes
+ *	capture	the datagrams as received, with their arrival time, in the
+ *		format of nflog_set_capture(), for nf-log-replay
+ */
+#define WORKER_MAX	64
+#define GROUP_MAX	256
+#define RECV_BATCH	16
+#define OUT_BUFSIZ	(256 * 1024)
+#define LINKTYPE_NFLOG	239
+
+enum sink_format {
+	SINK_TEXT,
+	SINK_XML,
+	SINK_JSON,
+	SINK_PCAPNG,
+	SINK_BIN,
+	SINK_CAPTURE,
+};
+
+struct sink {
+	enum sink_format	format;
+	FILE			*fp;
+	pthread_mutex_t		lock;
+	int			failed;
+};
+
+struct worker_stats {
+	uint64_t	datagrams;
+	uint64_t	messages;
+	uint64_t	bytes;
+	uint64_t	enobufs;
+	uint64_t	truncated;
+	uint64_t	errors;
+};
+
+struct worker {
+	int			id;
+	pthread_t		thread;
+	struct mnl_socket	*nl;
+	unsigned int		portid;
+	struct sink		*sink;
+	struct worker_stats	st;	/* written by the worker only */
+	uint32_t		seq;	/* of the last config request */
+	char			buf[RECV_BATCH][RECV_BUFSIZ];
+	struct nflog_strbuf	fmt;	/* reused, grows to the largest record */
+	size_t			len;
+	char			out[OUT_BUFSIZ];
+};
+
+/* counters are written by their worker and read by the main thread */
+#define STAT_ADD(w, field, n)						\
+	__atomic_store_n(&(w)->st.field, (w)->st.field + (n), __ATOMIC_RELAXED)
+#define STAT_GET(w, field)						\
+	__atomic_load_n(&(w)->st.field, __ATOMIC_RELAXED)
+
+static void sink_write(struct sink *sink, const void *buf, size_t len)
+{
+	pthread_mutex_lock(&sink->lock);
+	if (!sink->failed &&
+	    (fwrite(buf, 1, len, sink->fp) != len || fflush(sink->fp) != 0)) {
+		perror("write");
+		sink->failed = 1;
+		stop = 1;
+	}
+	pthread_mutex_unlock(&sink->lock);
+}
+
+static void worker_flush(struct worker *w)
+{
+	if (w->len) {
+		sink_write(w->sink, w->out, w->len);
+		w->len = 0;
+	}
+}
+
+static void worker_append(struct worker *w, const void *buf, size_t len)
+{
+	if (w->len + len > sizeof(w->out))
+		worker_flush(w);
+	if (len > sizeof(w->out)) {
+		sink_write(w->sink, buf, len);
+		return;
+	}
+	memcpy(w->out + w->len, buf, len);
+	w->len += len;
+}
+
+/* keep a record of len bytes in one piece, other workers share the sink */
+static void worker_reserve(struct worker *w, size_t len)
+{
+	if (w->len + len > sizeof(w->out))
+		worker_flush(w);
+}
+
+static void pcapng_block(struct worker *w, uint32_t type, const void *body,
+			 uint32_t len, const void *data, uint32_t data_len)
+{
+	static const char pad[4];
+	uint32_t total = 12 + len + ((data_len + 3) & ~3);
+
+	worker_reserve(w, total);
+	worker_append(w, &type, sizeof(type));
+	worker_append(w, &total, sizeof(total));
+	worker_append(w, body, len);
+	worker_append(w, data, data_len);
+	worker_append(w, pad, ((data_len + 3) & ~3) - data_len);
+	worker_append(w, &total, sizeof(total));
+}
+
+static void pcapng_header(struct worker *w)
+{
+	struct {
+		uint32_t	magic;
+		uint16_t	major, minor;
+		int64_t		section_len;
+	} shb = { 0x1a2b3c4d, 1, 0, -1 };
+	struct {
+		uint16_t	linktype, reserved;
+		uint32_t	snaplen;
+	} idb = { LINKTYPE_NFLOG, 0, 0 };
+
+	pcapng_block(w, 0x0a0d0d0a, &shb, sizeof(shb), NULL, 0);
+	pcapng_block(w, 0x00000001, &idb, sizeof(idb), NULL, 0);
+}
+
+static void pcapng_packet(struct worker *w, const struct nlmsghdr *nlh,
+			  struct nlattr **attrs)
+{
+	struct nfulnl_msg_packet_timestamp *ts;
+	uint32_t len = nlh->nlmsg_len - MNL_NLMSG_HDRLEN;
+	struct timeval tv;
+	uint64_t usec;
+	struct {
+		uint32_t	interface;
+		uint32_t	ts_high, ts_low;
+		uint32_t	caplen, len;
+	} epb;
+
+	if (attrs[NFULA_TIMESTAMP]) {
+		ts = mnl_attr_get_payload(attrs[NFULA_TIMESTAMP]);
+		usec = be64toh(ts->sec) * 1000000 + be64toh(ts->usec);
+	} else {
+		gettimeofday(&tv, NULL);
+		usec = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+
+	epb.interface = 0;
+	epb.ts_high = usec >> 32;
+	epb.ts_low = usec;
+	epb.caplen = epb.len = len;
+
+	/* LINKTYPE_NFLOG is the nfgenmsg header and the attributes */
+	pcapng_block(w, 0x00000006, &epb, sizeof(epb),
+		     mnl_nlmsg_get_payload(nlh), len);
+}
+
+static void capture_record(struct worker *w, const void *buf, uint32_t len,
+			   uint64_t tstamp, uint32_t flags)
+{
+	static const char pad[8];
+	struct nflog_capture_rec rec = {
+		.tstamp_ns	= tstamp,
+		.len		= len,
+		.flags		= flags,
+	};
+
+	worker_reserve(w, sizeof(rec) + NFLOG_CAPTURE_ALIGN(len));
+	worker_append(w, &rec, sizeof(rec));
+	worker_append(w, buf, len);
+	worker_append(w, pad, NFLOG_CAPTURE_ALIGN(len) - len);
+}
+
+static int collect_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *attrs[NFULA_MAX + 1] = { NULL };
+	static const char pad[4];
+	struct worker *w = data;
 	int ret;
-	unsigned int portid, gnum;
 
-	if (argc != 2) {
-		printf("Usage: %s [queue_num]\n", argv[0]);
-		exit(EXIT_FAILURE);
+	STAT_ADD(w, messages, 1);
+	STAT_ADD(w, bytes, nlh->nlmsg_len);
+
+	switch (w->sink->format) {
+	case SINK_TEXT:
+		pthread_mutex_lock(&w->sink->lock);
+		ret = log_cb(nlh, NULL);
+		pthread_mutex_unlock(&w->sink->lock);
+		return ret;
+	case SINK_BIN:
+		worker_reserve(w, MNL_ALIGN(nlh->nlmsg_len));
+		worker_append(w, nlh, nlh->nlmsg_len);
+		worker_append(w, pad, MNL_ALIGN(nlh->nlmsg_len) - nlh->nlmsg_len);
+		return MNL_CB_OK;
+	case SINK_CAPTURE:
+		/* written whole by worker_run() */
+		return MNL_CB_OK;
+	default:
+		break;
+	}
+
+	ret = nflog_nlmsg_parse(nlh, attrs);
+	if (ret != MNL_CB_OK)
+		return ret;
+
+	if (w->sink->format == SINK_PCAPNG) {
+		pcapng_packet(w, nlh, attrs);
+		return MNL_CB_OK;
+	}
+
+	w->fmt.len = 0;
+	ret = nflog_nlmsg_strbuf_append(&w->fmt, nlh, attrs,
+					w->sink->format == SINK_JSON ?
+					NFLOG_OUTPUT_JSON : NFLOG_OUTPUT_XML,
+					NFLOG_XML_ALL_EXT);
+	if (ret < 0)
+		return MNL_CB_ERROR;
+
+	/* in place of the NUL, so that the record goes out in one piece */
+	w->fmt.data[w->fmt.len] = '\n';
+	worker_append(w, w->fmt.data, w->fmt.len + 1);
+	return MNL_CB_OK;
+}
+
+static void *worker_run(void *data)
+{
+	struct mmsghdr msgs[RECV_BATCH];
+	struct iovec iov[RECV_BATCH];
+	struct worker *w = data;
+	struct pollfd pfd = {
+		.fd	= mnl_socket_get_fd(w->nl),
+		.events	= POLLIN,
+	};
+	int i, ret;
+
+	while (!stop) {
+		/* wake up now and then to notice we have to stop */
+		ret = poll(&pfd, 1, 250);
+		if (ret <= 0)
+			continue;
+
+		for (i = 0; i < RECV_BATCH; i++) {
+			iov[i].iov_base = w->buf[i];
+			iov[i].iov_len = sizeof(w->buf[i]);
+			msgs[i].msg_hdr = (struct msghdr) {
+				.msg_iov	= &iov[i],
+				.msg_iovlen	= 1,
+			};
+		}
+
+		ret = recvmmsg(pfd.fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+		if (ret < 0) {
+			if (errno == ENOBUFS)
+				STAT_ADD(w, enobufs, 1);
+			else if (errno != EAGAIN && errno != EINTR)
+				STAT_ADD(w, errors, 1);
+			continue;
+		}
+
+		STAT_ADD(w, datagrams, ret);
+		if (w->sink->format == SINK_CAPTURE) {
+			struct timespec ts;
+			uint64_t tstamp;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			tstamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+			for (i = 0; i < ret; i++)
+				capture_record(w, w->buf[i], msgs[i].msg_len,
+					       tstamp,
+					       msgs[i].msg_hdr.msg_flags & MSG_TRUNC ?
+					       NFLOG_CAPTURE_F_TRUNC : 0);
+		}
+		for (i = 0; i < ret; i++) {
+			/* cannot be parsed, a capture keeps it flagged */
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				STAT_ADD(w, truncated, 1);
+				continue;
+			}
+			if (mnl_cb_run(w->buf[i], msgs[i].msg_len, 0, w->portid,
+				       collect_cb, w) < 0)
+				STAT_ADD(w, errors, 1);
+		}
+		worker_flush(w);
+	}
+
+	worker_flush(w);
+	return NULL;
+}
+
+/*
+ * Send a config request and wait for the kernel to ack it, eg. to learn that
+ * another process has the group. The log messages of the groups bound so far
+ * are dropped meanwhile, the workers have not started yet.
+ */
+static int cfg_query(struct worker *w, struct nlmsghdr *nlh)
+{
+	const struct nlmsghdr *reply;
+	const struct nlmsgerr *err;
+	int len;
+
+	nlh->nlmsg_flags |= NLM_F_ACK;
+	nlh->nlmsg_seq = ++w->seq;
+	if (mnl_socket_sendto(w->nl, nlh, nlh->nlmsg_len) < 0)
+		return -1;
+
+	for (;;) {
+		len = mnl_socket_recvfrom(w->nl, w->buf[0], sizeof(w->buf[0]));
+		if (len < 0) {
+			if (errno == ENOBUFS)
+				continue;
+			return -1;
+		}
+
+		for (reply = (struct nlmsghdr *)w->buf[0];
+		     mnl_nlmsg_ok(reply, len);
+		     reply = mnl_nlmsg_next(reply, &len)) {
+			if (reply->nlmsg_type != NLMSG_ERROR ||
+			    reply->nlmsg_seq != w->seq)
+				continue;
+
+			err = mnl_nlmsg_get_payload(reply);
+			if (err->error) {
+				errno = -err->error;
+				return -1;
+			}
+			return 0;
+		}
 	}
-	gnum = atoi(argv[1]);
+}
+
+static int send_cfg_cmd(struct worker *w, uint8_t family, uint16_t gnum,
+			uint8_t cmd)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
 
-	nl = mnl_socket_open(NETLINK_NETFILTER);
-	if (nl == NULL) {
+	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, family, gnum);
+	if (nflog_attr_put_cfg_cmd(nlh, cmd) < 0)
+		return -1;
+
+	/* the answer depends on the kernel version, see worker_open() */
+	if (cmd == NFULNL_CFG_CMD_PF_BIND || cmd == NFULNL_CFG_CMD_PF_UNBIND)
+		return mnl_socket_sendto(w->nl, nlh, nlh->nlmsg_len);
+
+	return cfg_query(w, nlh);
+}
+
+static int send_cfg_mode(struct worker *w, uint16_t gnum, uint16_t flags)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+
+	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, AF_UNSPEC, gnum);
+	if (nflog_attr_put_cfg_mode(nlh, NFULNL_COPY_PACKET, 0xffff) < 0)
+		return -1;
+
+	if (flags)
+		mnl_attr_put_u16(nlh, NFULA_CFG_FLAGS, htons(flags));
+
+	return cfg_query(w, nlh);
+}
+
+/* open the socket of worker _id_ and bind it to its share of the groups */
+static int worker_open(struct worker *w, const unsigned int *groups,
+		       unsigned int ngroups, unsigned int nworkers)
+{
+	unsigned int i;
+
+	w->nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (w->nl == NULL) {
 		perror("mnl_socket_open");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
-	if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+	if (mnl_socket_bind(w->nl, 0, MNL_SOCKET_AUTOPID) < 0) {
 		perror("mnl_socket_bind");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
-	portid = mnl_socket_get_portid(nl);
+	w->portid = mnl_socket_get_portid(w->nl);
 
 	/* kernels 3.8 and later is required to omit PF_(UN)BIND */
-
-	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, AF_INET, 0);
-	if (nflog_attr_put_cfg_cmd(nlh, NFULNL_CFG_CMD_PF_UNBIND) < 0) {
+	if (w->id == 0 &&
+	    (send_cfg_cmd(w, AF_INET, 0, NFULNL_CFG_CMD_PF_UNBIND) < 0 ||
+	     send_cfg_cmd(w, AF_INET, 0, NFULNL_CFG_CMD_PF_BIND) < 0)) {
 		perror("nflog_attr_put_cfg_cmd");
-		exit(EXIT_FAILURE);
+		return -1;
 	}
 
-	if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0) {
-		perror("mnl_socket_sendto");
-		exit(EXIT_FAILURE);
+	for (i = w->id; i < ngroups; i += nworkers) {
+		/* the conntrack entries, unless the kernel cannot attach them */
+		if (send_cfg_cmd(w, AF_INET, groups[i],
+				 NFULNL_CFG_CMD_BIND) < 0 ||
+		    (send_cfg_mode(w, groups[i], NFULNL_CFG_F_CONNTRACK) < 0 &&
+		     (errno != EOPNOTSUPP ||
+		      send_cfg_mode(w, groups[i], 0) < 0))) {
+			fprintf(stderr, "group %u: %s\n", groups[i],
+				strerror(errno));
+			return -1;
+		}
 	}
 
-	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, AF_INET, 0);
-	if (nflog_attr_put_cfg_cmd(nlh, NFULNL_CFG_CMD_PF_BIND) < 0) {
-		perror("nflog_attr_put_cfg_cmd");
-		exit(EXIT_FAILURE);
+	return 0;
+}
+
+static void print_stats(struct worker *workers, unsigned int nworkers,
+			struct worker_stats *last, double elapsed)
+{
+	struct worker_stats now = {};
+	unsigned int i;
+
+	for (i = 0; i < nworkers; i++) {
+		now.datagrams += STAT_GET(&workers[i], datagrams);
+		now.messages += STAT_GET(&workers[i], messages);
+		now.bytes += STAT_GET(&workers[i], bytes);
+		now.enobufs += STAT_GET(&workers[i], enobufs);
+		now.truncated += STAT_GET(&workers[i], truncated);
+		now.errors += STAT_GET(&workers[i], errors);
 	}
 
-	if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0) {
-		perror("mnl_socket_sendto");
-		exit(EXIT_FAILURE);
+	fprintf(stderr, "%.0f msg/s %.2f MB/s %.1f msg/datagram "
+		"overruns %llu truncated %llu errors %llu\n",
+		(now.messages - last->messages) / elapsed,
+		(now.bytes - last->bytes) / elapsed / 1e6,
+		now.datagrams > last->datagrams ?
+		(double)(now.messages - last->messages) /
+		(now.datagrams - last->datagrams) : 0.0,
+		(unsigned long long)now.enobufs,
+		(unsigned long long)now.truncated,
+		(unsigned long long)now.errors);
+
+	*last = now;
+}
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-f text|xml|json|pcapng|bin|capture] [-o file] "
+	       "[-w workers] [-s interval] [-d socket_path] group...\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker *workers;
+	unsigned int groups[GROUP_MAX], ngroups = 0, nworkers = 1;
+	unsigned int i, interval = 0;
+	struct sink sink = {
+		.format	= SINK_TEXT,
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct worker_stats last = {};
+	struct sigaction sa = {
+		.sa_handler	= on_signal,
+	};
+	struct timespec start, now;
+	const char *path = NULL, *out = NULL;
+	sigset_t block, old;
+	int opt, lfd = -1, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "f:o:w:s:d:")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				sink.format = SINK_TEXT;
+			else if (strcmp(optarg, "xml") == 0)
+				sink.format = SINK_XML;
+			else if (strcmp(optarg, "json") == 0)
+				sink.format = SINK_JSON;
+			else if (strcmp(optarg, "pcapng") == 0)
+				sink.format = SINK_PCAPNG;
+			else if (strcmp(optarg, "bin") == 0)
+				sink.format = SINK_BIN;
+			else if (strcmp(optarg, "capture") == 0)
+				sink.format = SINK_CAPTURE;
+			else
+				usage(argv[0]);
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'w':
+			nworkers = atoi(optarg);
+			if (nworkers == 0 || nworkers > WORKER_MAX)
+				usage(argv[0]);
+			break;
+		case 's':
+			interval = atoi(optarg);
+			break;
+		case 'd':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
 	}
 
-	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, AF_INET, gnum);
-	if (nflog_attr_put_cfg_cmd(nlh, NFULNL_CFG_CMD_BIND) < 0) {
-		perror("nflog_attr_put_cfg_cmd");
+	if (optind == argc || argc - optind > GROUP_MAX)
+		usage(argv[0]);
+	for (; optind < argc; optind++)
+		groups[ngroups++] = atoi(argv[optind]);
+
+	if (nworkers > ngroups)
+		nworkers = ngroups;
+	if (path && nworkers > 1) {
+		fprintf(stderr, "daemon mode runs a single worker\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0) {
-		perror("mnl_socket_sendto");
+	workers = calloc(nworkers, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
 		exit(EXIT_FAILURE);
 	}
 
-	nlh = nflog_nlmsg_put_header(buf, NFULNL_MSG_CONFIG, AF_UNSPEC, gnum);
-	if (nflog_attr_put_cfg_mode(nlh, NFULNL_COPY_PACKET, 0xffff) < 0) {
-		perror("nflog_attr_put_cfg_mode");
-		exit(EXIT_FAILURE);
+	sink.fp = stdout;
+	if (out) {
+		/* the text dump goes through printf() */
+		sink.fp = sink.format == SINK_TEXT ? freopen(out, "w", stdout) :
+						    fopen(out, "w");
+		if (!sink.fp) {
+			perror(out);
+			exit(EXIT_FAILURE);
+		}
 	}
 
-#ifdef BUILD_NFCT
-	mnl_attr_put_u16(nlh, NFULA_CFG_FLAGS, htons(NFULNL_CFG_F_CONNTRACK));
-#endif
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
 
-	if (mnl_socket_sendto(nl, nlh, nlh->nlmsg_len) < 0) {
-		perror("mnl_socket_sendto");
-		exit(EXIT_FAILURE);
+	for (i = 0; i < nworkers; i++) {
+		workers[i].id = i;
+		workers[i].sink = &sink;
+		if (worker_open(&workers[i], groups, ngroups, nworkers) < 0)
+			exit(EXIT_FAILURE);
 	}
 
-	ret = mnl_socket_recvfrom(nl, buf, sizeof(buf));
-	if (ret == -1) {
-		perror("mnl_socket_recvfrom");
-		exit(EXIT_FAILURE);
-	}
-	while (ret > 0) {
-		ret = mnl_cb_run(buf, ret, 0, portid, log_cb, NULL);
-		if (ret < 0){
-			perror("mnl_cb_run");
+	if (path) {
+		lfd = serve_listen(path);
+		if (lfd < 0) {
+			perror("serve_listen");
 			exit(EXIT_FAILURE);
 		}
+		serve(workers[0].nl, workers[0].portid, lfd);
+		close(lfd);
+		unlink(path);
+		goto out;
+	}
 
-		ret = mnl_socket_recvfrom(nl, buf, sizeof(buf));
-		if (ret == -1) {
-			perror("mnl_socket_recvfrom");
-			exit(EXIT_FAILURE);
+	if (sink.format == SINK_PCAPNG) {
+		pcapng_header(&workers[0]);
+		worker_flush(&workers[0]);
+	} else if (sink.format == SINK_CAPTURE) {
+		struct nflog_capture_hdr hdr = {
+			.magic		= NFLOG_CAPTURE_MAGIC,
+			.version	= NFLOG_CAPTURE_VERSION,
+		};
+
+		sink_write(&sink, &hdr, sizeof(hdr));
+	}
+
+	/* signals are for the main thread, workers poll the flag */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i]) != 0) {
+			fprintf(stderr, "cannot start worker %u\n", i);
+			stop = 1;
+			nworkers = i;
+			ret = EXIT_FAILURE;
+			break;
 		}
 	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
 
-	mnl_socket_close(nl);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!stop) {
+		sleep(interval ? interval : 1);
+		if (!interval || stop)
+			continue;
 
-	return 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		print_stats(workers, nworkers, &last,
+			    now.tv_sec - start.tv_sec +
+			    (now.tv_nsec - start.tv_nsec) / 1e9);
+		start = now;
+	}
+
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+out:
+	for (i = 0; i < nworkers; i++) {
+		mnl_socket_close(workers[i].nl);
+		nflog_strbuf_release(&workers[i].fmt);
+	}
+
+	free(workers);
+
+	if (fclose(sink.fp) != 0 || sink.failed)
+		ret = EXIT_FAILURE;
+
+	return ret;
 }
@@ -70,8 +70,8 @@ int main(int argc, char **argv)
 	struct nflog_handle *h;
 	struct nflog_g_handle *gh;
 	struct nflog_g_handle *gh100;
-	int rv, fd;
-	char buf[4096];
+	int rv;
+	char *buf;
 
 	h = nflog_open();
 	if (!h) {
@@ -110,13 +110,11 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	fd = nflog_fd(h);
-
 	printf("registering callback for group 0\n");
 	nflog_callback_register(gh, &cb, NULL);
 
 	printf("going into main loop\n");
-	while ((rv = recv(fd, buf, sizeof(buf), 0)) && rv >= 0) {
+	while ((rv = nflog_recv(h, &buf)) && rv >= 0) {
 		printf("pkt received (len=%u)\n", rv);
 
 		/* handle messages in just-received packet */
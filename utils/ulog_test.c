@@ -15,7 +15,7 @@
 #include <string.h>
 #include <libnetfilter_log/libipulog.h>
 
-#define MYBUFSIZ 2048
+#define MYBUFSIZ 65536
 
 /* prints some logging about a single packet */
 void handle_packet(ulog_packet_msg_t *pkt)